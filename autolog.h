@@ -20,6 +20,11 @@
 #ifndef _AUTOLOG_H
 #define _AUTOLOG_H
 
+#include <pthread.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/types.h>
+
 
 #ifndef MAX
 #define MAX(A,B) ((A)>(B)?(A):(B))
@@ -37,40 +42,786 @@
 /*#define FILENAME_LEN          27 */           /* Max length of std LT filename WITHOUT extention */
 #define FIELD_LEN		33		/* Max length for most PEST input fields +1 */
 
+/* The column headings of the log, a line at a time: all four are too long for one C89 string literal */
+#define LOG_HEADER_RULE \
+  "############ ################## ################ ########################### #### ############ #################### ### ########## ###### ##### #### ####################### #################### ###\n"
+#define LOG_HEADER_NAMES \
+  "     UTC        OBJECT_NAME          PROPID          RA             dec       AIR  INSTRUMENT        FILTERS        BIN  GRATING    EXPOS SEING  SKY        FILENAME               GroupID        ERR\n"
+#define LOG_HEADER_UNITS \
+  "    START                                                  J2000                                                                      sec   sec  mag             \n"
+#define LOG_HEADER_LINES	4
+#define LOG_HEADER_LEN	(2*(sizeof(LOG_HEADER_RULE)-1) + sizeof(LOG_HEADER_NAMES)-1 + sizeof(LOG_HEADER_UNITS)-1)
+static const char *const log_header[LOG_HEADER_LINES] = {LOG_HEADER_RULE,LOG_HEADER_NAMES,LOG_HEADER_UNITS,LOG_HEADER_RULE};
+
+/* The format of each line in the log */
+#define LOG_ROW_FORMAT "%12s %18.18s %16.16s %13.13s %13.13s %4.2f %12.12s %20s %3d %11.11s %6.1f %5.1f %4.1f %22s %20.20s %d\n"
+
 #define FV FLEN_VALUE      			/* Shorthand FITS definition */
 #define FC FLEN_COMMENT    			/* Shorthand FITS definition */
 
 
 
 
-/* A structure to contain all the interesting data about a particular exposure */
+/* Room in each LogInfo for columns a --schema file adds which LogInfo has no field for.
+ * Each one holds a string or a number, depending on the type of the column */
+#define SCHEMA_MAX_EXTRA	8
+#define SCHEMA_EXTRA_LEN	(FLEN_VALUE+1)
+
+typedef union LogExtra_Union{
+  char str[SCHEMA_EXTRA_LEN];
+  double dval;
+  float fval;
+  int ival;
+}LogExtra;
+
+/* A structure to contain all the interesting data about a particular exposure.
+ * Strings from the header are kept whole. LOG_ROW_FORMAT cuts them to the width
+ * of their column, the other --format writers do not */
 typedef struct LogInfo_Struct{
-  char object[19];
+  char object[FLEN_VALUE];
   char exposure[FILENAME_LENGTH];
-  char ra[14];
-  char dec[14];
+  char ra[FLEN_VALUE];
+  char dec[FLEN_VALUE];
   char utstart[13];
   double mjd;		/* Used for sorting. Not output to log */
   float airmass;
-  char instrume[13];
-  char propid[17];
-  char groupid[21];
+  char instrume[FLEN_VALUE];
+  char propid[FLEN_VALUE];
+  char groupid[FLEN_VALUE];
   float exptime;
-  char grating[12];
-  char filter[48];
+  char grating[FLEN_VALUE+1];	/* Has a ' ' appended */
+  char filter[3*FLEN_VALUE];	/* Up to three filters, comma separated */
   int binning;
   float l1seeing;
   float l1photom;
   float l1skybrt;
   int error;
+  LogExtra extra[SCHEMA_MAX_EXTRA];	/* Columns from a --schema file. See autolog_schema.c */
 }LogInfo;
 
 
-int get_ext(char *fullname,int maxlen,char *ext);
-int dir_exists (char dirname[]);
+/* Which code reads the FITS headers. Chosen with --reader */
+#define READER_CFITSIO	0	/* fits_open_file() and friends. The default */
+#define READER_RAW	1	/* pread() the header blocks and parse the cards ourselves */
+#define READER_URING	2	/* As raw, but many files at once through io_uring. See autolog_uring.c */
+#define READER_MMAP	3	/* As raw, but mmap() the header blocks and parse the cards where they are */
+
+/* Files one io_uring worker keeps in flight at once */
+#define URING_DEPTH		64
+
+/* FITS header blocks, as seen by the raw reader in autolog_rawhdr.c */
+#define RAWHDR_BLOCK_LEN	2880
+#define RAWHDR_CARD_LEN		80
+#define RAWHDR_CARDS_PER_BLOCK	36
+#define RAWHDR_MAX_BLOCKS	1000	/* Give up if there is still no END after this many blocks */
+#define RAWHDR_MORE		(-1)	/* rawhdr_add_block(): no END yet, read the next block */
+#define RAWHDR_MAP_BLOCKS	16	/* rawhdr_map() maps this many blocks first, and doubles it until END */
+
+/* How the raw reader's cards are scanned, chosen for the CPU at run time. See autolog_cardscan.c */
+#define CARDSCAN_SCALAR		0	/* Plain C, a byte or a keyword at a time */
+#define CARDSCAN_SSE2		1	/* 16 bytes at a time */
+#define CARDSCAN_AVX2		2	/* 32 bytes at a time */
+#define CARDSCAN_NLEVELS	3
+
+/* How a FITS file is compressed, going by its name. See rawhdr_compression() */
+#define RAWHDR_PLAIN		0
+#define RAWHDR_GZIP		1	/* .fits.gz. Inflated only as far as the END card */
+#define RAWHDR_TILE		2	/* .fits.fz. The image header is in the first extension */
+
+/* A primary header read by rawhdr_open(). Only the cards up to (not including) END are kept */
+typedef struct RawHeader_Struct{
+  char *cards;			/* ncards * 80 chars, not \0 terminated */
+  int ncards;
+  long bytes_read;		/* Size of the file read to find END */
+  void *map;			/* From rawhdr_map(), cards points into this read only mapping. Else NULL */
+  size_t map_len;
+}RawHeader;
+
+/* An open header, whichever reader is being used */
+typedef struct LogHeader_Struct{
+  int reader;
+  fitsfile *fitsin;		/* READER_CFITSIO */
+  RawHeader raw;		/* READER_RAW */
+  long bytes_read;		/* Read to get to END. For cFITSIO, the size of the header */
+}LogHeader;
+
+struct Schema_Struct;
+
+/* Being polite to Dp(RT). See autolog_iopolicy.c */
+#define IOPOLICY_WINDOW		(512*1024)	/* Bytes at the start of each file whose pages are looked after */
+#define IOPOLICY_POLITE_FILES	2		/* --polite is --pagecache=drop --io-files=2 --io-rate=8M */
+#define IOPOLICY_POLITE_RATE	(8*1024*1024)
+
+typedef struct IoPolicy_Struct{
+  int drop;			/* --pagecache=drop */
+  int max_files;		/* --io-files. Files being read at once, over all threads. 0 for no limit */
+  double max_rate;		/* --io-rate. Header bytes per second. 0 for no limit */
+  pthread_mutex_t lock;
+  pthread_cond_t free;		/* A file has been finished with */
+  int nfiles;			/* Being read now */
+  double ready_at;		/* trace_now() before which no file may start, for max_rate */
+}IoPolicy;
+
+/* Which pages of a file were in the page cache before autolog read it */
+typedef struct PageSnapshot_Struct{
+  int fd;			/* -1 if there is no snapshot */
+  int own_fd;			/* iopolicy_snapshot() opened fd, so closes it again */
+  long pagesize;
+  size_t npages;		/* Pages in resident */
+  unsigned char resident[IOPOLICY_WINDOW/4096];	/* As from mincore() */
+}PageSnapshot;
+
+/* How extract_LogInfo() should read each file. Set up once by main() */
+typedef struct ExtractConfig_Struct{
+  const char *dirname;
+  int reader;			/* READER_* */
+  const struct Schema_Struct *schema;	/* Which keywords go in which columns */
+  IoPolicy *io;			/* NULL unless --pagecache=drop, --io-files or --io-rate */
+}ExtractConfig;
+
+
+/* What --red-report needs from each header, as red_report.c would have read it. See autolog_report.c */
+#define REPORT_NFLAGS		3	/* L1STATOV, L1STATDA and L1STATFL */
+#define REPORT_NKEYWORDS	(3+REPORT_NFLAGS)	/* INSTRUME, FILTERI1 and FILTERI2 first */
+
+typedef struct ReportValues_Struct{
+  char instrume[FLEN_VALUE];	/* As ffgkys() left it. "" if missing */
+  char filters[2*FLEN_VALUE];	/* FILTERI1 and FILTERI2, if status is 0 */
+  int status;			/* FITSIO status after INSTRUME, FILTERI1 and FILTERI2 in turn */
+  int flag[REPORT_NFLAGS];
+  int flag_status[REPORT_NFLAGS];	/* Each flag is read with a status of its own */
+}ReportValues;
+
+/* DirEntry.report. What red_report would do with the file */
+#define REPORT_NONE		0	/* Not an LT name ending in exactly .fits. Not read */
+#define REPORT_READ		1
+#define REPORT_REDUCED		2	/* Unreduced, and the _1 version is in the listing. Not read */
+
+/* One candidate file found by the directory scan. It is filled in by extract_LogInfo(),
+ * either inline or by one of the worker threads, and then collected by main() in the
+ * order the files were found. */
+typedef struct LogJob_Struct{
+  LTFileName cur;
+  int no_dprt;			/* Set if no Dp(RT) keywords are expected in this file */
+  int status;			/* 0 = OK, 41 = FITS open failed, else FITSIO error on close */
+  int date_read;		/* Set if DATE-OBS was read. Then date_year etc are valid */
+  int date_year,date_month,date_day;
+  long bytes_read;		/* Header bytes read, if the reader knows */
+  int from_cache;		/* Filled in from the --cache file rather than read */
+  ino_t inode;			/* Identity of the file, for the cache. inode 0 if unknown */
+  off_t size;
+  time_t mtime,ctime;
+  LogInfo info;
+  const ExtractConfig *cfg;	/* Which directory the file is in, and how to read it */
+  int worker;			/* Which worker thread read it. 0 for the main thread */
+  double t_start;		/* trace_now() as extract_LogInfo() started on it */
+  double t_open,t_keys,t_close;	/* Seconds spent opening it, picking out keywords and closing it */
+  double t_wait;		/* Seconds held up by --io-files or --io-rate before t_start */
+  unsigned int pages_dropped;	/* By --pagecache=drop */
+  int report_only;		/* Read only for --red-report. It does not go in the log */
+  ReportValues report;
+  unsigned int *pending;	/* Counted down by the worker once read. See workqueue_wait() */
+  struct LogJob_Struct *qnext;	/* Used only by the WorkQueue FIFO */
+}LogJob;
+
+/* The --cache file. See autolog_cache.c */
+#define AUTOLOG_CACHE_NAME	"autolog_cache.dat"
+#define AUTOLOG_CACHE_MAGIC	"ALOGCACH"
+#define AUTOLOG_CACHE_VERSION	4	/* Increment whenever CacheRecord or LogInfo change */
+
+typedef struct CacheFileHeader_Struct{
+  char magic[8];
+  unsigned int version;
+  unsigned int record_size;	/* sizeof(CacheRecord) of the build that wrote it */
+  unsigned int nrecords;
+  unsigned int schema_sum;	/* Schema.checksum of the --schema the records were read with */
+  unsigned int spare[2];	/* Pad to 32 bytes so the records are aligned */
+}CacheFileHeader;
+
+/* One file's worth of the cache. Everything extract_LogInfo() would have filled in */
+typedef struct CacheRecord_Struct{
+  ino_t inode;			/* The sort key of the cache file */
+  off_t size;
+  time_t mtime,ctime;
+  int no_dprt;
+  int status;
+  int date_read;
+  int date_year,date_month,date_day;
+  LogInfo info;
+  ReportValues report;
+}CacheRecord;
+
+typedef struct LogCache_Struct{
+  char path[1024];
+  void *map;			/* The old cache, mmap()ed read only */
+  size_t map_len;
+  const CacheRecord *old;	/* Records in the old cache, sorted by inode */
+  unsigned int nold;
+  CacheRecord *new;		/* Records for the cache written at the end of this run */
+  unsigned int nnew,nalloc;
+  unsigned int hits;		/* Files taken from the old cache this run */
+  unsigned int schema_sum;	/* Only records read with the same schema are any use */
+}LogCache;
+
+/* The --index file, one for the whole archive. See autolog_index.c */
+#define AUTOLOG_INDEX_MAGIC	"ALOGINDX"
+#define AUTOLOG_INDEX_VERSION	1	/* Increment whenever IndexRecord or IndexNight change */
+#define INDEX_KEY_PROPID	0	/* The keys each have an array of records sorted on them */
+#define INDEX_KEY_GROUPID	1
+#define INDEX_KEY_OBJECT	2
+#define INDEX_KEY_INSTRUME	3
+#define INDEX_NKEYS		4
+#define INDEX_KEY_LEN		32	/* Longest key kept, plus one. Longer values are cut */
+#define INDEX_NIGHT_LEN		256	/* Longest night directory, plus one */
+
+typedef struct IndexFileHeader_Struct{
+  char magic[8];
+  unsigned int version;
+  unsigned int record_size;	/* sizeof(IndexRecord) of the build that wrote it */
+  unsigned int nrecords;
+  unsigned int nnights;
+  unsigned int spare[2];	/* Pad to 32 bytes */
+}IndexFileHeader;
+
+/* The directory a night was read from, as an absolute path */
+typedef struct IndexNight_Struct{
+  char dirname[INDEX_NIGHT_LEN];
+}IndexNight;
+
+/* One row of a night's log, cut down to fixed widths. Sorted by mjd, then night and exposure */
+typedef struct IndexRecord_Struct{
+  double mjd;
+  unsigned int night;		/* Which IndexNight it is from */
+  int error;
+  float airmass,exptime,l1seeing,l1skybrt;
+  int binning;
+  char utstart[13];
+  char ra[14],dec[14];
+  char filter[64];
+  char grating[16];
+  char exposure[FILENAME_LENGTH];
+  char key[INDEX_NKEYS][INDEX_KEY_LEN];	/* propid, groupid, object and instrume. See INDEX_KEY_* */
+}IndexRecord;
+
+/* A --index file, mmap()ed read only */
+typedef struct ArchiveIndex_Struct{
+  void *map;
+  size_t map_len;
+  const IndexNight *nights;
+  const IndexRecord *records;
+  const unsigned int *keys[INDEX_NKEYS];	/* Record numbers, sorted on each key then mjd */
+  unsigned int nrecords,nnights;
+}ArchiveIndex;
+
+/* The nights to go into the --index at the end of the run */
+typedef struct IndexUpdate_Struct{
+  const char *path;
+  IndexNight *nights;
+  unsigned int nnights,nnalloc;
+  IndexRecord *records;		/* Their night is an index into nights above, for now */
+  unsigned int nrecords,nalloc;
+}IndexUpdate;
+
+/* Writing the rows of the log. See autolog_output.c */
+#define OUTPUT_MAX_ROW		1024	/* Longest row format_log_row() may produce, plus one */
+#define OUTPUT_ROW_GUESS	220	/* Typical row length, for sizing the buffer up front */
+#define OUTPUT_PARALLEL_MIN	4096	/* Fewer rows than this are not worth a thread */
+#define OUTPUT_MAX_CHUNKS	64
+
+/* The fields of LogInfo by name, for --sort and the --format writers. See autolog_formats.c */
+#define LOG_FIELD_STRING	0
+#define LOG_FIELD_DOUBLE	1
+#define LOG_FIELD_FLOAT		2
+#define LOG_FIELD_INT		3
+
+typedef struct LogField_Struct{
+  const char *name;		/* As given to --sort, and the column name in the --format outputs */
+  int type;			/* LOG_FIELD_* */
+  size_t offset;		/* offsetof() the field in LogInfo */
+  size_t size;			/* sizeof() the field */
+  const char *unit;		/* For the FITS table. "" if none */
+}LogField;
+
+extern const LogField log_fields[];
+extern const int log_nfields;
+
+/* The keyword schema: which header keywords fill which columns. See autolog_schema.c */
+#define SCHEMA_MAX_COLUMNS	64
+#define SCHEMA_MAX_KEYWORDS	128	/* Distinct keywords over all the columns */
+#define SCHEMA_MAX_CHAIN	8	/* Keywords in one column's fallback list */
+#define SCHEMA_MAX_HASH_BITS	12	/* Largest perfect hash table is 1<<this slots */
+
+/* How a column's value is made from its keywords */
+#define SCHEMA_RULE_FIRST	0	/* The first keyword present. For strings, the first non-blank one */
+#define SCHEMA_RULE_FILTERS	1	/* Filter names joined with ',', leaving out the clear ones */
+#define SCHEMA_RULE_L1STAT	2	/* Dp(RT) error flags. Subtract 2<<n if keyword n is not +-1 */
+
+typedef struct SchemaColumn_Struct{
+  LogField field;		/* The output column, and where it lives in LogInfo */
+  char name[32];		/* field.name points here */
+  char unit[32];		/* ...and field.unit here */
+  int keywords[SCHEMA_MAX_CHAIN];	/* Index of each keyword in Schema.keywords, in the order tried */
+  int nkeywords;		/* 0 for a column not read from the header, e.g. exposure */
+  int rule;			/* SCHEMA_RULE_* */
+  int has_default;		/* Use dflt if none of the keywords gives a value */
+  char dflt[SCHEMA_EXTRA_LEN];
+  double dflt_num;		/* dflt as a number, for the numeric types */
+  int dprt;			/* Only read from frames which have been through Dp(RT) */
+  int underscore;		/* Blanks in the value become '_' */
+  int space;			/* A blank is appended to the value */
+}SchemaColumn;
+
+typedef struct Schema_Struct{
+  SchemaColumn columns[SCHEMA_MAX_COLUMNS];	/* In the order they are written out */
+  int ncolumns;
+  LogField fields[SCHEMA_MAX_COLUMNS];	/* columns[ii].field, for the --format writers */
+  int nextra;			/* How many of LogInfo.extra are in use */
+  char keywords[SCHEMA_MAX_KEYWORDS][9];	/* Blank padded to the 8 characters of a card */
+  int nkeywords;
+  int dateobs;			/* Index of DATE-OBS, always matched for naming the log */
+  int report[REPORT_NKEYWORDS];	/* Index of each of report_keywords[], always matched too */
+  uint64_t hash_mult;		/* The perfect hash. See schema_match() */
+  int hash_shift;
+  uint64_t *hash_keys;		/* Keyword in each slot, as 8 bytes. 1<<(64-hash_shift) slots */
+  short *hash_index;		/* Index into keywords of each slot, -1 if empty */
+  unsigned int checksum;	/* Of the column definitions, to tell --cache files apart */
+}Schema;
+
+/* Which files are written, chosen with --format */
+#define FORMAT_TEXT		0x01	/* The classic fixed width log, YYYYMMDD.log */
+#define FORMAT_CSV		0x02
+#define FORMAT_JSONL		0x04
+#define FORMAT_FITSTABLE	0x08
+
+/* One --format output other than text, written a row at a time. See autolog_formats.c */
+typedef struct FormatWriter_Struct{
+  int format;			/* FORMAT_CSV, FORMAT_JSONL or FORMAT_FITSTABLE */
+  char path[1040];
+  const LogField *fields;	/* The columns, in order */
+  int nfields;
+  FILE *fp;			/* csv and jsonl */
+  fitsfile *fptr;		/* fitstable */
+  unsigned int row;		/* Rows written so far */
+  int status;			/* cFITSIO status for fitstable, otherwise 1 after an error */
+}FormatWriter;
+
+/* Sorting the log with --sort. See autolog_sort.c */
+#define SORT_MAX_KEYS		8
+#define SORT_DEFAULT		"mjd"	/* What autolog has always sorted on */
+
+typedef struct SortSpec_Struct{
+  LogField keys[SORT_MAX_KEYS];	/* Most significant first */
+  int nkeys;
+}SortSpec;
+
+/* Chunked storage for LogJobs. See autolog_store.c */
+#define LOGSTORE_MIN_CHUNK	256
+#define LOGSTORE_BATCH		2048	/* Files read and collected at a time, without --memory */
+
+typedef struct LogStore_Struct{
+  LogJob **chunks;		/* Each chunk is chunk_size jobs, never moved once allocated */
+  unsigned int nchunks,chunk_alloc;
+  unsigned int chunk_size;
+  unsigned int njobs;		/* Jobs handed out so far */
+}LogStore;
+
+/* The rows of a night once read, packed. See autolog_table.c */
+#define LOGTABLE_MAX_SLOTS	32	/* log_fields[] and the SCHEMA_MAX_EXTRA extras */
+
+/* Each distinct string once, known by a number counting up from 0 */
+typedef struct StrPool_Struct{
+  char *text;			/* The strings, \0 terminated, one after the other */
+  size_t len,alloc;
+  unsigned int *offsets;	/* Where each string starts in text */
+  unsigned int nstrings,nalloc;
+  unsigned int *hash;		/* 1 + the number of the string in each slot, 0 if empty */
+  unsigned int hashsize;	/* A power of 2, at least twice nstrings */
+}StrPool;
+
+/* Where one field of LogInfo is kept in a packed row */
+typedef struct LogTableSlot_Struct{
+  size_t offset;		/* offsetof() the field in LogInfo */
+  int type;			/* LOG_FIELD_* */
+  int cell;			/* Its first cell in the row. -1 for mjd, which is in LogTable.mjd */
+}LogTableSlot;
+
+typedef struct LogTable_Struct{
+  StrPool pool;			/* Every string of every row */
+  LogTableSlot slots[LOGTABLE_MAX_SLOTS];
+  int nslots;
+  int ncells;			/* uint32_t cells in a row: one per string, float or int, two per double */
+  uint32_t *cells;		/* nrows rows of ncells, in the order the files were read */
+  double *mjd;			/* The MJD of each row, on its own for sorting */
+  unsigned int nrows,nalloc;
+}LogTable;
+
+/* --memory. Sorted runs of rows written out to temporary files. See autolog_spill.c */
+#define SPILL_MIN_BUDGET	(1024*1024)	/* Smaller --memory budgets are raised to this */
+#define SPILL_MIN_BATCH		16	/* Fewest files to hand over to be read at once */
+#define SPILL_MAX_RUNS		32	/* More runs than this are merged into one before going on */
+
+typedef struct SpillRun_Struct{
+  FILE *fp;			/* Unlinked as soon as it is made, so it goes when closed. NULL for the table */
+  unsigned int nrows;
+  unsigned int next;		/* Rows read back so far, while merging */
+  LogInfo row;			/* The row read last, while merging */
+}SpillRun;
+
+typedef struct SpillSet_Struct{
+  size_t budget;		/* --memory, or 0 for no limit. Nothing is spilled then */
+  size_t table_bytes;		/* A LogTable holding more than this is spilled */
+  unsigned int batch;		/* Files handed over to be read at once */
+  SortSpec spec;		/* What the runs are sorted on */
+  LogTableSlot slots[LOGTABLE_MAX_SLOTS];	/* The fields of a row, as in the LogTable */
+  int nslots;
+  SpillRun *runs[SPILL_MAX_RUNS];
+  int nruns;
+  SpillRun tail;		/* The rows still in the table, merged in after the runs */
+  const LogTable *table;	/* ...which are these, in this order. NULL if none */
+  const unsigned int *order;
+  int heap[SPILL_MAX_RUNS+1];	/* Runs with rows left, the next to come out first, while merging */
+  int nheap;
+}SpillSet;
+
+/* Timing each run. See autolog_trace.c */
+#define TRACE_READDIR		0	/* dirscan_read() */
+#define TRACE_CACHE_LOAD	1
+#define TRACE_RESOLVE		2	/* dirscan_resolve(), which replaced the fileex() probes */
+#define TRACE_ORDER		3	/* dirscan_order(), including any FIEMAP calls */
+#define TRACE_READ		4	/* Handing each file over. Serially, this is reading them too */
+#define TRACE_WAIT		5	/* Waiting for the worker threads, and collecting what they read */
+#define TRACE_CACHE_SAVE	6
+#define TRACE_SORT		7	/* sort_log_rows(), which replaced indexx_dble() */
+#define TRACE_OUTPUT		8	/* The text log, and the copy on stdout */
+#define TRACE_FORMATS		9	/* csv, jsonl and fitstable */
+#define TRACE_REPORT		10	/* --red-report */
+#define TRACE_SPILL		11	/* --memory: sorting and writing out runs, and merging them */
+#define TRACE_NPHASES		12
+
+#define TRACE_HIST_BINS		20	/* File latency. Under 16us, then doubling. The last is 4s and over */
+#define TRACE_SLOWEST		5	/* Slowest files named in the summary */
+
+typedef struct TraceSlow_Struct{
+  double secs;
+  char exposure[FILENAME_LENGTH];
+}TraceSlow;
+
+/* The timing of one night, for the summary at the end of autolog_status.log */
+typedef struct NightTiming_Struct{
+  double start;			/* trace_now() when the night was started */
+  double phase[TRACE_NPHASES];	/* Seconds in each phase */
+  double open,keys,close;	/* Seconds in each step of reading a file, summed over the files */
+  unsigned int nfiles;		/* Files read, as opposed to taken from the cache */
+  unsigned int hist[TRACE_HIST_BINS];	/* Number of files by time from open to close */
+  TraceSlow slowest[TRACE_SLOWEST];	/* Slowest first */
+  double total;			/* From start to trace_summary() */
+}NightTiming;
+
+/* The --trace file, in the Chrome trace event format */
+typedef struct TraceFile_Struct{
+  FILE *fp;			/* NULL unless --trace */
+  double epoch;			/* trace_now() at the start. Times in the file are from this */
+  int nevents;
+}TraceFile;
+
+/* What happened to the files of one night, for --metrics. See autolog_metrics.c */
+typedef struct NightCounts_Struct{
+  unsigned int scanned;		/* Names in the listing, less . and .. and our own files */
+  unsigned int not_lt;		/* Not an LT file name (31) */
+  unsigned int not_fits;	/* LT names which are not FITS files */
+  unsigned int superseded;	/* Skipped for a more reduced version of the same exposure */
+  unsigned int open_failed;	/* Failed to open FITS (41) */
+  unsigned int fitsio_errors;	/* Read, but with some other FITSIO error */
+  unsigned int cached;		/* Taken from the --cache file */
+  unsigned int l1stat[SCHEMA_MAX_CHAIN];	/* Files with each L1STAT keyword flagging an error */
+  double bytes_read;
+  unsigned int pages_dropped;	/* By --pagecache=drop */
+  double io_wait;		/* Seconds held up by --io-files and --io-rate, over all threads */
+}NightCounts;
+
+/* --open-order. How night_scan() orders the files it hands over to be read */
+#define OPEN_ORDER_DIR		0	/* As listed. The status log comes out as it always did */
+#define OPEN_ORDER_INODE	1	/* By inode number. The default */
+#define OPEN_ORDER_EXTENT	2	/* By where the first block is on disk, from FIEMAP, else inode */
+
+#define DIRSCAN_BUFSIZE		(256*1024)	/* Bytes of directory entries per getdents64() */
+
+#define DIRSCAN_NAME_MAX	255		/* Longer names are cut short to this */
+
+/*
+ * One name from the directory listing. The names themselves are one after another in
+ * DirScan.names, and dirscan_chop() gives the rest of the LTFileName when it is wanted.
+ * See autolog_dirscan.c
+ */
+typedef struct DirEntry_Struct{
+  LogJob *job;			/* Where night_scan() put the file to be read, or NULL */
+  ino_t inode;
+  off_t physical;		/* Disk offset of the first block with OPEN_ORDER_EXTENT. 0 if unknown */
+  unsigned int name;		/* Where the name starts in DirScan.names. See dirscan_name() */
+  unsigned int base;		/* Where the exposure less its pipeline flag starts there, if is_fits */
+  unsigned short baselen;	/* ...and its length. It is usually the start of the name */
+  short p;			/* Pipeline flag as a number */
+  unsigned char wanted;		/* 0 for a name kept only for --red-report. It was not chopped */
+  unsigned char report;		/* --red-report: REPORT_*. See report_plan() */
+  unsigned char lt_ok;		/* chop_filename() understood the name */
+  unsigned char is_fits;	/* ...and it is a FITS file */
+  unsigned char superseded;	/* A more reduced FITS file of the same exposure exists */
+}DirEntry;
+
+typedef struct DirScan_Struct{
+  DirEntry *entries;		/* In the order the directory lists them */
+  unsigned int nentries,nalloc;
+  char *names;			/* Every name, each ending in \0 */
+  size_t nameslen,namesalloc;
+  unsigned int nfits;		/* Number of entries with is_fits set */
+  unsigned int nskipped;	/* Not regular files, or not .fits names, so never put in entries */
+  unsigned int *order;		/* The FITS entries to be read, in the order to open them */
+  unsigned int norder;
+  unsigned int nextents;	/* Of those, the number FIEMAP gave a disk offset for */
+}DirScan;
+
+/* Everything accumulated while scanning one directory */
+typedef struct LogRun_Struct{
+  FILE *proglog;		/* autolog_status.log */
+  LogStore store;		/* The batch of files being read, in the order submitted. Every file with --red-report */
+  LogTable table;		/* One row per file successfully read. With --memory, only those not spilled */
+  SpillSet spill;		/* With --memory, the rows spilled from table so far */
+  unsigned int filect;		/* Number of rows in table */
+  unsigned int badfilect;	/* Number of files rejected and not read */
+  int date_year,date_month,date_day;	/* DATE-OBS of the last file read */
+  LogCache *cache;		/* NULL unless --cache */
+  int quiet;			/* --quiet. No copy of the log on stdout */
+  int screen;			/* Errors go on stdout as well as into the status log */
+  int ok;			/* 0 if the directory or its status log could not be opened */
+  ExtractConfig cfg;		/* This directory, and how to read it */
+  LogCache cachebuf;		/* What cache points at */
+  unsigned int pending;		/* Files handed to the workers and not read yet */
+  char putative_outlogdate[9];	/* Date of the first file, to name the log after */
+  int multiple_nights_data;	/* Set if the files are not all from that one night */
+  int create_outlog_name;	/* 0 if the log was named on the command line */
+  char outlog_name[1024];
+  char logpath[1040];		/* The log, once it has a name */
+  unsigned int *order;		/* The rows of table in the order they go in the log */
+  NightTiming timing;
+  NightCounts counts;
+  TraceFile *trace;		/* The --trace file. Its fp is NULL without --trace */
+  int trace_pid;		/* Each night is a process of its own in the trace */
+  FILE *report;			/* red_report.log with --red-report, else NULL */
+  DirScan scan;			/* With --red-report, the listing, kept for report_write() */
+  int watch_fd;			/* With --watch, the inotify watch set up before the listing, else -1 */
+}LogRun;
+
+/* The command line options, which apply to every directory. libautolog fills in its own */
+typedef struct AutologOptions_Struct{
+  int nthreads;			/* -j */
+  int reader;			/* --reader, READER_* */
+  int use_cache;		/* --cache */
+  int watch;			/* --watch */
+  int quiet;			/* --quiet */
+  int screen;			/* Errors go on stdout too. Always, from the command line */
+  int formats;			/* --format, FORMAT_* */
+  SortSpec sort_spec;		/* --sort */
+  Schema schema;		/* --schema, or the built in one */
+  const char *metrics;		/* --metrics, or NULL */
+  FILE *report_out;		/* Where --red-report's screen report goes. NULL without --red-report */
+  IoPolicy io;			/* --pagecache, --io-files, --io-rate and --polite */
+  int open_order;		/* --open-order, OPEN_ORDER_* */
+  IndexUpdate *index;		/* --index, or NULL */
+  size_t memory;		/* --memory, in bytes. 0 for no limit */
+}AutologOptions;
+
+/* With --batch, how many nights may be scanned ahead of the one being written */
+#define BATCH_NIGHTS_AHEAD	4
+
+/* FIFO of LogJobs shared by the worker threads in autolog_workers.c */
+typedef struct WorkQueue_Struct{
+  pthread_mutex_t lock;
+  pthread_cond_t ready;		/* A job has been queued */
+  pthread_cond_t done;		/* A job has been read */
+  LogJob *head,*tail;
+  int closed;			/* No more jobs will be submitted */
+  int nthreads;			/* 0 means jobs are read inline by workqueue_submit() */
+  int next_worker;		/* Each worker numbers itself from this, starting at 1 */
+  int uring;			/* The workers read through io_uring. See autolog_uring.c */
+  IoPolicy *io;			/* The I/O limits, for the io_uring workers. NULL if none */
+  pthread_t *threads;
+}WorkQueue;
+
+
+/* autolog.c */
+extern int Autolog_Error;
 void echo_usage(void);
-int indexx_dble (unsigned int nn, double arrin[], unsigned int indx[]);
-void init_LogInfo(LogInfo *to_init);
-int fileex(char *file);
+
+/* autolog_night.c */
+void night_init(LogRun *run, const char *dirname, const char *outname, AutologOptions *opt);
+int night_scan(LogRun *run, const AutologOptions *opt, WorkQueue *wq, char **names, int nnames);
+void night_collect(LogRun *run, const AutologOptions *opt, WorkQueue *wq);
+void night_sort(LogRun *run, const SortSpec *spec);
+void night_name_log(LogRun *run);
+int night_write(LogRun *run, const AutologOptions *opt, int formats, FILE *merged);
+void night_free(LogRun *run);
+void night_init_LogInfo(LogInfo *to_init);
+void log_header_write(FILE *fp);
+int format_log_row(char *buf, size_t buflen, const LogInfo *info);
+void night_exposure_base(const char *exposure, char *base);
+
+/* autolog_dirscan.c */
+int dirscan_read(const char *dirname, DirScan *scan, int keep_all);
+int dirscan_names(const char *dirname, char **names, int nnames, DirScan *scan, int keep_all);
+int dirscan_resolve(DirScan *scan);
+int dirscan_order(const char *dirname, DirScan *scan, int how);
+void dirscan_order_some(const DirScan *scan, unsigned int *idx, unsigned int n);
+const char *dirscan_name(const DirScan *scan, unsigned int ii);
+int dirscan_chop(const DirScan *scan, unsigned int ii, LTFileName *cur);
+void dirscan_free(DirScan *scan);
+
+/* autolog_extract.c */
+int extract_LogInfo(const ExtractConfig *cfg, LogJob *job);
+void extract_begin(const ExtractConfig *cfg, LogJob *job, char *path);
+void extract_cards(const ExtractConfig *cfg, LogJob *job, const RawHeader *raw);
+int log_open_header(LogHeader *hdr, int reader, const char *path, const IoPolicy *io, int *status);
+int log_close_header(LogHeader *hdr, int *status);
+
+/* autolog_rawhdr.c */
+int rawhdr_compression(const char *path);
+int rawhdr_open(const char *path, const IoPolicy *io, RawHeader *hdr);
+int rawhdr_map(const char *path, const IoPolicy *io, RawHeader *hdr);
+char *rawhdr_block_space(RawHeader *hdr);
+int rawhdr_add_block(RawHeader *hdr, int first, int primary);
+void rawhdr_close(RawHeader *hdr);
+const char *rawhdr_find_card(const RawHeader *hdr, const char *keyword);
+void rawhdr_card_value(const char *card, char *value);
+int rawhdr_card_string(const char *card, char *value, int *status);
+int rawhdr_card_key(const char *card, int datatype, void *value, int *status);
+int rawhdr_read_string(const RawHeader *hdr, const char *keyword, char *value, int *status);
+int rawhdr_read_key(const RawHeader *hdr, int datatype, const char *keyword, void *value, int *status);
+
+/* autolog_cardscan.c */
+int cardscan_level(void);
+int cardscan_force(int level);
+const char *cardscan_name(int level);
+int cardscan_find(const char *cards, int ncards, const char *key);
+int cardscan_value(const char *card, int *len);
+
+/* autolog_cache.c */
+int cache_load(LogCache *cache, const char *dirname, unsigned int schema_sum);
+int cache_fill_job(LogCache *cache, const char *dirname, LogJob *job);
+void cache_add(LogCache *cache, const LogJob *job);
+int cache_save(LogCache *cache);
+void cache_close(LogCache *cache);
+
+/* autolog_formats.c */
+const LogField *log_field_find(const char *name);
+int format_parse(const char *list, int *formats);
+void format_path(const char *logpath, const char *suffix, char *path);
+int format_open(FormatWriter *writer, int format, const char *path, const LogField *fields, int nfields, unsigned int n);
+void format_row(FormatWriter *writer, const LogInfo *info);
+int format_close(FormatWriter *writer);
+
+/* autolog_index.c */
+extern const char *index_key_names[INDEX_NKEYS];
+void index_update_init(IndexUpdate *up, const char *path);
+int index_add_night(IndexUpdate *up, const char *dirname, unsigned int n, unsigned int *night);
+void index_add_row(IndexUpdate *up, unsigned int night, const LogInfo *info);
+int index_update_write(IndexUpdate *up);
+void index_update_free(IndexUpdate *up);
+int index_open(ArchiveIndex *idx, const char *path);
+void index_close(ArchiveIndex *idx);
+unsigned int index_find_mjd(const ArchiveIndex *idx, double mjd);
+void index_find_key(const ArchiveIndex *idx, int kk, const char *value, double from, double to, unsigned int *first, unsigned int *last);
+int index_key_matches(const IndexRecord *rec, int kk, const char *value);
+
+/* autolog_iopolicy.c */
+void iopolicy_init(IoPolicy *io);
+void iopolicy_free(IoPolicy *io);
+int iopolicy_active(const IoPolicy *io);
+int iopolicy_parse_rate(const char *str, double *rate);
+void iopolicy_describe(const IoPolicy *io, FILE *fp);
+double iopolicy_begin(IoPolicy *io);
+int iopolicy_try_begin(IoPolicy *io);
+void iopolicy_end(IoPolicy *io, long bytes);
+void iopolicy_no_readahead(const IoPolicy *io, int fd);
+void iopolicy_snapshot(const IoPolicy *io, const char *path, int fd, PageSnapshot *snap);
+unsigned int iopolicy_release(const IoPolicy *io, PageSnapshot *snap);
+
+/* autolog_metrics.c */
+void metrics_job(LogRun *run, const LogJob *job);
+int metrics_write(const char *path, const LogRun *runs, int nruns);
+
+/* autolog_output.c */
+int output_log_rows(const LogTable *table, const unsigned int *order, unsigned int n, int nthreads, FILE **sinks, int nsinks);
+
+/* autolog_report.c */
+extern const char *report_keywords[REPORT_NKEYWORDS];
+void report_extract(const Schema *schema, const char **found, ReportValues *report);
+int report_plan(DirScan *scan);
+void report_write(const LogRun *run, FILE *out);
+
+/* autolog_schema.c */
+int schema_load(const char *path, Schema *schema);
+void schema_free(Schema *schema);
+const LogField *schema_field_find(const Schema *schema, const char *name);
+void schema_match(const Schema *schema, const char *cards, int ncards, const char **found);
+void schema_extract(const Schema *schema, const char **found, int no_dprt, LogInfo *info);
+
+/* autolog_sort.c */
+int sort_parse(const char *list, const Schema *schema, SortSpec *spec);
+int sort_log_rows(const LogTable *table, const SortSpec *spec, unsigned int *order);
+int sort_compare_rows(const LogInfo *aa, const LogInfo *bb, const SortSpec *spec);
+
+/* autolog_spill.c */
+void spill_init(SpillSet *spill, size_t budget, const SortSpec *spec, const LogTable *table);
+int spill_due(const SpillSet *spill, const LogTable *table);
+int spill_table(SpillSet *spill, LogTable *table);
+int spill_merge_start(SpillSet *spill, const LogTable *table, const unsigned int *order);
+int spill_merge_next(SpillSet *spill, LogInfo *info);
+void spill_free(SpillSet *spill);
+
+/* autolog_store.c */
+void logstore_init(LogStore *store, unsigned int hint);
+LogJob *logstore_new_job(LogStore *store);
+LogJob *logstore_job(const LogStore *store, unsigned int ii);
+void logstore_reset(LogStore *store);
+void logstore_free(LogStore *store);
+
+/* autolog_table.c */
+void strpool_init(StrPool *pool);
+int strpool_add(StrPool *pool, const char *str, unsigned int *id);
+const char *strpool_str(const StrPool *pool, unsigned int id);
+void strpool_free(StrPool *pool);
+void logtable_init(LogTable *table, const Schema *schema);
+int logtable_reserve(LogTable *table, unsigned int nrows);
+int logtable_add(LogTable *table, const LogInfo *info);
+size_t logtable_bytes(const LogTable *table);
+void logtable_clear(LogTable *table);
+void logtable_row(const LogTable *table, unsigned int ii, LogInfo *info);
+const LogTableSlot *logtable_slot(const LogTable *table, const LogField *field);
+void logtable_free(LogTable *table);
+
+/* autolog_trace.c */
+extern const char *trace_phase_names[TRACE_NPHASES];
+double trace_now(void);
+int trace_open(TraceFile *trace, const char *path);
+void trace_close(TraceFile *trace);
+void trace_night_start(LogRun *run, TraceFile *trace, int pid, int nthreads);
+double trace_phase(LogRun *run, int phase, double start);
+void trace_file(LogRun *run, const LogJob *job);
+void trace_summary(LogRun *run);
+
+/* autolog_uring.c */
+int uring_available(void);
+int uring_worker(WorkQueue *wq, int worker);
+
+/* autolog_watch.c */
+int watch_begin(const char *dirname);
+int watch_directory(LogRun *run, const ExtractConfig *cfg, const unsigned int *order, const char *logpath);
+
+/* autolog_workers.c */
+int workqueue_start(WorkQueue *wq, int nthreads, int reader, IoPolicy *io);
+void workqueue_submit(WorkQueue *wq, LogJob *job);
+void workqueue_wait(WorkQueue *wq, unsigned int *pending);
+void workqueue_finish(WorkQueue *wq);
+LogJob *workqueue_take(WorkQueue *wq, int wait);
+void workqueue_done(WorkQueue *wq, LogJob *job);
 
 #endif
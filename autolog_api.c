@@ -0,0 +1,234 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+The libautolog API in libautolog.h, on top of the night_*() functions in autolog_night.c.
+A session is an AutologOptions, filled in here rather than from a command line, and the
+WorkQueue, started once and kept for every night it reads. Each night is a LogRun which
+has been through night_scan(), night_collect() and night_sort() by the time it is handed
+back, so its rows are all there.
+*/
+
+#define _ISOC99_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+#include "libautolog.h"
+
+struct AutologSession_Struct{
+  AutologOptions opt;
+  WorkQueue wq;
+  TraceFile trace;		/* Never a file. The timing summaries still need one */
+};
+
+struct AutologNight_Struct{
+  LogRun run;
+  AutologSession *session;
+  char *dirname;		/* run.cfg.dirname points at this */
+  LogInfo row;			/* The last row asked for, unpacked from run.table */
+};
+
+
+/* The defaults of the command line: one thread, cFITSIO, inode order, no cache or limits */
+void autolog_config_init(AutologConfig *config)
+{
+  config->nthreads = 1;
+  config->reader = READER_CFITSIO;
+  config->open_order = OPEN_ORDER_INODE;
+  config->use_cache = 0;
+  config->schema = NULL;
+  config->pagecache_drop = 0;
+  config->io_files = 0;
+  config->io_rate = 0;
+}
+
+
+/*
+ * Load the schema and start the worker threads.
+ * Returns the session, or NULL if the schema could not be loaded or out of memory.
+ */
+AutologSession *autolog_session_open(const AutologConfig *config)
+{
+  AutologSession *session;
+  AutologOptions *opt;
+
+  session = (AutologSession *)calloc(1,sizeof(AutologSession));
+  if (session == NULL)
+    return NULL;
+  opt = &session->opt;
+
+  opt->nthreads = MAX(config->nthreads,1);
+  opt->reader = config->reader;
+  opt->open_order = config->open_order;
+  opt->use_cache = config->use_cache;
+  opt->watch = 0;
+  opt->quiet = 1;
+  opt->screen = 0;
+  opt->formats = FORMAT_TEXT;
+  opt->metrics = NULL;
+  opt->report_out = NULL;
+  opt->index = NULL;
+  opt->memory = 0;
+  iopolicy_init(&opt->io);
+  opt->io.drop = config->pagecache_drop;
+  opt->io.max_files = MAX(config->io_files,0);
+  opt->io.max_rate = MAX(config->io_rate,0);
+
+  if (schema_load(config->schema,&opt->schema)) {
+    iopolicy_free(&opt->io);
+    free(session);
+    return NULL;
+  }
+  sort_parse(SORT_DEFAULT,&opt->schema,&opt->sort_spec);
+  trace_open(&session->trace,NULL);
+
+  workqueue_start(&session->wq,opt->nthreads,opt->reader,iopolicy_active(&opt->io) ? &opt->io : NULL);
+  return session;
+}
+
+
+/* The columns, for schema_field_find() on the extra ones a --schema file adds */
+const Schema *autolog_session_schema(const AutologSession *session)
+{
+  return &session->opt.schema;
+}
+
+
+/* Stop the workers and free the session. Close its nights first */
+void autolog_session_close(AutologSession *session)
+{
+  if (session == NULL)
+    return;
+  workqueue_finish(&session->wq);
+  schema_free(&session->opt.schema);
+  iopolicy_free(&session->opt.io);
+  free(session);
+}
+
+
+/*
+ * Read the night in dirname: every file in it with names NULL, else just the nnames
+ * files named, which are in dirname. The rows come back sorted by MJD.
+ * Returns the night, or NULL with *error set to the code the command line
+ * would have exited with (-21 directory, -23 status log, -25 out of memory).
+ */
+AutologNight *autolog_night_read(AutologSession *session, const char *dirname, char **names, int nnames, int *error)
+{
+  AutologNight *night;
+  LogRun *run;
+
+  *error = -25;
+  night = (AutologNight *)calloc(1,sizeof(AutologNight));
+  if (night == NULL)
+    return NULL;
+  night->dirname = (char *)malloc(strlen(dirname)+1);
+  if (night->dirname == NULL) {
+    free(night);
+    return NULL;
+  }
+  strcpy(night->dirname,dirname);
+  night->session = session;
+  run = &night->run;
+
+  night_init(run,night->dirname,NULL,&session->opt);
+  trace_night_start(run,&session->trace,1,session->wq.nthreads);
+  *error = night_scan(run,&session->opt,&session->wq,names,nnames);
+  if (*error) {
+    free(night->dirname);
+    free(night);
+    return NULL;
+  }
+  night_collect(run,&session->opt,&session->wq);
+  night_sort(run,&session->opt.sort_spec);
+
+  *error = 0;
+  return night;
+}
+
+
+/*
+ * Sort the rows again on keys, a --sort list such as "instrume,mjd".
+ * Returns 0, or 1 if keys is not a --sort list. The order is then unchanged.
+ */
+int autolog_night_sort(AutologNight *night, const char *keys)
+{
+  SortSpec spec;
+
+  if (sort_parse(keys,&night->session->opt.schema,&spec))
+    return 1;
+  night_sort(&night->run,&spec);
+  return 0;
+}
+
+
+/* The number of rows, which is the number of files in the log */
+unsigned int autolog_night_count(const AutologNight *night)
+{
+  return night->run.filect;
+}
+
+
+/*
+ * Row ii, in sorted order, or NULL past the last. The rows are kept packed, so this
+ * is a copy, good until the next call for this night.
+ */
+const LogInfo *autolog_night_row(AutologNight *night, unsigned int ii)
+{
+  if (ii >= night->run.filect)
+    return NULL;
+  logtable_row(&night->run.table,night->run.order[ii],&night->row);
+  return &night->row;
+}
+
+
+/*
+ * Write the log in each of formats (FORMAT_*) as the command line's --format does, in
+ * the night's directory. logname is the name of the text log, as the command line's
+ * output_file_name, or NULL to name it after the night as the command line would.
+ * Returns 0, or 1 if any of them could not be written.
+ */
+int autolog_night_write(AutologNight *night, int formats, const char *logname)
+{
+  LogRun *run;
+
+  run = &night->run;
+  if (logname)
+    sprintf(run->logpath,"%.767s/%.255s",run->cfg.dirname,logname);
+  else
+    night_name_log(run);
+  return night_write(run,&night->session->opt,formats,NULL);
+}
+
+
+/* Add the timing summary to the night's status log, and free it */
+void autolog_night_close(AutologNight *night)
+{
+  if (night == NULL)
+    return;
+  trace_summary(&night->run);
+  night_free(&night->run);
+  free(night->dirname);
+  free(night);
+}
@@ -0,0 +1,872 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+autolog_bench. Makes a synthetic night of LT frames and times programs over it. This is
+what `make bench` runs. It needs nothing but libc, so it runs anywhere, offline.
+
+  autolog_bench [--frames=N] [--seed=S] [--missing=PCT] [--reduced=PCT] [--data=KB]
+                [--date=YYYYMMDD] [--runs=R] DIR [-- "command args" ...]
+
+First DIR is filled with N exposures from IO:O, RATCam and FRODOSpec, with the headers each
+instrument writes and a mix of raw (_0) and Dp(RT) reduced (_1) frames. --reduced percent of
+the exposures have been reduced, and half of those still have their raw frame alongside, as
+on a real night. Each keyword which is not needed to make a valid FITS file is left out with
+a chance of --missing percent. --data gives each frame a data unit of that many KB, which is
+written out in full (zeros), so the files take up the space they would for real. The same
+seed always gives the same night.
+
+DIR is created if need be. If it already exists it must be empty, or have been made by
+autolog_bench before, in which case its files are removed first. Nothing else is ever
+deleted.
+
+Then each command after -- is run R times, with DIR as its last argument, in DIR, with its
+output thrown away. For each run we report the wall clock and CPU time, files/s, the bytes
+it read, both through read() and from the disk, and its peak RSS. The bytes come from
+/proc/<pid>/io, which is read while the finished process is still a zombie. Where there is
+no /proc only the blocks read from disk are known. Neither count sees pages touched through
+mmap().
+
+The first run usually reads the files from disk and the rest from the page cache. Nothing
+here drops the cache, since that needs root.
+*/
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE		/* wait4() on glibc */
+#define _DARWIN_C_SOURCE	/* and on OS X */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define BENCH_CARD_LEN 80
+#define BENCH_BLOCK_LEN 2880
+#define BENCH_MAX_CARDS 720		/* 20 header blocks */
+#define BENCH_MAX_ARGS 32
+#define BENCH_MARKER ".autolog_bench"
+
+/* Everything given on the command line */
+typedef struct BenchConfig_Struct{
+  int frames;			/* Exposures, not files. Each may be a raw frame, a reduced one or both */
+  uint64_t seed;
+  double missing;		/* Chance of leaving out each keyword */
+  double reduced;		/* Chance of an exposure having been through Dp(RT) */
+  long data_kb;			/* Size of each data unit. 0 for headers only */
+  int date;			/* The night, as YYYYMMDD */
+  int runs;			/* Times to run each command */
+  char dir[PATH_MAX];
+}BenchConfig;
+
+/* One instrument, with the keywords which only it writes */
+typedef struct BenchInst_Struct{
+  const char *prefix;		/* First part of the LT filename */
+  const char *instrume;
+  const char *detector;
+  int nfilters;			/* FILTERn/FILTERIn pairs. 0 for a spectrograph */
+  double pixscale;
+}BenchInst;
+
+static const BenchInst bench_insts[] = {
+  {"h","IO:O","e2v CCD 231-84",3,0.15},
+  {"c","RATCam","EEV CCD42-40",2,0.135},
+  {"v","FRODOSpec","e2v CCD 44-82",0,0.0}
+};
+#define BENCH_NINSTS ((int)(sizeof(bench_insts)/sizeof(bench_insts[0])))
+
+static const char *bench_filters[] = {"SDSS-U","SDSS-G","SDSS-R","SDSS-I","SDSS-Z","Bessell-B","Bessell-V","H-Alpha-6566"};
+static const char *bench_objects[] = {"M 31","NGC 1234","SN 2020abc","HD 123456","GRB 200624A","Barnard's Star","ZTF20aaelulu","PG 1530+057"};
+static const char *bench_proposals[] = {"JL20A01","JL20A07","PL20A12","XCL20A03","CL20A15","JQ20A02"};
+
+/* A header under construction. Cards may be dropped as they are added */
+typedef struct BenchHeader_Struct{
+  char cards[BENCH_MAX_CARDS*BENCH_CARD_LEN];
+  int ncards;
+  double missing;
+  uint64_t *rng;
+}BenchHeader;
+
+/* One run of one command */
+typedef struct BenchResult_Struct{
+  double wall,cpu;
+  long rchar,read_bytes;	/* -1 if not known */
+  long maxrss;			/* KB */
+  int status;			/* Exit status, or -signal */
+}BenchResult;
+
+
+/* xorshift64*. Not rand(), so a seed gives the same night on every machine */
+static uint64_t bench_rand(uint64_t *state)
+{
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * (((uint64_t)0x2545F491 << 32) | 0x4F6CDD1D);
+}
+
+
+/* Uniform in [0,1) */
+static double bench_uniform(uint64_t *state)
+{
+  return (bench_rand(state) >> 11) * (1.0/9007199254740992.0);
+}
+
+
+/* Uniform integer in [lo,hi] */
+static int bench_range(uint64_t *state, int lo, int hi)
+{
+  return lo + (int)(bench_uniform(state)*(hi-lo+1));
+}
+
+
+/* MJD of a calendar date, and back again (Fliegel and van Flandern) */
+static long bench_mjd(int year, int month, int day)
+{
+  long a,y,m;
+
+  a = (14-month)/12;
+  y = year+4800-a;
+  m = month+12*a-3;
+  return day + (153*m+2)/5 + 365*y + y/4 - y/100 + y/400 - 32045 - 2400001;
+}
+
+
+static void bench_civil(long mjd, int *year, int *month, int *day)
+{
+  long l,n,i,j;
+
+  l = mjd + 2400001 + 68569;
+  n = 4*l/146097;
+  l = l - (146097*n+3)/4;
+  i = 4000*(l+1)/1461001;
+  l = l - 1461*i/4 + 31;
+  j = 80*l/2447;
+  *day = (int)(l - 2447*j/80);
+  l = j/11;
+  *month = (int)(j + 2 - 12*l);
+  *year = (int)(100*(n-49) + i + l);
+}
+
+
+/* Add a card made from an already formatted value field */
+static void bench_card(BenchHeader *h, const char *key, const char *value, const char *comment)
+{
+  char card[BENCH_CARD_LEN+64];
+  int len;
+
+  if (h->ncards == BENCH_MAX_CARDS-1)	/* Leave room for END */
+    return;
+
+  if (value == NULL)
+    len = sprintf(card,"%-8.8s%.72s",key,comment ? comment : "");
+  else if (comment)
+    len = sprintf(card,"%-8.8s= %-20s / %.47s",key,value,comment);
+  else
+    len = sprintf(card,"%-8.8s= %-20s",key,value);
+  if (len > BENCH_CARD_LEN)
+    len = BENCH_CARD_LEN;
+  memset(card+len,' ',BENCH_CARD_LEN-len);
+  memcpy(h->cards + h->ncards*BENCH_CARD_LEN,card,BENCH_CARD_LEN);
+  h->ncards++;
+}
+
+
+/* True if this keyword should be left out */
+static int bench_drop(BenchHeader *h)
+{
+  return h->missing > 0 && bench_uniform(h->rng) < h->missing;
+}
+
+
+static void bench_key_str(BenchHeader *h, const char *key, const char *value, const char *comment)
+{
+  char quoted[72];
+  int ii,jj;
+
+  if (bench_drop(h))
+    return;
+
+  /* Quotes inside the value are doubled, and it is padded to at least 8 characters */
+  jj = 0;
+  quoted[jj++] = '\'';
+  for (ii=0; value[ii] && jj<66; ii++) {
+    if (value[ii] == '\'')
+      quoted[jj++] = '\'';
+    quoted[jj++] = value[ii];
+  }
+  while (jj < 9)
+    quoted[jj++] = ' ';
+  quoted[jj++] = '\'';
+  quoted[jj] = '\0';
+  bench_card(h,key,quoted,comment);
+}
+
+
+static void bench_key_int(BenchHeader *h, const char *key, long value, const char *comment)
+{
+  char num[32];
+
+  if (bench_drop(h))
+    return;
+  sprintf(num,"%20ld",value);
+  bench_card(h,key,num,comment);
+}
+
+
+static void bench_key_dbl(BenchHeader *h, const char *key, double value, int decimals, const char *comment)
+{
+  char num[64];
+
+  if (bench_drop(h))
+    return;
+  sprintf(num,"%20.*f",decimals,value);
+  bench_card(h,key,num,comment);
+}
+
+
+static void bench_key_log(BenchHeader *h, const char *key, int value, const char *comment)
+{
+  if (bench_drop(h))
+    return;
+  bench_card(h,key,value ? "                   T" : "                   F",comment);
+}
+
+
+/* Sexagesimal, as the TCS writes RA and DEC */
+static void bench_sexagesimal(char *str, double value, int sign)
+{
+  double abs;
+  int dd,mm;
+
+  abs = value < 0 ? -value : value;
+  dd = (int)abs;
+  mm = (int)((abs-dd)*60);
+  if (sign)
+    sprintf(str,"%c%02d:%02d:%04.1f",value<0 ? '-' : '+',dd,mm,((abs-dd)*60-mm)*60);
+  else
+    sprintf(str,"%02d:%02d:%05.2f",dd,mm,((abs-dd)*60-mm)*60);
+}
+
+
+/*
+ * Start the random numbers for one exposure, and choose its type from them:
+ * e for a science exposure, f for a sky flat or b for a bias.
+ */
+static char bench_exptype(const BenchConfig *cfg, int frame, uint64_t *rng)
+{
+  int nn;
+
+  *rng = cfg->seed ^ ((uint64_t)(frame+1) * (((uint64_t)0x9E3779B9 << 32) | 0x7F4A7C15));
+  bench_rand(rng);
+  nn = bench_range(rng,0,99);
+  return nn < 85 ? 'e' : (nn < 95 ? 'f' : 'b');
+}
+
+
+/*
+ * Write one frame. p is 0 for raw, 1 for reduced. Every call with the same frame
+ * number and seed writes the same header, so the raw and reduced versions of an
+ * exposure agree apart from the cards Dp(RT) adds.
+ * Returns the number of bytes written, or -1.
+ */
+static long bench_write_frame(const BenchConfig *cfg, int frame, int run, int seq, int p, const char *path)
+{
+  static char zeros[64*BENCH_BLOCK_LEN];
+  BenchHeader *h;
+  const BenchInst *inst;
+  uint64_t rng,droprng;
+  char str[80],date[16],dateobs[32],utstart[16];
+  double mjd,frac,exptime,ra,dec;
+  long day,ms,naxis1,naxis2,datalen,left,total;
+  int year,month,dd,hh,mi,ii,nn,fd;
+  double ss;
+  char exptype;
+
+  h = (BenchHeader *)malloc(sizeof(BenchHeader));
+  if (h == NULL)
+    return -1;
+
+  /* Everything about the exposure comes from rng, whatever is dropped */
+  exptype = bench_exptype(cfg,frame,&rng);
+  /* and the dropping from this, which differs between the raw and reduced frames */
+  droprng = rng ^ ((uint64_t)(p+1) << 32);
+  bench_rand(&droprng);
+  h->ncards = 0;
+  h->missing = 0;
+  h->rng = &droprng;
+
+  inst = &bench_insts[run % BENCH_NINSTS];
+
+  /* The night runs from 21:00 UT for ten hours, with the frames spread evenly across it */
+  frac = (21.0 + 10.0*frame/(cfg->frames > 0 ? cfg->frames : 1)) / 24.0;
+  day = bench_mjd(cfg->date/10000,(cfg->date/100)%100,cfg->date%100);
+  mjd = day + frac;
+  day = (long)mjd;
+  bench_civil(day,&year,&month,&dd);
+  ms = (long)((mjd-day)*86400000.0 + 0.5);
+  hh = (int)(ms/3600000);
+  mi = (int)(ms/60000%60);
+  ss = (ms%60000)/1000.0;
+  sprintf(date,"%04d-%02d-%02d",year,month,dd);
+  sprintf(dateobs,"%sT%02d:%02d:%06.3f",date,hh,mi,ss);
+  sprintf(utstart,"%02d:%02d:%06.3f",hh,mi,ss);
+  exptime = exptype == 'b' ? 0.0 : 1 + bench_uniform(&rng)*299;
+
+  naxis1 = naxis2 = 0;
+  if (cfg->data_kb > 0) {
+    naxis1 = 1024;
+    naxis2 = (cfg->data_kb*1024/2 + naxis1-1) / naxis1;
+  }
+
+  /* These make it a FITS file, so are never left out */
+  bench_card(h,"SIMPLE","                   T","A valid FITS file");
+  bench_card(h,"BITPIX","                  16","Bits per data value");
+  sprintf(str,"%20d",naxis1 ? 2 : 0);
+  bench_card(h,"NAXIS",str,"Number of axes");
+  if (naxis1) {
+    sprintf(str,"%20ld",naxis1);
+    bench_card(h,"NAXIS1",str,NULL);
+    sprintf(str,"%20ld",naxis2);
+    bench_card(h,"NAXIS2",str,NULL);
+  }
+
+  /* Everything from here on might be missing */
+  h->missing = cfg->missing;
+  bench_key_dbl(h,"BZERO",32768.0,1,"Number to offset data values by");
+  bench_key_dbl(h,"BSCALE",1.0,1,"Number to multiply data values by");
+  bench_key_str(h,"ORIGIN","Liverpool JMU",NULL);
+  bench_key_str(h,"OBSTYPE",exptype == 'e' ? "EXPOSE" : (exptype == 'f' ? "SKYFLAT" : "BIAS"),"What type of observation has been taken");
+  bench_key_int(h,"RUNNUM",run,"Number of Multrun");
+  bench_key_int(h,"EXPNUM",seq,"Number of exposure within Multrun");
+  bench_key_int(h,"EXPTOTAL",bench_range(&rng,seq,seq+4),"Total number of exposures within Multrun");
+  bench_key_str(h,"DATE",date,"[UTC] The start date of the observation");
+  bench_key_str(h,"DATE-OBS",dateobs,"[UTC] The start time of the observation");
+  bench_key_str(h,"UTSTART",utstart,"[UTC] The start time of the observation");
+  bench_key_dbl(h,"MJD",mjd,8,"[days] Modified Julian Days.");
+  bench_key_dbl(h,"EXPTIME",exptime,3,"[Seconds] Exposure length.");
+  bench_key_str(h,"INSTRUME",inst->instrume,"Instrument used.");
+  bench_key_str(h,"INSTATUS","Nominal","The instrument status.");
+  bench_key_int(h,"CONFIGID",bench_range(&rng,1000,99999),"Unique configuration ID.");
+  sprintf(str,"%s-%d",inst->instrume,bench_range(&rng,1,40));
+  bench_key_str(h,"CONFNAME",str,"The instrument configuration used.");
+  bench_key_str(h,"DETECTOR",inst->detector,"Science grade (1) chip.");
+  bench_key_int(h,"PRESCAN",28,"[pixels] Number of pixels in left bias strip.");
+  bench_key_int(h,"POSTSCAN",28,"[pixels] Number of pixels in right bias strip.");
+  bench_key_dbl(h,"GAIN",1.6,2,"[electrons/count] This is a nominal value.");
+  bench_key_dbl(h,"READNOIS",7.0,2,"[electrons/pixel] This is a nominal value.");
+  bench_key_int(h,"CCDXIMSI",naxis1 ? naxis1 : 2048,"[pixels] Imaging pixels");
+  bench_key_int(h,"CCDYIMSI",naxis2 ? naxis2 : 2056,"[pixels] Imaging pixels");
+  nn = bench_range(&rng,1,2);
+  bench_key_int(h,"CCDXBIN",nn,"[pixels] X binning factor");
+  bench_key_int(h,"CCDYBIN",nn,"[pixels] Y binning factor");
+  bench_key_dbl(h,"CCDATEMP",163.0+bench_uniform(&rng),2,"[Kelvin] Actual temperature");
+  bench_key_dbl(h,"CCDSTEMP",163.0,2,"[Kelvin] Required temperature.");
+  if (inst->pixscale > 0)
+    bench_key_dbl(h,"CCDSCALE",inst->pixscale*nn,4,"[arcsec/binned pixel] Scale of binned image on CCD");
+
+  /* The filter wheels of an imager, or the grating of a spectrograph */
+  for (ii=1; ii<=inst->nfilters; ii++) {
+    const char *filter;
+    char key[32],ikey[32],id[32];
+
+    filter = (ii == 1 || bench_uniform(&rng) < 0.2)
+      ? bench_filters[bench_range(&rng,0,(int)(sizeof(bench_filters)/sizeof(bench_filters[0]))-1)]
+      : (bench_uniform(&rng) < 0.5 ? "clear" : "NONE");
+    sprintf(key,"FILTER%d",ii);
+    sprintf(ikey,"FILTERI%d",ii);
+    sprintf(id,"%s-%02d",filter,bench_range(&rng,1,3));
+    bench_key_str(h,key,filter,"The specific filter used.");
+    bench_key_str(h,ikey,id,"The specific filter used.");
+  }
+  if (inst->nfilters == 0) {
+    bench_key_str(h,"GRATID",bench_uniform(&rng) < 0.5 ? "red" : "blue","Grating ID");
+    bench_key_int(h,"GRATPOS",bench_range(&rng,0,1),"Grating position (0=low res, 1=high res)");
+  }
+
+  bench_key_str(h,"TELESCOP","Liverpool Telescope","The Name of the Telescope");
+  bench_key_str(h,"TELMODE","ROBOTIC","[{PLANETARIUM, ROBOTIC, MANUAL, ENGINEERING}]");
+  nn = bench_range(&rng,0,(int)(sizeof(bench_proposals)/sizeof(bench_proposals[0]))-1);
+  bench_key_str(h,"TAGID",bench_proposals[nn]+2,"Telescope Allocation Committee ID");
+  bench_key_str(h,"USERID","Bench.User","User login ID");
+  bench_key_str(h,"PROPID",bench_proposals[nn],"Proposal ID");
+  sprintf(str,"%s bench group %d",bench_proposals[nn],run%17);
+  bench_key_str(h,"GROUPID",str,"Group Id");
+  bench_key_str(h,"OBSID","ExposeCCD","Observation ID");
+  bench_key_str(h,"GRPTIMNG",bench_uniform(&rng) < 0.5 ? "MONITOR" : "FLEXIBLE","Group timing constraint class");
+  bench_key_int(h,"GRPUID",bench_range(&rng,100000,999999),"Group unique ID");
+  bench_key_int(h,"GRPNUMOB",1,"Number of observations in group");
+
+  nn = bench_range(&rng,0,(int)(sizeof(bench_objects)/sizeof(bench_objects[0]))-1);
+  ra = bench_uniform(&rng)*24;
+  dec = bench_uniform(&rng)*120 - 30;
+  if (exptype == 'e') {
+    bench_key_str(h,"OBJECT",bench_objects[nn],"Actual system object");
+    if (bench_uniform(&rng) < 0.6)
+      bench_key_str(h,"CAT-NAME",bench_objects[nn],"Catalog name");
+  }
+  else
+    bench_key_str(h,"OBJECT",exptype == 'f' ? "flat" : "bias","Actual system object");
+  bench_sexagesimal(str,ra,0);
+  bench_key_str(h,"CAT-RA",str,"[HH:MM:SS.ss] Catalog RA");
+  bench_key_str(h,"RA",str,"[HH:MM:SS.ss] Currently same as CAT_RA");
+  bench_sexagesimal(str,dec,1);
+  bench_key_str(h,"CAT-DEC",str,"[DD:MM:SS.ss] Catalog declination");
+  bench_key_str(h,"DEC",str,"[DD:MM:SS.ss] Currently same as CAT_DEC");
+  bench_key_dbl(h,"CAT-EQUI",2000.0,1,"[Years] Catalog coordinate equinox");
+  bench_key_dbl(h,"CAT-EPOC",2000.0,1,"[Years] Catalog coordinate epoch");
+  bench_key_str(h,"RADECSYS","FK5","[{FK4, FK5}] Fundamental coordinate system");
+  bench_key_dbl(h,"EQUINOX",2000.0,1,"[Years] Date of the coordinate system");
+  bench_key_dbl(h,"AIRMASS",1 + bench_uniform(&rng),4,"Airmass");
+  bench_key_dbl(h,"ROTSKYPA",bench_uniform(&rng)*360-180,4,"[degs] Sky position angle");
+  bench_key_dbl(h,"ROTANGLE",bench_uniform(&rng)*360-180,4,"[degs] Mount position angle");
+  bench_key_str(h,"MOONSTAT","DOWN","[{UP, DOWN}] Moon position at start of current observation");
+  bench_key_dbl(h,"MOONFRAC",bench_uniform(&rng),4,"Lunar Illuminated Fraction");
+  bench_key_dbl(h,"MOONDIST",bench_uniform(&rng)*180,4,"[Degs] Lunar Distance from Target");
+  bench_key_dbl(h,"SUNDIST",bench_uniform(&rng)*180,4,"[Degs] Solar Distance from Target");
+  bench_key_dbl(h,"WINDSPEE",bench_uniform(&rng)*15,4,"[m/s] Windspeed");
+  bench_key_dbl(h,"WMSTEMP",275 + bench_uniform(&rng)*15,4,"[Kelvin] Current external temperature");
+  bench_key_dbl(h,"WMSHUMID",bench_uniform(&rng)*80,4,"[0.00% - 100.00%] Current relative humidity");
+  bench_key_dbl(h,"WMSPRES",770 + bench_uniform(&rng)*10,4,"[mbar] Current pressure");
+  bench_key_log(h,"AUTOGUID",bench_uniform(&rng) < 0.7,"Autoguider used");
+  bench_key_dbl(h,"FOCDMD",27.0 + bench_uniform(&rng),4,"[mm] Demand focus position");
+  bench_card(h,"COMMENT",NULL,"  FITS (Flexible Image Transport System) format is defined in 'Astronomy");
+  bench_card(h,"COMMENT",NULL,"  and Astrophysics', volume 376, page 359; bibcode: 2001A&A...376..359H");
+
+  /* What Dp(RT) adds */
+  if (p > 0) {
+    bench_key_str(h,"L1DATE",date,"[UTC] Date the data was reduced");
+    bench_key_str(h,"L1BIAS","bias_frame.fits","Bias frame used");
+    bench_key_str(h,"L1FLAT",exptype == 'e' ? "flat_frame.fits" : "","Flat frame used");
+    bench_key_int(h,"L1STATOV",bench_uniform(&rng) < 0.9 ? 1 : -1,"Status flag for overscan correction");
+    bench_key_int(h,"L1STATZE",bench_uniform(&rng) < 0.95 ? 1 : 2,"Status flag for bias frame subtraction");
+    bench_key_int(h,"L1STATTR",1,"Status flag for overscan trimming");
+    bench_key_int(h,"L1STATFL",exptype == 'e' ? (bench_uniform(&rng) < 0.95 ? 1 : -2) : -1,"Status flag for flatfielding");
+    bench_key_int(h,"L1STATDA",-1,"Status flag for dark frame subtraction");
+    bench_key_int(h,"L1STATFR",1,"Status flag for fringe removal");
+    bench_key_dbl(h,"L1MEDIAN",500 + bench_uniform(&rng)*5000,3,"[counts] Median counts in image");
+    bench_key_dbl(h,"L1SKYBRT",18 + bench_uniform(&rng)*3,3,"[mag/arcsec^2] Sky brightness");
+    if (bench_uniform(&rng) < 0.8)
+      bench_key_dbl(h,"L1SEESEC",0.6 + bench_uniform(&rng)*2.5,3,"[arcsec] Frame seeing in arcsec");
+    else
+      bench_key_dbl(h,"L1SEEING",3 + bench_uniform(&rng)*10,3,"[pixels] Frame seeing in pixels");
+    bench_key_dbl(h,"L1PHOTOM",bench_uniform(&rng) < 0.7 ? -0.1 : 25 + bench_uniform(&rng),4,"[mag] Zeropoint");
+    if (bench_uniform(&rng) < 0.2)
+      bench_key_str(h,"SCHEDSKY","UNKNOWN","[mag/arcsec^2] Predicted sky brightness");
+    else
+      bench_key_dbl(h,"SCHEDSKY",19 + bench_uniform(&rng)*2,3,"[mag/arcsec^2] Predicted sky brightness");
+    nn = bench_range(&rng,8,40);
+    for (ii=0; ii<nn; ii++) {
+      sprintf(str,"  Dp(RT) pipeline step %d of %d completed",ii+1,nn);
+      bench_card(h,"HISTORY",NULL,str);
+    }
+  }
+
+  bench_card(h,"END",NULL,NULL);
+  /* Blank cards up to the end of the last block */
+  nn = (BENCH_BLOCK_LEN/BENCH_CARD_LEN) - h->ncards % (BENCH_BLOCK_LEN/BENCH_CARD_LEN);
+  if (nn < BENCH_BLOCK_LEN/BENCH_CARD_LEN) {
+    memset(h->cards + h->ncards*BENCH_CARD_LEN,' ',nn*BENCH_CARD_LEN);
+    h->ncards += nn;
+  }
+
+  fd = open(path,O_WRONLY|O_CREAT|O_TRUNC,0644);
+  if (fd < 0) {
+    free(h);
+    return -1;
+  }
+
+  total = (long)h->ncards*BENCH_CARD_LEN;
+  if (write(fd,h->cards,total) != total) {
+    close(fd);
+    free(h);
+    return -1;
+  }
+
+  datalen = naxis1*naxis2*2;
+  datalen = ((datalen + BENCH_BLOCK_LEN-1) / BENCH_BLOCK_LEN) * BENCH_BLOCK_LEN;
+  for (left=datalen; left>0; left-=nn) {
+    nn = left < (long)sizeof(zeros) ? (int)left : (int)sizeof(zeros);
+    if (write(fd,zeros,nn) != nn) {
+      close(fd);
+      free(h);
+      return -1;
+    }
+  }
+  total += datalen;
+
+  close(fd);
+  free(h);
+  return total;
+}
+
+
+/*
+ * Make sure dir exists and holds nothing we did not make.
+ * Returns 0, or 1 with the reason printed.
+ */
+static int bench_prepare_dir(const char *dir)
+{
+  DIR *dp;
+  struct dirent *de;
+  char path[PATH_MAX];
+  int marked,others;
+  FILE *fp;
+
+  if (mkdir(dir,0755) != 0 && errno != EEXIST) {
+    printf("Could not create %s: %s\n",dir,strerror(errno));
+    return 1;
+  }
+
+  dp = opendir(dir);
+  if (dp == NULL) {
+    printf("Could not open %s: %s\n",dir,strerror(errno));
+    return 1;
+  }
+  sprintf(path,"%s/%s",dir,BENCH_MARKER);
+  marked = access(path,F_OK) == 0;
+  others = 0;
+  while ((de = readdir(dp)) != NULL) {
+    if (strcmp(de->d_name,".") == 0 || strcmp(de->d_name,"..") == 0 || strcmp(de->d_name,BENCH_MARKER) == 0)
+      continue;
+    if (!marked) {
+      others = 1;
+      break;
+    }
+    sprintf(path,"%s/%s",dir,de->d_name);
+    if (unlink(path) != 0) {
+      printf("Could not remove %s: %s\n",path,strerror(errno));
+      closedir(dp);
+      return 1;
+    }
+  }
+  closedir(dp);
+
+  if (others) {
+    printf("%s is not empty and was not made by autolog_bench. Give an empty or new directory.\n",dir);
+    return 1;
+  }
+
+  sprintf(path,"%s/%s",dir,BENCH_MARKER);
+  fp = fopen(path,"w");
+  if (fp == NULL) {
+    printf("Could not create %s: %s\n",path,strerror(errno));
+    return 1;
+  }
+  fprintf(fp,"Made by autolog_bench. Everything in this directory is removed by the next run.\n");
+  fclose(fp);
+
+  return 0;
+}
+
+
+/*
+ * Fill cfg->dir with the synthetic night.
+ * Returns the number of FITS files written, or -1. *bytes is their total size.
+ */
+static int bench_make_night(const BenchConfig *cfg, double *bytes)
+{
+  uint64_t rng,framerng;
+  char path[PATH_MAX+64];
+  const BenchInst *inst;
+  int frame,run,seq,runlen,nfiles,reduced,keepraw;
+  long len;
+  char exptype;
+
+  if (bench_prepare_dir(cfg->dir))
+    return -1;
+
+  rng = cfg->seed;
+  bench_rand(&rng);
+  nfiles = 0;
+  *bytes = 0;
+  run = 0;
+  seq = runlen = 0;
+
+  for (frame=0; frame<cfg->frames; frame++) {
+    /* Exposures come in multruns of one to five */
+    if (seq == runlen) {
+      run++;
+      seq = 0;
+      runlen = bench_range(&rng,1,5);
+    }
+    seq++;
+
+    inst = &bench_insts[run % BENCH_NINSTS];
+    exptype = bench_exptype(cfg,frame,&framerng);
+    reduced = bench_uniform(&rng) < cfg->reduced;
+    keepraw = !reduced || bench_uniform(&rng) < 0.5;
+
+    if (keepraw) {
+      sprintf(path,"%s/%s_%c_%08d_%d_1_%d_0.fits",cfg->dir,inst->prefix,exptype,cfg->date,run,seq);
+      if ((len = bench_write_frame(cfg,frame,run,seq,0,path)) < 0)
+	break;
+      nfiles++;
+      *bytes += len;
+    }
+    if (reduced) {
+      sprintf(path,"%s/%s_%c_%08d_%d_1_%d_1.fits",cfg->dir,inst->prefix,exptype,cfg->date,run,seq);
+      if ((len = bench_write_frame(cfg,frame,run,seq,1,path)) < 0)
+	break;
+      nfiles++;
+      *bytes += len;
+    }
+  }
+
+  if (frame < cfg->frames) {
+    printf("Could not write %s: %s\n",path,strerror(errno));
+    return -1;
+  }
+  return nfiles;
+}
+
+
+static double bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+
+/* rchar and read_bytes of a process which has exited but not been reaped. 0 if found */
+static int bench_proc_io(pid_t pid, long *rchar, long *read_bytes)
+{
+  char path[64],line[128];
+  FILE *fp;
+  long val;
+
+  sprintf(path,"/proc/%ld/io",(long)pid);
+  fp = fopen(path,"r");
+  if (fp == NULL)
+    return 1;
+  while (fgets(line,sizeof(line),fp)) {
+    if (sscanf(line,"rchar: %ld",&val) == 1)
+      *rchar = val;
+    else if (sscanf(line,"read_bytes: %ld",&val) == 1)
+      *read_bytes = val;
+  }
+  fclose(fp);
+  return 0;
+}
+
+
+/* Run argv once in dir, with dir as its last argument */
+static void bench_run(const BenchConfig *cfg, char **argv, BenchResult *res)
+{
+  struct rusage ru;
+  siginfo_t si;
+  double start;
+  pid_t pid;
+  int status,fd;
+
+  res->wall = res->cpu = 0;
+  res->rchar = res->read_bytes = -1;
+  res->maxrss = 0;
+  res->status = -1;
+
+  fflush(stdout);
+  start = bench_now();
+  pid = fork();
+  if (pid < 0)
+    return;
+  if (pid == 0) {
+    fd = open("/dev/null",O_WRONLY);
+    if (fd >= 0) {
+      dup2(fd,STDOUT_FILENO);
+      dup2(fd,STDERR_FILENO);
+      close(fd);
+    }
+    if (chdir(cfg->dir) != 0)
+      _exit(126);
+    execvp(argv[0],argv);
+    _exit(127);
+  }
+
+  /* Wait without reaping, so that /proc/<pid>/io is still there to be read */
+  while (waitid(P_PID,pid,&si,WEXITED|WNOWAIT) != 0 && errno == EINTR)
+    ;
+  res->wall = bench_now() - start;
+  bench_proc_io(pid,&res->rchar,&res->read_bytes);
+
+  while (wait4(pid,&status,0,&ru) < 0 && errno == EINTR)
+    ;
+  res->cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec*1e-6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec*1e-6;
+#ifdef __APPLE__
+  res->maxrss = ru.ru_maxrss/1024;	/* Bytes here, KB on Linux */
+#else
+  res->maxrss = ru.ru_maxrss;
+#endif
+  if (res->read_bytes < 0)
+    res->read_bytes = ru.ru_inblock*512L;
+  res->status = WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status);
+}
+
+
+/*
+ * Split a command into argv on blanks and add dir on the end. cmd is written on.
+ * Returns the number of arguments, or -1 if there are too many.
+ */
+static int bench_split(char *cmd, const char *dir, char **argv)
+{
+  char *tok;
+  int argc;
+
+  argc = 0;
+  for (tok=strtok(cmd," \t"); tok; tok=strtok(NULL," \t")) {
+    if (argc == BENCH_MAX_ARGS-2)
+      return -1;
+    argv[argc++] = tok;
+  }
+  argv[argc++] = (char *)dir;
+  argv[argc] = NULL;
+  return argc;
+}
+
+
+static void bench_usage(void)
+{
+  printf("autolog_bench [--frames=N] [--seed=S] [--missing=PCT] [--reduced=PCT] [--data=KB]\n");
+  printf("\t[--date=YYYYMMDD] [--runs=R] DIR [-- \"command args\" ...]\n");
+  printf("Makes a synthetic night of N LT exposures in DIR, then runs each command R times\n");
+  printf("with DIR as its last argument and reports files/s, bytes read and peak RSS.\n");
+  printf("--frames=N exposures to make. Default 2000\n");
+  printf("--seed=S the same seed always makes the same night. Default 1\n");
+  printf("--missing=PCT chance of each keyword being left out of a header. Default 3\n");
+  printf("--reduced=PCT how many exposures Dp(RT) has reduced. Half keep their raw frame. Default 60\n");
+  printf("--data=KB size of the data unit of every frame. Default 0, headers only\n");
+  printf("--date=YYYYMMDD the night. Default 20200624\n");
+  printf("--runs=R times to run each command. Default 3\n");
+  printf("DIR is created if need be. It must be empty or have been made by autolog_bench.\n");
+}
+
+
+int main(int argc, char **argv)
+{
+  BenchConfig cfg;
+  BenchResult res;
+  char *cmd,*args[BENCH_MAX_ARGS],label[40];
+  double bytes,t0;
+  int ii,nfiles,first_cmd,cc,rr;
+  const char *dir;
+
+  cfg.frames = 2000;
+  cfg.seed = 1;
+  cfg.missing = 0.03;
+  cfg.reduced = 0.6;
+  cfg.data_kb = 0;
+  cfg.date = 20200624;
+  cfg.runs = 3;
+  dir = NULL;
+  first_cmd = argc;
+
+  for (ii=1; ii<argc; ii++) {
+    if (strncmp(argv[ii],"--frames=",9) == 0)
+      cfg.frames = atoi(argv[ii]+9);
+    else if (strncmp(argv[ii],"--seed=",7) == 0)
+      cfg.seed = strtoul(argv[ii]+7,NULL,10);
+    else if (strncmp(argv[ii],"--missing=",10) == 0)
+      cfg.missing = atof(argv[ii]+10)/100;
+    else if (strncmp(argv[ii],"--reduced=",10) == 0)
+      cfg.reduced = atof(argv[ii]+10)/100;
+    else if (strncmp(argv[ii],"--data=",7) == 0)
+      cfg.data_kb = atol(argv[ii]+7);
+    else if (strncmp(argv[ii],"--date=",7) == 0)
+      cfg.date = atoi(argv[ii]+7);
+    else if (strncmp(argv[ii],"--runs=",7) == 0)
+      cfg.runs = atoi(argv[ii]+7);
+    else if (strcmp(argv[ii],"--") == 0) {
+      first_cmd = ii+1;
+      break;
+    }
+    else if (argv[ii][0] == '-' || dir != NULL) {
+      bench_usage();
+      return 1;
+    }
+    else
+      dir = argv[ii];
+  }
+
+  if (dir == NULL || cfg.frames < 1 || cfg.runs < 1 || cfg.data_kb < 0 ||
+      cfg.date < 19000101 || (cfg.date/100)%100 < 1 || (cfg.date/100)%100 > 12) {
+    bench_usage();
+    return 1;
+  }
+  if (cfg.seed == 0)		/* xorshift would stay at zero */
+    cfg.seed = 1;
+  if (strlen(dir) >= sizeof(cfg.dir)-64) {
+    printf("Directory name too long: %s\n",dir);
+    return 1;
+  }
+  strcpy(cfg.dir,dir);
+
+  t0 = bench_now();
+  nfiles = bench_make_night(&cfg,&bytes);
+  if (nfiles < 0)
+    return 1;
+  printf("%d exposures in %d files, %.1f MB, made in %s in %.2f s\n",cfg.frames,nfiles,bytes/1e6,cfg.dir,bench_now()-t0);
+
+  /* Children run in the night directory, so it must be absolute in their arguments */
+  if (realpath(dir,cfg.dir) == NULL) {
+    printf("Could not resolve %s: %s\n",dir,strerror(errno));
+    return 1;
+  }
+
+  if (first_cmd >= argc)
+    return 0;
+
+  printf("%-32s %3s %8s %9s %8s %9s %9s %8s %6s\n","command","run","wall s","files/s","cpu s","read MB","disk MB","RSS MB","exit");
+  for (cc=first_cmd; cc<argc; cc++) {
+    cmd = (char *)malloc(strlen(argv[cc])+1);
+    if (cmd == NULL)
+      return 1;
+    strcpy(cmd,argv[cc]);
+    sprintf(label,"%.32s",argv[cc]);
+    if (bench_split(cmd,cfg.dir,args) < 2) {
+      printf("Empty or overlong command: %s\n",argv[cc]);
+      free(cmd);
+      return 1;
+    }
+    for (rr=1; rr<=cfg.runs; rr++) {
+      bench_run(&cfg,args,&res);
+      printf("%-32s %3d %8.3f %9.0f %8.3f ",label,rr,res.wall,res.wall > 0 ? nfiles/res.wall : 0.0,res.cpu);
+      if (res.rchar >= 0)
+	printf("%9.2f ",res.rchar/1e6);
+      else
+	printf("%9s ","-");
+      printf("%9.2f %8.1f %6d\n",res.read_bytes/1e6,res.maxrss/1024.0,res.status);
+    }
+    free(cmd);
+  }
+
+  return 0;
+}
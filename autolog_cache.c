@@ -0,0 +1,276 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+The --cache option. autolog gets run several times over the same directory each night
+(from cron, then again after Dp(RT)), and without this every run re-reads every header.
+
+The cache is a single file, AUTOLOG_CACHE_NAME, in the data directory next to
+autolog_status.log. It is simply a CacheFileHeader followed by an array of CacheRecord,
+sorted by inode. Loading it is one mmap() and looking a file up is a binary search, so
+there is no parsing at all. A file is only taken from the cache if its inode, size, mtime
+and ctime all still match, otherwise it is read again as normal.
+
+The cache holds raw struct contents, so it is only good for the machine and the build which
+wrote it, and the keyword schema it was read with. The version number, record size and
+schema checksum in the header catch the obvious mismatches, and any cache which does not
+look right is just ignored and rewritten at the end of the run.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+
+static int cache_compare_inode(const void *a, const void *b)
+{
+  const CacheRecord *ra = (const CacheRecord *)a;
+  const CacheRecord *rb = (const CacheRecord *)b;
+
+  if (ra->inode < rb->inode) return -1;
+  if (ra->inode > rb->inode) return 1;
+  return 0;
+}
+
+
+/*
+ * Map the cache file in dirname, if there is a usable one. The cache is always usable
+ * afterwards, even if there was no file (it just starts empty). A cache written with
+ * a different keyword schema (schema_sum) is no use either. Returns the number of
+ * records loaded.
+ */
+int cache_load(LogCache *cache, const char *dirname, unsigned int schema_sum)
+{
+  int fd;
+  struct stat st;
+  const CacheFileHeader *fhdr;
+
+  cache->map = NULL;
+  cache->map_len = 0;
+  cache->old = NULL;
+  cache->nold = 0;
+  cache->new = NULL;
+  cache->nnew = 0;
+  cache->nalloc = 0;
+  cache->hits = 0;
+  cache->schema_sum = schema_sum;
+  sprintf(cache->path,"%s/%s",dirname,AUTOLOG_CACHE_NAME);
+
+  fd = open(cache->path,O_RDONLY);
+  if (fd < 0)
+    return 0;
+
+  if (fstat(fd,&st) != 0 || st.st_size < (off_t)sizeof(CacheFileHeader)) {
+    close(fd);
+    return 0;
+  }
+
+  cache->map = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+  close(fd);
+  if (cache->map == MAP_FAILED) {
+    cache->map = NULL;
+    return 0;
+  }
+  cache->map_len = st.st_size;
+
+  /* Anything unexpected and we pretend there was no cache */
+  fhdr = (const CacheFileHeader *)cache->map;
+  if (memcmp(fhdr->magic,AUTOLOG_CACHE_MAGIC,8) != 0
+      || fhdr->version != AUTOLOG_CACHE_VERSION
+      || fhdr->record_size != sizeof(CacheRecord)
+      || fhdr->schema_sum != schema_sum
+      || sizeof(CacheFileHeader) + (size_t)fhdr->nrecords*sizeof(CacheRecord) > cache->map_len) {
+    munmap(cache->map,cache->map_len);
+    cache->map = NULL;
+    cache->map_len = 0;
+    return 0;
+  }
+
+  cache->old = (const CacheRecord *)((const char *)cache->map + sizeof(CacheFileHeader));
+  cache->nold = fhdr->nrecords;
+
+  return cache->nold;
+}
+
+
+/*
+ * stat() the file behind job and look for it in the cache. On a hit, job is filled in
+ * exactly as extract_LogInfo() would have done and job->from_cache is set.
+ * Either way the file's identity is left in job, ready for cache_add().
+ * Returns 1 on a hit, 0 otherwise.
+ */
+int cache_fill_job(LogCache *cache, const char *dirname, LogJob *job)
+{
+  char path[1024];
+  struct stat st;
+  CacheRecord key;
+  const CacheRecord *rec;
+  long first;
+
+  job->from_cache = 0;
+  job->inode = 0;
+
+  sprintf(path,"%s/%s.%s",dirname,job->cur.exposure,job->cur.ext);
+  if (stat(path,&st) != 0)
+    return 0;
+
+  job->inode = st.st_ino;
+  job->size = st.st_size;
+  job->mtime = st.st_mtime;
+  job->ctime = st.st_ctime;
+
+  if (cache->nold == 0)
+    return 0;
+
+  key.inode = st.st_ino;
+  rec = (const CacheRecord *)bsearch(&key,cache->old,cache->nold,sizeof(CacheRecord),cache_compare_inode);
+  if (rec == NULL)
+    return 0;
+
+  /* bsearch() may land anywhere in a run of equal inodes (a file was deleted and its
+   * inode reused). Step back to the first and check them all */
+  first = rec - cache->old;
+  while (first > 0 && cache->old[first-1].inode == key.inode)
+    first--;
+
+  for (rec = cache->old+first; rec < cache->old+cache->nold && rec->inode == key.inode; rec++) {
+    if (rec->size == job->size && rec->mtime == job->mtime && rec->ctime == job->ctime
+	&& rec->no_dprt == job->no_dprt
+	&& strcmp(rec->info.exposure,job->cur.exposure) == 0) {
+      job->status = rec->status;
+      job->date_read = rec->date_read;
+      job->date_year = rec->date_year;
+      job->date_month = rec->date_month;
+      job->date_day = rec->date_day;
+      job->bytes_read = 0;
+      job->info = rec->info;
+      job->report = rec->report;
+      job->from_cache = 1;
+      cache->hits++;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+
+/*
+ * Add a file which has been read (or taken from the cache) this run to the new cache.
+ * Files which could not be stat()ed are not cached.
+ */
+void cache_add(LogCache *cache, const LogJob *job)
+{
+  CacheRecord *rec,*newrecs;
+
+  if (job->inode == 0)
+    return;
+
+  if (cache->nnew == cache->nalloc) {
+    cache->nalloc = cache->nalloc ? 2*cache->nalloc : 256;
+    newrecs = (CacheRecord *)realloc(cache->new,cache->nalloc*sizeof(CacheRecord));
+    if (newrecs == NULL) {
+      cache->nalloc = cache->nnew;
+      return;
+    }
+    cache->new = newrecs;
+  }
+
+  rec = &cache->new[cache->nnew++];
+  memset(rec,0,sizeof(CacheRecord));
+  rec->inode = job->inode;
+  rec->size = job->size;
+  rec->mtime = job->mtime;
+  rec->ctime = job->ctime;
+  rec->no_dprt = job->no_dprt;
+  rec->status = job->status;
+  rec->date_read = job->date_read;
+  rec->date_year = job->date_year;
+  rec->date_month = job->date_month;
+  rec->date_day = job->date_day;
+  rec->info = job->info;
+  rec->report = job->report;
+}
+
+
+/*
+ * Write everything given to cache_add() out as the new cache. Files which have gone from
+ * the directory since the last run are thereby dropped. The file is written under a
+ * temporary name and renamed, so a run which is killed part way never leaves a broken cache.
+ * Returns 0 on success.
+ */
+int cache_save(LogCache *cache)
+{
+  char tmppath[1040];
+  CacheFileHeader fhdr;
+  FILE *fp;
+  int ok;
+
+  qsort(cache->new,cache->nnew,sizeof(CacheRecord),cache_compare_inode);
+
+  memset(&fhdr,0,sizeof(fhdr));
+  memcpy(fhdr.magic,AUTOLOG_CACHE_MAGIC,8);
+  fhdr.version = AUTOLOG_CACHE_VERSION;
+  fhdr.record_size = sizeof(CacheRecord);
+  fhdr.nrecords = cache->nnew;
+  fhdr.schema_sum = cache->schema_sum;
+
+  sprintf(tmppath,"%s.tmp",cache->path);
+  fp = fopen(tmppath,"wb");
+  if (fp == NULL)
+    return 1;
+
+  ok = (fwrite(&fhdr,sizeof(fhdr),1,fp) == 1);
+  if (ok && cache->nnew > 0)
+    ok = (fwrite(cache->new,sizeof(CacheRecord),cache->nnew,fp) == cache->nnew);
+  if (fclose(fp) != 0)
+    ok = 0;
+
+  if (!ok || rename(tmppath,cache->path) != 0) {
+    remove(tmppath);
+    return 1;
+  }
+
+  return 0;
+}
+
+
+void cache_close(LogCache *cache)
+{
+  if (cache->map)
+    munmap(cache->map,cache->map_len);
+  cache->map = NULL;
+  cache->old = NULL;
+  cache->nold = 0;
+  free(cache->new);
+  cache->new = NULL;
+  cache->nnew = cache->nalloc = 0;
+}
@@ -0,0 +1,346 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+autolog_cardbench. Times the card scans of autolog_cardscan.c, the plain C versions against
+the SSE2 and AVX2 ones, on synthetic headers held in memory. This is what `make cardbench`
+runs. Nothing is read from disk, so it shows only what the scans themselves cost.
+
+  autolog_cardbench [--headers=N] [--cards=C] [--seed=S] [--runs=R]
+
+N headers of C cards each are made, the last of them END, from a mix of what our
+instruments write: quoted strings, some with '' in them or running on to the end of the
+card with no closing quote, numbers right justified in column 30, T and F, comments after
+a '/' or not, COMMENT and HISTORY cards and blank ones. The default of 324 cards is nine
+blocks, about what IO:O writes once Dp(RT) has added its keywords.
+
+For each version the CPU can do, three things are timed, each the best of R runs:
+	end	find END a block at a time, as rawhdr_add_block() does
+	find	find 8 keywords spread through the header, as rawhdr_find_card() does
+	value	find the value of every card, as rawhdr_card_value() does
+and given as ns a card, and as how many times faster than the plain C version. Before
+anything is timed, every card of every header is checked to give the same answer with
+each version as with plain C, and if one does not, that is reported and we stop.
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+#define CARDBENCH_NFIND 8	/* Keywords looked for by name in each header */
+#define CARDBENCH_NTESTS 3
+
+/* Everything given on the command line */
+typedef struct CardBenchConfig_Struct{
+  int headers;
+  int cards;			/* In each header, END included */
+  uint64_t seed;
+  int runs;
+}CardBenchConfig;
+
+static const char *cardbench_tests[CARDBENCH_NTESTS] = {"end","find","value"};
+
+static const char *cardbench_strings[] = {"IO:O","SDSS-R","M 31","JL20A07","Barnard''s Star",
+					  "e2v CCD 231-84","EXPOSE","2020-06-24T23:41:12.345","Clear",
+					  "ZTF20aaelulu","H-Alpha-6566","PG 1530+057","Slit 1/2","''",""};
+#define CARDBENCH_NSTRINGS ((int)(sizeof(cardbench_strings)/sizeof(cardbench_strings[0])))
+
+
+/* xorshift64*, as autolog_bench */
+static uint64_t cardbench_rand(uint64_t *state)
+{
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * (((uint64_t)0x2545F491 << 32) | 0x4F6CDD1D);
+}
+
+
+/* Uniform integer in [0,nn) */
+static int cardbench_pick(uint64_t *state, int nn)
+{
+  return (int)((cardbench_rand(state) >> 33) % (uint64_t)nn);
+}
+
+
+static double cardbench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+
+/* A card with keyword key, of one of the kinds above, into the 80 characters at card */
+static void cardbench_card(char *card, const char *key, uint64_t *rng)
+{
+  char text[200];
+  int len;
+
+  switch (cardbench_pick(rng,10)) {
+  case 0:
+    len = sprintf(text,"%-8.8s %s",cardbench_pick(rng,2) ? "COMMENT" : "HISTORY","Written by the synthetic header maker");
+    break;
+  case 1:
+    len = 0;
+    break;
+  case 2:
+    len = sprintf(text,"%-8.8s= %20s",key,cardbench_pick(rng,2) ? "T" : "F");
+    break;
+  case 3:
+    /* Runs off the end of the card, with no closing quote */
+    len = sprintf(text,"%-8.8s= '%s",key,"A string far too long for the card it is on, which never gets its closing quote");
+    break;
+  case 4:
+  case 5:
+    len = sprintf(text,"%-8.8s= %20.6f / [deg] A number with its units",key,(double)cardbench_pick(rng,360000)/1000.0);
+    break;
+  case 6:
+    len = sprintf(text,"%-8.8s= %20d",key,cardbench_pick(rng,100000)-50000);
+    break;
+  default:
+    len = sprintf(text,"%-8.8s= '%-8s'%s",key,cardbench_strings[cardbench_pick(rng,CARDBENCH_NSTRINGS)],
+		  cardbench_pick(rng,2) ? " / The value, which is a string" : "");
+    break;
+  }
+  if (len > RAWHDR_CARD_LEN)
+    len = RAWHDR_CARD_LEN;
+  memset(card,' ',RAWHDR_CARD_LEN);
+  memcpy(card,text,len);
+}
+
+
+/*
+ * Make the headers, one after another in a single buffer, and the keywords to look for
+ * by name in each, at find[CARDBENCH_NFIND*hh]. NULL if out of memory.
+ */
+static char *cardbench_make(const CardBenchConfig *cfg, char *find)
+{
+  char *cards,*card,key[16];
+  uint64_t rng;
+  int hh,ii,ff;
+
+  cards = (char *)malloc((size_t)cfg->headers*cfg->cards*RAWHDR_CARD_LEN);
+  if (cards == NULL)
+    return NULL;
+  rng = cfg->seed;
+  for (hh=0; hh<cfg->headers; hh++) {
+    card = cards + (size_t)hh*cfg->cards*RAWHDR_CARD_LEN;
+    memcpy(card,"SIMPLE  =                    T",30);
+    memset(card+30,' ',RAWHDR_CARD_LEN-30);
+    for (ii=1; ii<cfg->cards-1; ii++) {
+      sprintf(key,"KEY%05d",cardbench_pick(&rng,100000));
+      cardbench_card(card+ii*RAWHDR_CARD_LEN,key,&rng);
+    }
+    memset(card+(cfg->cards-1)*RAWHDR_CARD_LEN,' ',RAWHDR_CARD_LEN);
+    memcpy(card+(cfg->cards-1)*RAWHDR_CARD_LEN,"END",3);
+
+    /* Keywords from all through the header, and one which is not there */
+    for (ff=0; ff<CARDBENCH_NFIND-1; ff++)
+      memcpy(find+(hh*CARDBENCH_NFIND+ff)*8,card+((ff+1)*(cfg->cards-1)/CARDBENCH_NFIND)*RAWHDR_CARD_LEN,8);
+    memcpy(find+(hh*CARDBENCH_NFIND+ff)*8,"NOTTHERE",8);
+  }
+  return cards;
+}
+
+
+/* Test tt over every header. Returns a sum of what was found, so that it is not optimised away */
+static long cardbench_run(const CardBenchConfig *cfg, int tt, const char *cards, const char *find)
+{
+  const char *hdr;
+  long sum;
+  int hh,ii,nn,start,len,found;
+
+  sum = 0;
+  for (hh=0; hh<cfg->headers; hh++) {
+    hdr = cards + (size_t)hh*cfg->cards*RAWHDR_CARD_LEN;
+    switch (tt) {
+    case 0:
+      for (ii=0; ii<cfg->cards; ii+=RAWHDR_CARDS_PER_BLOCK) {
+	nn = MIN(RAWHDR_CARDS_PER_BLOCK,cfg->cards-ii);
+	found = cardscan_find(hdr+ii*RAWHDR_CARD_LEN,nn,"END     ");
+	if (found < nn) {
+	  sum += ii+found;
+	  break;
+	}
+      }
+      break;
+    case 1:
+      for (ii=0; ii<CARDBENCH_NFIND; ii++)
+	sum += cardscan_find(hdr,cfg->cards,find+(hh*CARDBENCH_NFIND+ii)*8);
+      break;
+    default:
+      for (ii=0; ii<cfg->cards; ii++) {
+	start = cardscan_value(hdr+ii*RAWHDR_CARD_LEN,&len);
+	if (len)
+	  sum += start+len;
+      }
+      break;
+    }
+  }
+  return sum;
+}
+
+
+/*
+ * Check that every card gives the same answers with level as with plain C.
+ * Returns 0, or 1 after saying which card did not.
+ */
+static int cardbench_check(const CardBenchConfig *cfg, int level, const char *cards, const char *find)
+{
+  const char *hdr,*card;
+  int hh,ii,start[2],len[2],found[2],pass;
+
+  for (hh=0; hh<cfg->headers; hh++) {
+    hdr = cards + (size_t)hh*cfg->cards*RAWHDR_CARD_LEN;
+    for (ii=0; ii<cfg->cards; ii++) {
+      card = hdr + ii*RAWHDR_CARD_LEN;
+      for (pass=0; pass<2; pass++) {
+	cardscan_force(pass ? level : CARDSCAN_SCALAR);
+	start[pass] = cardscan_value(card,&len[pass]);
+	found[pass] = cardscan_find(hdr,cfg->cards,card);
+      }
+      if (len[0] != len[1] || (len[0] && start[0] != start[1]) || found[0] != found[1]) {
+	printf("%s differs from scalar on card %d of header %d: %.80s\n",cardscan_name(level),ii,hh,card);
+	return 1;
+      }
+    }
+    for (ii=0; ii<CARDBENCH_NFIND; ii++) {
+      for (pass=0; pass<2; pass++) {
+	cardscan_force(pass ? level : CARDSCAN_SCALAR);
+	found[pass] = cardscan_find(hdr,cfg->cards,find+(hh*CARDBENCH_NFIND+ii)*8);
+      }
+      if (found[0] != found[1]) {
+	printf("%s differs from scalar finding %.8s in header %d\n",cardscan_name(level),find+(hh*CARDBENCH_NFIND+ii)*8,hh);
+	return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+
+static void cardbench_usage(void)
+{
+  printf("autolog_cardbench [--headers=N] [--cards=C] [--seed=S] [--runs=R]\n");
+  printf("Times autolog's card scans, plain C against SSE2 and AVX2, on N synthetic headers.\n");
+  printf("--headers=N headers to make. Default 2000\n");
+  printf("--cards=C cards in each header, END included. Default 324, nine blocks\n");
+  printf("--seed=S the same seed always makes the same headers. Default 1\n");
+  printf("--runs=R each time is the best of R runs. Default 5\n");
+}
+
+
+int main(int argc, char **argv)
+{
+  CardBenchConfig cfg;
+  char *cards,*find;
+  double best[CARDSCAN_NLEVELS][CARDBENCH_NTESTS],t0,tt;
+  long sum[CARDBENCH_NTESTS],ss;
+  int ii,level,test,rr,top;
+
+  cfg.headers = 2000;
+  cfg.cards = 324;
+  cfg.seed = 1;
+  cfg.runs = 5;
+
+  for (ii=1; ii<argc; ii++) {
+    if (strncmp(argv[ii],"--headers=",10) == 0)
+      cfg.headers = atoi(argv[ii]+10);
+    else if (strncmp(argv[ii],"--cards=",8) == 0)
+      cfg.cards = atoi(argv[ii]+8);
+    else if (strncmp(argv[ii],"--seed=",7) == 0)
+      cfg.seed = strtoul(argv[ii]+7,NULL,10);
+    else if (strncmp(argv[ii],"--runs=",7) == 0)
+      cfg.runs = atoi(argv[ii]+7);
+    else {
+      cardbench_usage();
+      return 1;
+    }
+  }
+  if (cfg.headers < 1 || cfg.cards < 2 || cfg.runs < 1) {
+    cardbench_usage();
+    return 1;
+  }
+  if (cfg.seed == 0)		/* xorshift would stay at zero */
+    cfg.seed = 1;
+
+  find = (char *)malloc((size_t)cfg.headers*CARDBENCH_NFIND*8);
+  cards = find ? cardbench_make(&cfg,find) : NULL;
+  if (cards == NULL) {
+    printf("Out of memory for %d headers of %d cards\n",cfg.headers,cfg.cards);
+    return 1;
+  }
+
+  top = cardscan_level();
+  printf("%d headers of %d cards. This CPU can use: ",cfg.headers,cfg.cards);
+  for (level=0; level<=top; level++)
+    printf("%s%s",cardscan_name(level),level < top ? ", " : "\n");
+
+  for (level=CARDSCAN_SSE2; level<=top; level++) {
+    if (cardbench_check(&cfg,level,cards,find))
+      return 1;
+  }
+
+  for (level=0; level<=top; level++) {
+    cardscan_force(level);
+    for (test=0; test<CARDBENCH_NTESTS; test++) {
+      best[level][test] = 0;
+      for (rr=0; rr<cfg.runs; rr++) {
+	t0 = cardbench_now();
+	ss = cardbench_run(&cfg,test,cards,find);
+	tt = cardbench_now()-t0;
+	if (rr == 0 || tt < best[level][test])
+	  best[level][test] = tt;
+      }
+      if (level == 0)
+	sum[test] = ss;
+      else if (ss != sum[test]) {
+	printf("%s gave a different answer for %s\n",cardscan_name(level),cardbench_tests[test]);
+	return 1;
+      }
+    }
+  }
+
+  printf("%-8s","");
+  for (test=0; test<CARDBENCH_NTESTS; test++)
+    printf(" %9s ns/card %6s",cardbench_tests[test],"");
+  printf("\n");
+  for (level=0; level<=top; level++) {
+    printf("%-8s",cardscan_name(level));
+    for (test=0; test<CARDBENCH_NTESTS; test++)
+      printf(" %17.2f %5.2fx",best[level][test]*1e9/((double)cfg.headers*cfg.cards),
+	     best[level][test] > 0 ? best[0][test]/best[level][test] : 0.0);
+    printf("\n");
+  }
+
+  free(cards);
+  free(find);
+  return 0;
+}
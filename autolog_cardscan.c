@@ -0,0 +1,395 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+The two scans the raw reader makes of the cards themselves, with SSE2 and AVX2 versions
+beside the plain C ones. cardscan_find() looks for the card with a given keyword, which
+is how rawhdr_add_block() finds END in each block it reads and how rawhdr_find_card()
+finds any other single keyword. cardscan_value() finds where the value of a card starts
+and ends, as rawhdr_card_value() wants it.
+
+cardscan_find() compares the 8 keyword characters of two cards (SSE2) or four (AVX2)
+with the one wanted in a single instruction. cardscan_value() makes three masks of the
+whole 80 byte card at once, with a bit for each blank, quote and '/', and then finds the
+first character of the value, the closing quote of a string and the last character
+before a comment by counting bits rather than stepping through the card. The plain C
+versions are the loops the raw reader has always used, and each gives exactly the same
+answer as they do, whatever is on the card.
+
+Which is used is decided by what the CPU can do, each time it is asked, so there is
+nothing to set up and every thread gets the same. SSE2 is always there on x86_64, but
+not on every i386, and AVX2 only since Haswell. Elsewhere, or with a compiler which
+cannot target the instructions, the plain C versions are all there is. cardscan_force()
+is for autolog_cardbench, to compare the versions on one machine.
+
+Matching a header against the schema does not go through here: schema_match() already
+takes each card's keyword with a multiply and one compare however many keywords are
+wanted, which leaves nothing for wider compares to do.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CARDSCAN_X86
+#include <immintrin.h>
+#endif
+
+
+/* The level forced by cardscan_force(), or -1 to go by the CPU */
+static int cardscan_forced = -1;
+
+static const char *cardscan_names[CARDSCAN_NLEVELS] = {"scalar","sse2","avx2"};
+
+
+/* The most the CPU can do */
+static int cardscan_detect(void)
+{
+#ifdef CARDSCAN_X86
+  if (__builtin_cpu_supports("avx2"))
+    return CARDSCAN_AVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return CARDSCAN_SSE2;
+#endif
+  return CARDSCAN_SCALAR;
+}
+
+
+/* CARDSCAN_SCALAR, CARDSCAN_SSE2 or CARDSCAN_AVX2: the one in use */
+int cardscan_level(void)
+{
+  if (cardscan_forced >= 0)
+    return cardscan_forced;
+  return cardscan_detect();
+}
+
+
+/*
+ * Use level from now on, rather than the best the CPU can do, or go back to that if level
+ * is -1. Returns 0, or 1 if this CPU cannot do level. Not to be called with threads reading.
+ */
+int cardscan_force(int level)
+{
+  if (level >= CARDSCAN_NLEVELS || level > cardscan_detect())
+    return 1;
+  cardscan_forced = level;
+  return 0;
+}
+
+
+const char *cardscan_name(int level)
+{
+  if (level < 0 || level >= CARDSCAN_NLEVELS)
+    return "unknown";
+  return cardscan_names[level];
+}
+
+
+static int cardscan_find_scalar(const char *cards, int ncards, const char *key)
+{
+  int ii;
+
+  for (ii=0; ii<ncards; ii++) {
+    if (memcmp(cards+ii*RAWHDR_CARD_LEN,key,8) == 0)
+      return ii;
+  }
+  return ncards;
+}
+
+
+/*
+ * Where the value of card starts and ends, as the raw reader has always found it: after
+ * "= " and any blanks, up to and including the closing quote of a string (a doubled ''
+ * does not close it), or up to any comment '/' of anything else, less trailing blanks.
+ */
+static int cardscan_value_scalar(const char *card, int *len)
+{
+  int ii,end;
+
+  *len = 0;
+  if (card[8] != '=' || card[9] != ' ')
+    return 0;
+
+  for (ii=10; ii<RAWHDR_CARD_LEN && card[ii]==' '; ii++)
+    ;
+  if (ii == RAWHDR_CARD_LEN)
+    return 0;
+
+  if (card[ii] == '\'') {
+    for (end=ii+1; end<RAWHDR_CARD_LEN; end++) {
+      if (card[end] == '\'') {
+	if (end+1 < RAWHDR_CARD_LEN && card[end+1] == '\'')
+	  end++;
+	else
+	  break;
+      }
+    }
+    if (end == RAWHDR_CARD_LEN)
+      end--;			/* No closing quote. Take what there is */
+    *len = end-ii+1;
+  }
+  else {
+    for (end=ii; end<RAWHDR_CARD_LEN && card[end]!='/'; end++)
+      ;
+    while (end > ii && card[end-1] == ' ')
+      end--;
+    *len = end-ii;
+  }
+  return ii;
+}
+
+
+#ifdef CARDSCAN_X86
+
+/*
+ * A mask of the 80 bytes of a card: bit ii of mask[0] for byte ii of the first 64,
+ * and bit ii of mask[1] for byte 64+ii.
+ */
+typedef struct CardMask_Struct{
+  uint64_t mask[2];
+}CardMask;
+
+
+/* The first byte from pos on which is in m, or RAWHDR_CARD_LEN if there is none */
+static int cardmask_next(const CardMask *m, int pos)
+{
+  uint64_t word;
+
+  if (pos < 64) {
+    word = m->mask[0] >> pos;
+    if (word)
+      return pos + __builtin_ctzll(word);
+    pos = 64;
+  }
+  if (pos < RAWHDR_CARD_LEN) {
+    word = m->mask[1] >> (pos-64);
+    if (word)
+      return pos + __builtin_ctzll(word);
+  }
+  return RAWHDR_CARD_LEN;
+}
+
+
+/* The last byte before pos which is in m, or -1 if there is none */
+static int cardmask_prev(const CardMask *m, int pos)
+{
+  uint64_t word;
+
+  if (pos > 64) {
+    word = m->mask[1] & ((((uint64_t)1) << (pos-64)) - 1);
+    if (word)
+      return 127 - __builtin_clzll(word);
+    pos = 64;
+  }
+  if (pos > 0) {
+    word = (pos == 64) ? m->mask[0] : m->mask[0] & ((((uint64_t)1) << pos) - 1);
+    if (word)
+      return 63 - __builtin_clzll(word);
+  }
+  return -1;
+}
+
+
+/* cardscan_value_scalar(), going by the masks of card's blanks, quotes and slashes */
+static int cardscan_value_masks(const char *card, const CardMask *blank, const CardMask *quote,
+				const CardMask *slash, int *len)
+{
+  CardMask used;
+  int ii,end;
+
+  *len = 0;
+  if (card[8] != '=' || card[9] != ' ')
+    return 0;
+
+  used.mask[0] = ~blank->mask[0];
+  used.mask[1] = ~blank->mask[1] & 0xffff;
+  ii = cardmask_next(&used,10);
+  if (ii == RAWHDR_CARD_LEN)
+    return 0;
+
+  if (card[ii] == '\'') {
+    end = cardmask_next(quote,ii+1);
+    while (end+1 < RAWHDR_CARD_LEN && card[end+1] == '\'')
+      end = cardmask_next(quote,end+2);
+    if (end == RAWHDR_CARD_LEN)
+      end--;
+    *len = end-ii+1;
+  }
+  else {
+    end = cardmask_prev(&used,cardmask_next(slash,ii)) + 1;
+    *len = (end > ii) ? end-ii : 0;
+  }
+  return ii;
+}
+
+
+__attribute__((target("sse2")))
+static int cardscan_find_sse2(const char *cards, int ncards, const char *key)
+{
+  __m128i want,two;
+  unsigned int mask;
+  int ii;
+
+  want = _mm_loadl_epi64((const __m128i *)key);
+  want = _mm_unpacklo_epi64(want,want);
+  for (ii=0; ii+2<=ncards; ii+=2) {
+    two = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(cards+ii*RAWHDR_CARD_LEN)),
+			     _mm_loadl_epi64((const __m128i *)(cards+(ii+1)*RAWHDR_CARD_LEN)));
+    mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(two,want));
+    if ((mask & 0xff) == 0xff)
+      return ii;
+    if ((mask & 0xff00) == 0xff00)
+      return ii+1;
+  }
+  return ii + cardscan_find_scalar(cards+ii*RAWHDR_CARD_LEN,ncards-ii,key);
+}
+
+
+/* Which of the 16 bytes are cc, as a 16 bit mask */
+__attribute__((target("sse2")))
+static uint64_t cardscan_eq16(__m128i bytes, char cc)
+{
+  return (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes,_mm_set1_epi8(cc)));
+}
+
+
+__attribute__((target("sse2")))
+static int cardscan_value_sse2(const char *card, int *len)
+{
+  CardMask blank,quote,slash;
+  __m128i bytes;
+  int kk;
+
+  if (card[8] != '=' || card[9] != ' ') {
+    *len = 0;
+    return 0;
+  }
+
+  memset(&blank,0,sizeof(blank));
+  memset(&quote,0,sizeof(quote));
+  memset(&slash,0,sizeof(slash));
+  for (kk=0; kk<RAWHDR_CARD_LEN/16; kk++) {
+    bytes = _mm_loadu_si128((const __m128i *)(card+16*kk));
+    blank.mask[kk/4] |= cardscan_eq16(bytes,' ') << 16*(kk%4);
+    quote.mask[kk/4] |= cardscan_eq16(bytes,'\'') << 16*(kk%4);
+    slash.mask[kk/4] |= cardscan_eq16(bytes,'/') << 16*(kk%4);
+  }
+  return cardscan_value_masks(card,&blank,&quote,&slash,len);
+}
+
+
+__attribute__((target("avx2")))
+static int cardscan_find_avx2(const char *cards, int ncards, const char *key)
+{
+  __m256i want,four;
+  __m128i lo,hi;
+  unsigned int mask;
+  int ii;
+
+  want = _mm256_broadcastq_epi64(_mm_loadl_epi64((const __m128i *)key));
+  for (ii=0; ii+4<=ncards; ii+=4) {
+    lo = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(cards+ii*RAWHDR_CARD_LEN)),
+			    _mm_loadl_epi64((const __m128i *)(cards+(ii+1)*RAWHDR_CARD_LEN)));
+    hi = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(cards+(ii+2)*RAWHDR_CARD_LEN)),
+			    _mm_loadl_epi64((const __m128i *)(cards+(ii+3)*RAWHDR_CARD_LEN)));
+    four = _mm256_inserti128_si256(_mm256_castsi128_si256(lo),hi,1);
+    mask = (unsigned int)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(four,want)));
+    if (mask)
+      return ii + __builtin_ctz(mask);
+  }
+  return ii + cardscan_find_scalar(cards+ii*RAWHDR_CARD_LEN,ncards-ii,key);
+}
+
+
+/* Which of the 32 bytes are cc, as a 32 bit mask */
+__attribute__((target("avx2")))
+static uint64_t cardscan_eq32(__m256i bytes, char cc)
+{
+  return (uint64_t)(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes,_mm256_set1_epi8(cc)));
+}
+
+
+__attribute__((target("avx2")))
+static int cardscan_value_avx2(const char *card, int *len)
+{
+  CardMask blank,quote,slash;
+  __m256i first,second;
+  __m128i last;
+
+  if (card[8] != '=' || card[9] != ' ') {
+    *len = 0;
+    return 0;
+  }
+
+  /* Bytes 0-31, 32-63 and 64-79 */
+  first = _mm256_loadu_si256((const __m256i *)card);
+  second = _mm256_loadu_si256((const __m256i *)(card+32));
+  last = _mm_loadu_si128((const __m128i *)(card+64));
+  blank.mask[0] = cardscan_eq32(first,' ') | (cardscan_eq32(second,' ') << 32);
+  quote.mask[0] = cardscan_eq32(first,'\'') | (cardscan_eq32(second,'\'') << 32);
+  slash.mask[0] = cardscan_eq32(first,'/') | (cardscan_eq32(second,'/') << 32);
+  blank.mask[1] = (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(last,_mm_set1_epi8(' ')));
+  quote.mask[1] = (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(last,_mm_set1_epi8('\'')));
+  slash.mask[1] = (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(last,_mm_set1_epi8('/')));
+  return cardscan_value_masks(card,&blank,&quote,&slash,len);
+}
+
+#endif
+
+
+/*
+ * The first of ncards cards (80 characters each, from cards) whose keyword is key, which is
+ * 8 characters, blank padded and not \0 terminated. ncards if none of them is.
+ */
+int cardscan_find(const char *cards, int ncards, const char *key)
+{
+#ifdef CARDSCAN_X86
+  switch (cardscan_level()) {
+  case CARDSCAN_AVX2:
+    return cardscan_find_avx2(cards,ncards,key);
+  case CARDSCAN_SSE2:
+    return cardscan_find_sse2(cards,ncards,key);
+  }
+#endif
+  return cardscan_find_scalar(cards,ncards,key);
+}
+
+
+/*
+ * Where the value of card starts, with its length in *len. A card with no value, or only
+ * blanks after the "= ", has a *len of 0. See cardscan_value_scalar().
+ */
+int cardscan_value(const char *card, int *len)
+{
+#ifdef CARDSCAN_X86
+  switch (cardscan_level()) {
+  case CARDSCAN_AVX2:
+    return cardscan_value_avx2(card,len);
+  case CARDSCAN_SSE2:
+    return cardscan_value_sse2(card,len);
+  }
+#endif
+  return cardscan_value_scalar(card,len);
+}
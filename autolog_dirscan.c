@@ -0,0 +1,554 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+Reads the whole directory listing up front, before any FITS file is opened.
+
+We used to decide whether to skip an unreduced frame by building the name of the reduced
+one and trying to fopen() it, once for every raw frame. On a busy night over NFS that is
+thousands of extra lookups. Now every name is chopped once and the FITS files are put into
+a hash table keyed on the exposure name less its pipeline flag (see night_exposure_base()).
+Whichever file has the highest pipeline flag for each exposure wins, and all the others
+are marked as superseded without going anywhere near the disk again.
+
+A semester's staging area can list hundreds of thousands of names, so an entry is kept
+small. The names go one after another in one block, and an entry keeps only where its
+name is, the exposure less its pipeline flag (the start of the name, as a rule) and the
+flag, which is all dirscan_resolve() needs. Anything else is chopped out of the name
+again by dirscan_chop() when it is wanted, which is once a file.
+
+On Linux the listing is read with getdents64(), DIRSCAN_BUFSIZE bytes at a time, rather
+than the 32K glibc's readdir() asks for. Subdirectories, devices and so on are dropped on
+their d_type, and names without .fits in them on sight, so neither is ever chopped.
+
+The directory lists names in whatever order its hash puts them, which has nothing to do
+with where the files are. dirscan_order() works out the order to open the files in
+instead: by inode number, which on ext4 and XFS is roughly where the inodes sit on disk,
+or by the disk offset of each file's first block, as FIEMAP gives it, where the file
+system will say. Files FIEMAP knows nothing about go after the rest, by inode.
+
+A program using libautolog may hand over the names itself instead, with dirscan_names().
+They are then treated just as if the directory had listed them, in that order.
+*/
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+#if defined(__linux__) && defined(SYS_getdents64)
+#define DIRSCAN_GETDENTS
+/* What getdents64() returns, one after another. glibc only has it under _GNU_SOURCE */
+struct dirscan_dirent64 {
+  __u64 d_ino;
+  __s64 d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[1];
+};
+#endif
+
+#ifndef DT_UNKNOWN
+#define DT_UNKNOWN	0
+#define DT_REG		8
+#define DT_LNK		10
+#endif
+#ifndef DT_DIR
+#define DT_DIR		4
+#endif
+
+
+/*
+ * Whether a name could be a FITS file, judged without chopping it or going near the
+ * disk. Links are kept, as they may well point at one. So are names of unknown type,
+ * as not every file system fills d_type in.
+ */
+static int dirscan_wanted(const char *name, int type)
+{
+  if (type != DT_REG && type != DT_LNK && type != DT_UNKNOWN)
+    return 0;
+  return strstr(name,".fits") != NULL;
+}
+
+
+/*
+ * Add the first len characters of str to scan->names, with a \0, and set *at to where
+ * they went. Returns 0, or 1 if out of memory.
+ */
+static int dirscan_keep(DirScan *scan, const char *str, size_t len, unsigned int *at)
+{
+  char *newnames;
+  size_t size;
+
+  if (scan->nameslen+len+1 > scan->namesalloc) {
+    size = scan->namesalloc ? 2*scan->namesalloc : 32*1024;
+    while (size < scan->nameslen+len+1)
+      size *= 2;
+    newnames = (char *)realloc(scan->names,size);
+    if (newnames == NULL)
+      return 1;
+    scan->names = newnames;
+    scan->namesalloc = size;
+  }
+  memcpy(scan->names+scan->nameslen,str,len);
+  scan->names[scan->nameslen+len] = '\0';
+  *at = (unsigned int)scan->nameslen;
+  scan->nameslen += len+1;
+  return 0;
+}
+
+
+/*
+ * Add one name to scan. With keep_all a name which is not wanted is kept all the same,
+ * though not chopped, for --red-report. Returns 0, or 1 if out of memory.
+ */
+static int dirscan_add(DirScan *scan, const char *name, ino_t inode, int type, int keep_all)
+{
+  DirEntry *entry,*newentries;
+  LTFileName cur;
+  char base[FILENAME_LENGTH];
+  unsigned int at;
+  size_t len;
+  int wanted;
+
+  if (strcmp(name,".") == 0 || strcmp(name,"..") == 0)
+    return 0;
+  wanted = dirscan_wanted(name,type);
+  if (!wanted)
+    scan->nskipped++;
+  if (!wanted && !keep_all)
+    return 0;
+
+  if (scan->nentries == scan->nalloc) {
+    scan->nalloc = scan->nalloc ? 2*scan->nalloc : 1024;
+    newentries = (DirEntry *)realloc(scan->entries,scan->nalloc*sizeof(DirEntry));
+    if (newentries == NULL)
+      return 1;
+    scan->entries = newentries;
+  }
+
+  len = strlen(name);
+  if (dirscan_keep(scan,name,MIN(len,DIRSCAN_NAME_MAX),&at))
+    return 1;
+  entry = &scan->entries[scan->nentries++];
+  entry->name = at;
+  entry->inode = inode;
+  entry->physical = 0;
+  entry->job = NULL;
+  entry->wanted = wanted;
+  entry->report = REPORT_NONE;
+  entry->lt_ok = wanted && (chop_filename(scan->names+at,&cur) == 0);
+  entry->is_fits = entry->lt_ok && (strncmp(cur.ext,"fits",4) == 0);
+  entry->p = entry->lt_ok ? atoi(cur.p) : 0;
+  entry->superseded = 0;
+  entry->base = at;
+  entry->baselen = 0;
+  if (!entry->is_fits)
+    return 0;
+
+  /* Only an exposure which is not the start of its name needs keeping apart */
+  night_exposure_base(cur.exposure,base);
+  len = strlen(base);
+  entry->baselen = (unsigned short)len;
+  if (strncmp(scan->names+at,base,len) != 0 && dirscan_keep(scan,base,len,&entry->base)) {
+    scan->nentries--;
+    return 1;
+  }
+  scan->nfits++;
+  return 0;
+}
+
+
+#ifdef DIRSCAN_GETDENTS
+/*
+ * dirscan_read() through getdents64(). Returns 0, -1 if the directory could not be
+ * opened, or 1 if getdents64() is refused outright, when readdir() is worth a try.
+ */
+static int dirscan_getdents(const char *dirname, DirScan *scan, int keep_all)
+{
+  struct dirscan_dirent64 *dent;
+  char *buf;
+  long nread,pos;
+  int fd,first;
+
+  fd = open(dirname,O_RDONLY|O_DIRECTORY);
+  if (fd < 0)
+    return -1;
+  buf = (char *)malloc(DIRSCAN_BUFSIZE);
+  if (buf == NULL) {
+    close(fd);
+    return 1;
+  }
+
+  first = 1;
+  while ( (nread=syscall(SYS_getdents64,fd,buf,DIRSCAN_BUFSIZE)) > 0 ) {
+    first = 0;
+    for (pos=0; pos<nread; pos+=dent->d_reclen) {
+      dent = (struct dirscan_dirent64 *)(buf+pos);
+      if (dirscan_add(scan,dent->d_name,(ino_t)dent->d_ino,dent->d_type,keep_all))
+	break;
+    }
+    if (pos < nread)
+      break;
+  }
+  free(buf);
+  close(fd);
+
+  return (nread < 0 && first) ? 1 : 0;
+}
+#endif
+
+
+/* An empty scan */
+static void dirscan_init(DirScan *scan)
+{
+  scan->entries = NULL;
+  scan->nentries = 0;
+  scan->nalloc = 0;
+  scan->names = NULL;
+  scan->nameslen = 0;
+  scan->namesalloc = 0;
+  scan->nfits = 0;
+  scan->nskipped = 0;
+  scan->order = NULL;
+  scan->norder = 0;
+  scan->nextents = 0;
+}
+
+
+/*
+ * Read every name in dirname which could be a FITS file into scan, in the order the
+ * directory lists them, or with keep_all every name but . and .. (those which could not
+ * be a FITS file have wanted clear). Returns 0, or -1 if the directory could not be opened.
+ */
+int dirscan_read(const char *dirname, DirScan *scan, int keep_all)
+{
+  DIR *pwd;
+  struct dirent *pwd_ls;
+  int type;
+
+  dirscan_init(scan);
+
+#ifdef DIRSCAN_GETDENTS
+  type = dirscan_getdents(dirname,scan,keep_all);
+  if (type <= 0)
+    return type;
+#endif
+
+  pwd = opendir(dirname);
+  if (pwd == NULL)
+    return -1;
+
+  while ( (pwd_ls=readdir(pwd)) ) {
+#ifdef _DIRENT_HAVE_D_TYPE
+    type = pwd_ls->d_type;
+#else
+    type = DT_UNKNOWN;
+#endif
+    if (dirscan_add(scan,pwd_ls->d_name,pwd_ls->d_ino,type,keep_all))
+      break;
+  }
+  closedir(pwd);
+
+  return 0;
+}
+
+
+/*
+ * dirscan_read() for just the nnames files in names, which are in dirname, in that order.
+ * Each is looked at with stat(), for its type and its inode.
+ * Returns 0, or -1 if dirname is not a directory.
+ */
+int dirscan_names(const char *dirname, char **names, int nnames, DirScan *scan, int keep_all)
+{
+  char path[1040];
+  struct stat st;
+  int ii,type;
+
+  dirscan_init(scan);
+  if (stat(dirname,&st) != 0 || !S_ISDIR(st.st_mode))
+    return -1;
+
+  for (ii=0; ii<nnames; ii++) {
+    sprintf(path,"%.767s/%.255s",dirname,names[ii]);
+    /* One which is not there is kept, and fails to open as it would have done */
+    if (stat(path,&st) != 0) {
+      st.st_ino = 0;
+      type = DT_UNKNOWN;
+    }
+    else
+      type = S_ISREG(st.st_mode) ? DT_REG : DT_DIR;
+    if (dirscan_add(scan,names[ii],st.st_ino,type,keep_all))
+      break;
+  }
+  return 0;
+}
+
+
+/* FNV-1a of the exposure of entry. Plenty good enough for a few thousand file names */
+static unsigned int dirscan_hash(const DirScan *scan, const DirEntry *entry)
+{
+  unsigned int hash = 2166136261u;
+  const char *str;
+  unsigned int ii;
+
+  str = scan->names+entry->base;
+  for (ii=0; ii<entry->baselen; ii++) {
+    hash ^= (unsigned char)str[ii];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+
+/* Whether entries aa and bb are of the same exposure */
+static int dirscan_same(const DirScan *scan, const DirEntry *aa, const DirEntry *bb)
+{
+  return aa->baselen == bb->baselen && memcmp(scan->names+aa->base,scan->names+bb->base,aa->baselen) == 0;
+}
+
+
+/*
+ * Mark every FITS file for which a more reduced version of the same exposure is
+ * also in the directory. Returns the number marked.
+ */
+int dirscan_resolve(DirScan *scan)
+{
+  int *table;
+  unsigned int tablesize,ii,slot;
+  int best,nsuperseded;
+  DirEntry *entry;
+
+  if (scan->nentries == 0)
+    return 0;
+
+  /* Open addressing. Keep the table at most half full */
+  tablesize = 64;
+  while (tablesize < 2*scan->nentries)
+    tablesize *= 2;
+
+  table = (int *)malloc(tablesize*sizeof(int));
+  if (table == NULL)
+    return 0;
+  for (ii=0; ii<tablesize; ii++)
+    table[ii] = -1;
+
+  /* Each slot ends up holding the entry with the highest pipeline flag for that exposure */
+  for (ii=0; ii<scan->nentries; ii++) {
+    entry = &scan->entries[ii];
+    if (!entry->is_fits)
+      continue;
+    slot = dirscan_hash(scan,entry) & (tablesize-1);
+    while (table[slot] >= 0 && !dirscan_same(scan,&scan->entries[table[slot]],entry))
+      slot = (slot+1) & (tablesize-1);
+
+    if (table[slot] < 0 || scan->entries[table[slot]].p < entry->p)
+      table[slot] = ii;
+  }
+
+  nsuperseded = 0;
+  for (ii=0; ii<scan->nentries; ii++) {
+    entry = &scan->entries[ii];
+    if (!entry->is_fits)
+      continue;
+
+    slot = dirscan_hash(scan,entry) & (tablesize-1);
+    while (!dirscan_same(scan,&scan->entries[table[slot]],entry))
+      slot = (slot+1) & (tablesize-1);
+    best = table[slot];
+
+    if (scan->entries[best].p > entry->p) {
+      entry->superseded = 1;
+      nsuperseded++;
+    }
+  }
+
+  free(table);
+
+  return nsuperseded;
+}
+
+
+/* Where the first block of dirname/name is on disk, from FIEMAP. Returns 0, or 1 if unknown */
+static int dirscan_physical(const char *dirname, const char *name, off_t *physical)
+{
+#if defined(__linux__) && defined(FS_IOC_FIEMAP)
+  union {
+    struct fiemap map;		/* With room for one extent after it */
+    char bytes[sizeof(struct fiemap)+sizeof(struct fiemap_extent)];
+  } fm;
+  char path[1040];
+  int fd,err;
+
+  sprintf(path,"%.768s/%s",dirname,name);
+  fd = open(path,O_RDONLY);
+  if (fd < 0)
+    return 1;
+  memset(&fm,0,sizeof(fm));
+  fm.map.fm_start = 0;
+  fm.map.fm_length = IOPOLICY_WINDOW;
+  fm.map.fm_extent_count = 1;
+  err = ioctl(fd,FS_IOC_FIEMAP,&fm.map) != 0 || fm.map.fm_mapped_extents == 0
+    || (fm.map.fm_extents[0].fe_flags & (FIEMAP_EXTENT_UNKNOWN|FIEMAP_EXTENT_DELALLOC));
+  close(fd);
+  if (!err)
+    *physical = (off_t)fm.map.fm_extents[0].fe_physical;
+  return err;
+#else
+  return 1;
+#endif
+}
+
+
+/* An entry to open, with what it is sorted on, so that qsort() needs nothing else */
+typedef struct DirScanKey_Struct{
+  off_t physical;
+  ino_t inode;
+  unsigned int entry;
+}DirScanKey;
+
+/* Those with a disk offset first, then by inode */
+static int dirscan_compare(const void *aa, const void *bb)
+{
+  const DirScanKey *ka,*kb;
+
+  ka = (const DirScanKey *)aa;
+  kb = (const DirScanKey *)bb;
+  if ((ka->physical != 0) != (kb->physical != 0))
+    return ka->physical != 0 ? -1 : 1;
+  if (ka->physical != kb->physical)
+    return ka->physical < kb->physical ? -1 : 1;
+  if (ka->inode != kb->inode)
+    return ka->inode < kb->inode ? -1 : 1;
+  return ka->entry < kb->entry ? -1 : (ka->entry > kb->entry);
+}
+
+
+/* Put the n entries numbered in idx in the order to open them. Returns 0, or 1 if out of memory */
+static int dirscan_sort(const DirScan *scan, unsigned int *idx, unsigned int n)
+{
+  DirScanKey *keys;
+  unsigned int ii;
+
+  keys = (DirScanKey *)malloc((n>0 ? n : 1)*sizeof(DirScanKey));
+  if (keys == NULL)
+    return 1;
+  for (ii=0; ii<n; ii++) {
+    keys[ii].physical = scan->entries[idx[ii]].physical;
+    keys[ii].inode = scan->entries[idx[ii]].inode;
+    keys[ii].entry = idx[ii];
+  }
+  qsort(keys,n,sizeof(DirScanKey),dirscan_compare);
+  for (ii=0; ii<n; ii++)
+    idx[ii] = keys[ii].entry;
+  free(keys);
+  return 0;
+}
+
+
+/*
+ * Fill in scan->order, the FITS files which dirscan_resolve() left to be read, and any
+ * others --red-report wants read (see report_plan()), in the order to open them: as
+ * listed, by inode or by disk offset (OPEN_ORDER_*). Call it after dirscan_resolve().
+ * FIEMAP means opening each file, so only OPEN_ORDER_EXTENT touches the disk. Returns 0,
+ * or 1 if out of memory, when they are left as listed.
+ */
+int dirscan_order(const char *dirname, DirScan *scan, int how)
+{
+  unsigned int ii;
+  DirEntry *entry;
+
+  scan->order = (unsigned int *)malloc((scan->nentries>0 ? scan->nentries : 1)*sizeof(unsigned int));
+  if (scan->order == NULL)
+    return 1;
+  scan->norder = 0;
+  scan->nextents = 0;
+  for (ii=0; ii<scan->nentries; ii++) {
+    entry = &scan->entries[ii];
+    if (!entry->is_fits || (entry->superseded && entry->report != REPORT_READ))
+      continue;
+    scan->order[scan->norder++] = ii;
+    entry->physical = 0;
+    if (how == OPEN_ORDER_EXTENT && dirscan_physical(dirname,scan->names+entry->name,&entry->physical) == 0)
+      scan->nextents++;
+  }
+
+  if (how != OPEN_ORDER_DIR)
+    return dirscan_sort(scan,scan->order,scan->norder);
+  return 0;
+}
+
+
+/*
+ * Put just the n entries numbered in idx in the order to open them, as dirscan_order()
+ * did for them all, which must have been called first. For --memory, which hands the
+ * files over a batch at a time. If out of memory they are left as they are.
+ */
+void dirscan_order_some(const DirScan *scan, unsigned int *idx, unsigned int n)
+{
+  dirscan_sort(scan,idx,n);
+}
+
+
+/* The name of entry ii. Good until the next name is added */
+const char *dirscan_name(const DirScan *scan, unsigned int ii)
+{
+  return scan->names+scan->entries[ii].name;
+}
+
+
+/* Chop the name of entry ii into cur. Returns what chop_filename() does, 0 if it understood it */
+int dirscan_chop(const DirScan *scan, unsigned int ii, LTFileName *cur)
+{
+  return chop_filename(scan->names+scan->entries[ii].name,cur);
+}
+
+
+void dirscan_free(DirScan *scan)
+{
+  free(scan->entries);
+  free(scan->names);
+  free(scan->order);
+  scan->entries = NULL;
+  scan->names = NULL;
+  scan->order = NULL;
+  scan->nentries = scan->nalloc = 0;
+  scan->nameslen = scan->namesalloc = 0;
+  scan->nfits = scan->nskipped = 0;
+  scan->norder = scan->nextents = 0;
+}
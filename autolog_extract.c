@@ -0,0 +1,230 @@
+/*   
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+Reads the FITS header of a single exposure into a LogInfo. This is the body of
+the original per-file loop in main(), pulled out so that it can be called either
+inline from the directory scan or from one of the worker threads in autolog_workers.c.
+The header itself is read either by cFITSIO or by the raw card reader in autolog_rawhdr.c,
+and the keywords are picked out of it as the keyword schema (autolog_schema.c) says.
+The io_uring reader in autolog_uring.c reads the cards its own way and uses only the
+extract_begin() and extract_cards() halves of this.
+
+Everything in here must stay thread safe. No globals, no static buffers and each
+call has its own fitsfile pointer. All the messages which go to autolog_status.log
+are written later by the main thread, in directory order, from what is left in the LogJob.
+*/
+
+#define _ISOC99_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+
+/*
+ * The header readers. Either way, what comes back in hdr->raw is every card of the primary
+ * header up to END, which is all extract_LogInfo() looks at. cFITSIO reads the header
+ * itself and we copy the cards out of it. The raw reader pread()s them directly, as does
+ * --reader=uring for a file it reads on its own rather than through the ring.
+ * --reader=mmap maps the blocks instead, and hdr->raw.cards points straight into them.
+ * Compressed files always go to the raw reader. cFITSIO would inflate the whole of a
+ * .gz file just to read its header, and finds only the empty primary of a .fz one.
+ * io only matters to the raw reader. cFITSIO does its own reads.
+ */
+int log_open_header(LogHeader *hdr, int reader, const char *path, const IoPolicy *io, int *status)
+{
+  char card[FLEN_CARD];
+  char *cards;
+  int nkeys,morekeys,ii,len;
+
+  hdr->reader = reader;
+  hdr->fitsin = NULL;
+  hdr->bytes_read = 0;
+  hdr->raw.cards = NULL;
+  hdr->raw.ncards = 0;
+  hdr->raw.map = NULL;
+  hdr->raw.map_len = 0;
+  hdr->raw.bytes_read = 0;
+
+  if (*status > 0)
+    return *status;
+
+  if (reader != READER_CFITSIO || rawhdr_compression(path) != RAWHDR_PLAIN) {
+    hdr->reader = READER_RAW;
+    if (reader == READER_MMAP && rawhdr_compression(path) == RAWHDR_PLAIN)
+      *status = rawhdr_map(path,io,&hdr->raw);
+    else
+      *status = rawhdr_open(path,io,&hdr->raw);
+    hdr->bytes_read = hdr->raw.bytes_read;
+    return *status;
+  }
+
+  if (fits_open_file(&hdr->fitsin,path,READONLY,status))
+    return *status;
+  if (fits_get_hdrspace(hdr->fitsin,&nkeys,&morekeys,status))
+    return *status;
+
+  cards = (char *)malloc((nkeys>0 ? nkeys : 1)*RAWHDR_CARD_LEN);
+  if (cards == NULL)
+    return (*status = MEMORY_ALLOCATION);
+  for (ii=0; ii<nkeys; ii++) {
+    if (fits_read_record(hdr->fitsin,ii+1,card,status))
+      break;
+    /* Blank pad, whether or not cFITSIO trimmed it */
+    len = strlen(card);
+    memcpy(cards+ii*RAWHDR_CARD_LEN,card,len);
+    memset(cards+ii*RAWHDR_CARD_LEN+len,' ',RAWHDR_CARD_LEN-len);
+  }
+  hdr->raw.cards = cards;
+  hdr->raw.ncards = ii;
+  /* cFITSIO does not say what it read, but it had to get through the header blocks */
+  hdr->bytes_read = (long)((nkeys+RAWHDR_CARDS_PER_BLOCK)/RAWHDR_CARDS_PER_BLOCK)*RAWHDR_BLOCK_LEN;
+
+  return *status;
+}
+
+int log_close_header(LogHeader *hdr, int *status)
+{
+  rawhdr_close(&hdr->raw);
+  if (hdr->reader != READER_RAW)
+    fits_close_file(hdr->fitsin,status);
+  return *status;
+}
+
+
+/*
+ * Get job ready to be read: clear what extract_LogInfo() fills in and start its clock.
+ * path gets the file to read, and must have room for 1024 characters.
+ */
+void extract_begin(const ExtractConfig *cfg, LogJob *job, char *path)
+{
+  job->status = 0;
+  job->date_read = 0;
+  job->bytes_read = 0;
+  job->t_open = job->t_keys = job->t_close = 0;
+  job->t_wait = 0;
+  job->pages_dropped = 0;
+  job->t_start = trace_now();
+
+  night_init_LogInfo(&job->info); 	/* Set strings to blank and values mostly to zero */
+  sprintf(job->info.exposure,"%s",job->cur.exposure);
+  sprintf(path,"%s/%s.%s",cfg->dirname,job->cur.exposure,job->cur.ext);
+}
+
+
+/*
+ * Fill job->info from the cards of its primary header, whichever reader found them.
+ * Which keywords go where is set by cfg->schema. See autolog_schema.c.
+ */
+void extract_cards(const ExtractConfig *cfg, LogJob *job, const RawHeader *raw)
+{
+  LogInfo *info;
+  const char *found[SCHEMA_MAX_KEYWORDS];
+  char value[RAWHDR_CARD_LEN+1];
+  int fits_stat;
+  int hour,minute;
+  double second;
+
+  info = &job->info;
+  hour = minute = 0;
+  second = 0;
+
+  /* One pass over the cards picks out every keyword any column wants. Each column then
+   * takes the first of its keywords which was there, so a missing keyword only ever
+   * affects its own column */
+  schema_match(cfg->schema,raw->cards,raw->ncards,found);
+  schema_extract(cfg->schema,found,job->no_dprt,info);
+  report_extract(cfg->schema,found,&job->report);
+
+  /* Time & DATE. Not a column, but main() names the log after it */
+  fits_stat = 0;
+  if (found[cfg->schema->dateobs] && rawhdr_card_string(found[cfg->schema->dateobs],value,&fits_stat) == 0) {
+    job->date_read = 1;
+    if(sscanf(value,"%4d-%2d-%2dT%2d:%2d:%lf",&job->date_year,&job->date_month,&job->date_day,&hour,&minute,&second)!=6)
+      sprintf(info->utstart,"%2d:%2d:%6.3f",hour,minute,second);
+    /* It is not yet clear as to whether we will always get MJD in the FITS header. If we
+     * find we do not, MJD could be worked out from DATE-OBS here with slalib:
+    second = (int)(second+0.5);           ** seconds as an integer        **
+    slaDtf2d(hour,minute,second,&frac_day,&sla_stat);
+    slaCldj(date_year,date_month,date_day,&mjdate,&sla_stat);
+    info->mjd = mjdate + frac_day;
+    */
+  }
+}
+
+
+/*
+ * Open cfg->dirname/job->cur and fill job->info from its primary header, using cfg->reader.
+ * job->cur and job->no_dprt must be set by the caller. On return job->status is
+ *	0	Everything read (or at least non-critical errors only)
+ *	41	FITS file could not be opened. job->info should be discarded
+ *	>0	Any other FITSIO error returned when closing the file
+ * The time each step took is left in job->t_open, t_keys and t_close.
+ */
+int extract_LogInfo(const ExtractConfig *cfg, LogJob *job)
+{
+  LogHeader hdr;
+  PageSnapshot snap;
+  int fits_stat;
+  char cur_fits[1024];
+  double waited;
+
+  /* Wait our turn under --io-files and --io-rate */
+  waited = cfg->io ? iopolicy_begin(cfg->io) : 0;
+  extract_begin(cfg,job,cur_fits);
+  job->t_wait = waited;
+  iopolicy_snapshot(cfg->io,cur_fits,-1,&snap);
+
+  /* Open FITS file */	    
+  fits_stat = 0;
+  log_open_header(&hdr,cfg->reader,cur_fits,cfg->io,&fits_stat);
+  job->t_open = trace_now() - job->t_start;
+  if(fits_stat){
+    fits_stat = 0;
+    if (hdr.fitsin)
+      log_close_header(&hdr,&fits_stat);
+    job->pages_dropped = iopolicy_release(cfg->io,&snap);
+    if (cfg->io)
+      iopolicy_end(cfg->io,0);
+    job->info.error = -1;
+    job->status = 41;
+    return job->status;
+  }
+
+  extract_cards(cfg,job,&hdr.raw);
+
+  /* Read everything I want. Close the file and clean up */
+  fits_stat = 0;
+  job->bytes_read = hdr.bytes_read;
+  job->t_keys = trace_now() - job->t_start - job->t_open;
+  log_close_header(&hdr,&fits_stat);
+  job->pages_dropped = iopolicy_release(cfg->io,&snap);
+  if (cfg->io)
+    iopolicy_end(cfg->io,job->bytes_read);
+  job->t_close = trace_now() - job->t_start - job->t_open - job->t_keys;
+
+  job->status = fits_stat;
+  return job->status;
+}
@@ -0,0 +1,443 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+The --format option. Besides the classic fixed width log, the same rows can be written as
+CSV, JSON Lines or a FITS binary table, for programs which would otherwise have to pick
+the text log apart. Any number of these can be asked for at once. They are all written
+from the night's LogTable after the one pass over the headers, so no FITS file is opened twice.
+Each is a FormatWriter, given one row at a time, so that with --memory the rows can come
+straight from merging the spilled runs instead (see autolog_spill.c).
+
+These writers give every column of the keyword schema (see autolog_schema.c), in full.
+With the built in schema that is every field of log_fields[]. Strings are not cut to the
+width of a log column (only leading and trailing blanks are dropped) and numbers are written
+to full precision rather than the one or two decimal places of the text log.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <float.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+
+#define LOG_FIELD(name,type,member,unit) \
+  {name, type, offsetof(LogInfo,member), sizeof(((LogInfo *)0)->member), unit}
+
+/* In the order of the columns in the text log, then the ones it does not show */
+const LogField log_fields[] = {
+  LOG_FIELD("utstart",	LOG_FIELD_STRING,	utstart,	""),
+  LOG_FIELD("object",	LOG_FIELD_STRING,	object,		""),
+  LOG_FIELD("propid",	LOG_FIELD_STRING,	propid,		""),
+  LOG_FIELD("ra",	LOG_FIELD_STRING,	ra,		""),
+  LOG_FIELD("dec",	LOG_FIELD_STRING,	dec,		""),
+  LOG_FIELD("airmass",	LOG_FIELD_FLOAT,	airmass,	""),
+  LOG_FIELD("instrume",	LOG_FIELD_STRING,	instrume,	""),
+  LOG_FIELD("filter",	LOG_FIELD_STRING,	filter,		""),
+  LOG_FIELD("binning",	LOG_FIELD_INT,		binning,	""),
+  LOG_FIELD("grating",	LOG_FIELD_STRING,	grating,	""),
+  LOG_FIELD("exptime",	LOG_FIELD_FLOAT,	exptime,	"s"),
+  LOG_FIELD("l1seeing",	LOG_FIELD_FLOAT,	l1seeing,	"arcsec"),
+  LOG_FIELD("l1skybrt",	LOG_FIELD_FLOAT,	l1skybrt,	"mag/arcsec**2"),
+  LOG_FIELD("exposure",	LOG_FIELD_STRING,	exposure,	""),
+  LOG_FIELD("groupid",	LOG_FIELD_STRING,	groupid,	""),
+  LOG_FIELD("error",	LOG_FIELD_INT,		error,		""),
+  LOG_FIELD("mjd",	LOG_FIELD_DOUBLE,	mjd,		"d"),
+  LOG_FIELD("l1photom",	LOG_FIELD_FLOAT,	l1photom,	"mag")
+};
+const int log_nfields = sizeof(log_fields)/sizeof(log_fields[0]);
+
+
+/* The field called name, or NULL */
+const LogField *log_field_find(const char *name)
+{
+  int ii;
+
+  for (ii=0; ii<log_nfields; ii++) {
+    if (strcmp(name,log_fields[ii].name) == 0)
+      return &log_fields[ii];
+  }
+  return NULL;
+}
+
+
+/*
+ * Parse a comma separated list of format names, e.g. "text,csv", into a FORMAT_* mask.
+ * Returns 0, or 1 if a name is not known. The offending name is printed.
+ */
+int format_parse(const char *list, int *formats)
+{
+  const char *ptr,*comma;
+  size_t len;
+
+  *formats = 0;
+  ptr = list;
+  while (1) {
+    comma = strchr(ptr,',');
+    len = comma ? (size_t)(comma-ptr) : strlen(ptr);
+
+    if (len == 4 && strncmp(ptr,"text",4) == 0)
+      *formats |= FORMAT_TEXT;
+    else if (len == 3 && strncmp(ptr,"csv",3) == 0)
+      *formats |= FORMAT_CSV;
+    else if (len == 5 && strncmp(ptr,"jsonl",5) == 0)
+      *formats |= FORMAT_JSONL;
+    else if (len == 9 && strncmp(ptr,"fitstable",9) == 0)
+      *formats |= FORMAT_FITSTABLE;
+    else {
+      printf("Unknown --format %.*s\n",(int)len,ptr);
+      return 1;
+    }
+
+    if (comma == NULL)
+      break;
+    ptr = comma+1;
+  }
+
+  return 0;
+}
+
+
+/*
+ * The name of another output to go alongside the text log logpath: its .log
+ * replaced by suffix (e.g. ".csv"), or suffix appended if it has no .log.
+ * path must be at least strlen(logpath)+strlen(suffix)+1 long.
+ */
+void format_path(const char *logpath, const char *suffix, char *path)
+{
+  size_t len;
+
+  strcpy(path,logpath);
+  len = strlen(path);
+  if (len > 4 && strcmp(path+len-4,".log") == 0)
+    path[len-4] = '\0';
+  strcat(path,suffix);
+}
+
+
+/* A string field with leading and trailing blanks dropped. *len is set to its length */
+static const char *format_trimmed(const LogInfo *info, const LogField *field, size_t *len)
+{
+  const char *str;
+
+  str = (const char *)info + field->offset;
+  while (*str == ' ')
+    str++;
+  *len = strlen(str);
+  while (*len > 0 && str[*len-1] == ' ')
+    (*len)--;
+  return str;
+}
+
+
+/* A numeric field as text, to the full precision of its type */
+static void format_number(const LogInfo *info, const LogField *field, char *buf)
+{
+  const char *ptr;
+  double dval;
+  float fval;
+  int ival;
+
+  ptr = (const char *)info + field->offset;
+  switch (field->type) {
+  case LOG_FIELD_DOUBLE:
+    memcpy(&dval,ptr,sizeof(dval));
+    sprintf(buf,"%.*g",DBL_DIG,dval);
+    break;
+  case LOG_FIELD_FLOAT:
+    memcpy(&fval,ptr,sizeof(fval));
+    sprintf(buf,"%.*g",FLT_DIG+1,fval);
+    break;
+  default:
+    memcpy(&ival,ptr,sizeof(ival));
+    sprintf(buf,"%d",ival);
+    break;
+  }
+}
+
+
+/* True if a numeric field is NaN or infinite. JSON has no way to say either */
+static int format_not_finite(const LogInfo *info, const LogField *field)
+{
+  double dval;
+  float fval;
+
+  if (field->type == LOG_FIELD_DOUBLE)
+    memcpy(&dval,(const char *)info + field->offset,sizeof(dval));
+  else if (field->type == LOG_FIELD_FLOAT) {
+    memcpy(&fval,(const char *)info + field->offset,sizeof(fval));
+    dval = fval;
+  }
+  else
+    return 0;
+
+  return (dval != dval || dval > DBL_MAX || dval < -DBL_MAX);
+}
+
+
+/*
+ * RFC 4180 CSV. A header line of the names of the fields, then one line per row.
+ * Strings are only quoted if they contain a comma, a quote or a line break.
+ */
+static void format_csv_row(FormatWriter *writer, const LogInfo *info)
+{
+  const LogField *fields;
+  FILE *fp;
+  char num[64];
+  const char *str;
+  size_t len,ii;
+  int ff;
+
+  fp = writer->fp;
+  fields = writer->fields;
+  for (ff=0; ff<writer->nfields; ff++) {
+    if (ff)
+      fputc(',',fp);
+    if (fields[ff].type != LOG_FIELD_STRING) {
+      format_number(info,&fields[ff],num);
+      fputs(num,fp);
+      continue;
+    }
+
+    str = format_trimmed(info,&fields[ff],&len);
+    if (strcspn(str,",\"\r\n") >= len) {
+      fwrite(str,1,len,fp);
+      continue;
+    }
+    fputc('"',fp);
+    for (ii=0; ii<len; ii++) {
+      if (str[ii] == '"')
+	fputc('"',fp);
+      fputc(str[ii],fp);
+    }
+    fputc('"',fp);
+  }
+  fputs("\r\n",fp);
+}
+
+
+/*
+ * JSON Lines. One object per row, keyed on the field names. NaN and infinite
+ * numbers are written as null.
+ */
+static void format_jsonl_row(FormatWriter *writer, const LogInfo *info)
+{
+  const LogField *fields;
+  FILE *fp;
+  char num[64];
+  const char *str;
+  size_t len,ii;
+  unsigned char cc;
+  int ff;
+
+  fp = writer->fp;
+  fields = writer->fields;
+  fputc('{',fp);
+  for (ff=0; ff<writer->nfields; ff++) {
+    fprintf(fp,"%s\"%s\":",ff ? "," : "",fields[ff].name);
+    if (fields[ff].type != LOG_FIELD_STRING) {
+      if (format_not_finite(info,&fields[ff]))
+	fputs("null",fp);
+      else {
+	format_number(info,&fields[ff],num);
+	fputs(num,fp);
+      }
+      continue;
+    }
+
+    str = format_trimmed(info,&fields[ff],&len);
+    fputc('"',fp);
+    for (ii=0; ii<len; ii++) {
+      cc = (unsigned char)str[ii];
+      if (cc == '"' || cc == '\\')
+	fprintf(fp,"\\%c",cc);
+      else if (cc < 0x20)
+	fprintf(fp,"\\u%04x",cc);
+      else
+	fputc(cc,fp);
+    }
+    fputc('"',fp);
+  }
+  fputs("}\n",fp);
+}
+
+
+/*
+ * A FITS binary table extension, AUTOLOG, with one column per field and one row per
+ * exposure. Any existing file of the same name is replaced. cFITSIO wants the number
+ * of rows when the table is made.
+ */
+static void format_fitstable_open(FormatWriter *writer, unsigned int n)
+{
+  char fitspath[1041];		/* The path, after a ! */
+  char *ttype[SCHEMA_MAX_COLUMNS];
+  char *tform[SCHEMA_MAX_COLUMNS];
+  char *tunit[SCHEMA_MAX_COLUMNS];
+  char forms[SCHEMA_MAX_COLUMNS][16];
+  const LogField *field;
+  int ff;
+
+  /* The leading ! tells cFITSIO to overwrite */
+  sprintf(fitspath,"!%s",writer->path);
+  fits_create_file(&writer->fptr,fitspath,&writer->status);
+  if (writer->status) {
+    writer->fptr = NULL;
+    return;
+  }
+
+  for (ff=0; ff<writer->nfields; ff++) {
+    field = &writer->fields[ff];
+    ttype[ff] = (char *)field->name;
+    tunit[ff] = (char *)field->unit;
+    switch (field->type) {
+    case LOG_FIELD_STRING:	sprintf(forms[ff],"%dA",(int)field->size-1); break;
+    case LOG_FIELD_DOUBLE:	strcpy(forms[ff],"1D"); break;
+    case LOG_FIELD_FLOAT:	strcpy(forms[ff],"1E"); break;
+    default:			strcpy(forms[ff],"1J"); break;
+    }
+    tform[ff] = forms[ff];
+  }
+  fits_create_tbl(writer->fptr,BINARY_TBL,n,writer->nfields,ttype,tform,tunit,"AUTOLOG",&writer->status);
+}
+
+
+static void format_fitstable_row(FormatWriter *writer, const LogInfo *info)
+{
+  char trimmed[3*FLEN_VALUE];
+  char *strptr;
+  const char *str;
+  const LogField *field;
+  size_t len;
+  long row;
+  int ff,*status;
+
+  row = writer->row+1;
+  status = &writer->status;
+  for (ff=0; ff<writer->nfields && !*status; ff++) {
+    field = &writer->fields[ff];
+    switch (field->type) {
+    case LOG_FIELD_STRING:
+      str = format_trimmed(info,field,&len);
+      memcpy(trimmed,str,len);
+      trimmed[len] = '\0';
+      strptr = trimmed;
+      fits_write_col(writer->fptr,TSTRING,ff+1,row,1,1,&strptr,status);
+      break;
+    case LOG_FIELD_DOUBLE:
+      fits_write_col(writer->fptr,TDOUBLE,ff+1,row,1,1,(char *)info + field->offset,status);
+      break;
+    case LOG_FIELD_FLOAT:
+      fits_write_col(writer->fptr,TFLOAT,ff+1,row,1,1,(char *)info + field->offset,status);
+      break;
+    default:
+      fits_write_col(writer->fptr,TINT,ff+1,row,1,1,(char *)info + field->offset,status);
+      break;
+    }
+  }
+}
+
+
+/*
+ * Start writing path in format (FORMAT_CSV, FORMAT_JSONL or FORMAT_FITSTABLE), with
+ * the nfields fields as its columns. n is the number of rows format_row() will be
+ * given. Returns 0, or as format_close() if the file could not be made. It need not
+ * be closed then.
+ */
+int format_open(FormatWriter *writer, int format, const char *path, const LogField *fields, int nfields, unsigned int n)
+{
+  int ff;
+
+  writer->format = format;
+  strcpy(writer->path,path);
+  writer->fields = fields;
+  writer->nfields = nfields;
+  writer->fp = NULL;
+  writer->fptr = NULL;
+  writer->row = 0;
+  writer->status = 0;
+
+  if (format == FORMAT_FITSTABLE) {
+    format_fitstable_open(writer,n);
+    if (writer->status && writer->fptr) {
+      ff = 0;
+      fits_close_file(writer->fptr,&ff);
+      writer->fptr = NULL;
+    }
+    return writer->status;
+  }
+
+  writer->fp = fopen(path,"w");
+  if (writer->fp == NULL)
+    return writer->status = 1;
+  if (format == FORMAT_CSV) {
+    for (ff=0; ff<nfields; ff++)
+      fprintf(writer->fp,"%s%s",ff ? "," : "",fields[ff].name);
+    fputs("\r\n",writer->fp);
+  }
+  return 0;
+}
+
+
+/* Write info as the next row. After an error the rest are ignored */
+void format_row(FormatWriter *writer, const LogInfo *info)
+{
+  if (writer->status)
+    return;
+  switch (writer->format) {
+  case FORMAT_CSV:		format_csv_row(writer,info); break;
+  case FORMAT_JSONL:		format_jsonl_row(writer,info); break;
+  case FORMAT_FITSTABLE:	format_fitstable_row(writer,info); break;
+  }
+  writer->row++;
+}
+
+
+/*
+ * Finish the file. Returns 0, or if anything could not be written, 1 for csv and jsonl
+ * and the first cFITSIO status for fitstable.
+ */
+int format_close(FormatWriter *writer)
+{
+  int status;
+
+  if (writer->fptr) {
+    /* Close it even after an error, but report the first error */
+    status = 0;
+    fits_close_file(writer->fptr,&status);
+    if (writer->status == 0)
+      writer->status = status;
+    writer->fptr = NULL;
+  }
+  if (writer->fp) {
+    if (ferror(writer->fp))
+      writer->status = 1;
+    if (fclose(writer->fp) != 0)
+      writer->status = 1;
+    writer->fp = NULL;
+  }
+  return writer->status;
+}
@@ -0,0 +1,564 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+The --index option, and the archive index it keeps. Finding every frame of one proposal
+between two dates used to mean grepping thousands of YYYYMMDD.log files. The index holds
+the rows of every night autolog has been run over with --index, in one file which
+autolog_query mmap()s and answers by binary search.
+
+The file is, one after the other:
+ - an IndexFileHeader
+ - nnights IndexNights, the directories the rows came from
+ - nrecords IndexRecords, sorted by MJD (then night and exposure)
+ - for each of the INDEX_NKEYS keys, nrecords record numbers, sorted on that key and
+   then by record number, which is to say by MJD
+So "all of a PROPID between two dates" is two binary searches in the PROPID array to
+find the proposal, and two more within it to find the dates.
+
+Each night a run reads is kept in an IndexUpdate until the end of the run, and then
+merged into the old file in one pass, so a --batch over years of nights rewrites the
+index once. The old rows of a night which is read again are replaced, so rerunning a
+night never duplicates it. Nights are known by their absolute path. A night later than
+everything in the index only adds records at the end, but the key arrays mean the file
+is still written out whole, as the cache is, under a temporary name and renamed.
+
+Two runs may finish at once, e.g. the cron job and a rerun by hand. Each would merge
+into the same old file, and the second rename would lose the first one's nights. So a
+run holds an flock() on INDEX.lock beside the index from reading the old file until the
+new one has been renamed over it, and the other waits. The lock cannot be on the index
+itself, which the rename replaces.
+
+Like the cache the records are raw structs, only good for the machine and the build which
+wrote them. An index file which does not look right is not overwritten, as it may have
+taken a long time to build. It can always be made again from the nights themselves.
+*/
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+/* As autolog_query's options, in INDEX_KEY_* order */
+const char *index_key_names[INDEX_NKEYS] = {
+  "propid","groupid","object","instrume"
+};
+
+#define INDEX_DROPPED	0xffffffffu	/* An old record whose night has been read again */
+
+
+void index_update_init(IndexUpdate *up, const char *path)
+{
+  up->path = path;
+  up->nights = NULL;
+  up->nnights = up->nnalloc = 0;
+  up->records = NULL;
+  up->nrecords = up->nalloc = 0;
+}
+
+
+void index_update_free(IndexUpdate *up)
+{
+  free(up->nights);
+  free(up->records);
+  up->nights = NULL;
+  up->records = NULL;
+  up->nnights = up->nrecords = 0;
+}
+
+
+/* from, cut to fit len and zero padded. Keys also lose any trailing spaces */
+static void index_copy(char *to, size_t len, const char *from, int key)
+{
+  size_t nn;
+
+  for (nn=0; nn<len-1 && from[nn]; nn++)
+    to[nn] = from[nn];
+  while (key && nn > 0 && to[nn-1] == ' ')
+    nn--;
+  memset(to+nn,0,len-nn);
+}
+
+
+/*
+ * Make room for the n rows of the night in dirname, which index_add_row() then adds
+ * one by one, for index_update_write(). *night is set to its number. A night added
+ * twice keeps only the second lot. Returns 0, or 1 if out of memory or the path is
+ * too long.
+ */
+int index_add_night(IndexUpdate *up, const char *dirname, unsigned int n, unsigned int *night)
+{
+  char path[PATH_MAX];
+  void *newspace;
+  unsigned int nn,ii,jj;
+
+  if (realpath(dirname,path) == NULL)
+    snprintf(path,sizeof(path),"%s",dirname);
+  if (strlen(path) >= INDEX_NIGHT_LEN)
+    return 1;
+
+  for (nn=0; nn<up->nnights; nn++) {
+    if (strcmp(up->nights[nn].dirname,path) == 0)
+      break;
+  }
+  if (nn < up->nnights) {
+    for (ii=jj=0; ii<up->nrecords; ii++) {
+      if (up->records[ii].night != nn)
+	up->records[jj++] = up->records[ii];
+    }
+    up->nrecords = jj;
+  }
+  else {
+    if (up->nnights == up->nnalloc) {
+      up->nnalloc = up->nnalloc ? 2*up->nnalloc : 64;
+      newspace = realloc(up->nights,up->nnalloc*sizeof(IndexNight));
+      if (newspace == NULL)
+	return 1;
+      up->nights = (IndexNight *)newspace;
+    }
+    memset(&up->nights[nn],0,sizeof(IndexNight));
+    strcpy(up->nights[nn].dirname,path);
+    up->nnights++;
+  }
+
+  if (up->nrecords+n > up->nalloc) {
+    up->nalloc = MAX(2*up->nalloc,up->nrecords+n);
+    newspace = realloc(up->records,up->nalloc*sizeof(IndexRecord));
+    if (newspace == NULL)
+      return 1;
+    up->records = (IndexRecord *)newspace;
+  }
+  *night = nn;
+  return 0;
+}
+
+
+/* One row of night, which index_add_night() made room for */
+void index_add_row(IndexUpdate *up, unsigned int night, const LogInfo *info)
+{
+  IndexRecord *rec;
+
+  rec = &up->records[up->nrecords++];
+  memset(rec,0,sizeof(IndexRecord));
+  rec->mjd = info->mjd;
+  rec->night = night;
+  rec->error = info->error;
+  rec->airmass = info->airmass;
+  rec->exptime = info->exptime;
+  rec->l1seeing = info->l1seeing;
+  rec->l1skybrt = info->l1skybrt;
+  rec->binning = info->binning;
+  index_copy(rec->utstart,sizeof(rec->utstart),info->utstart,0);
+  index_copy(rec->ra,sizeof(rec->ra),info->ra,0);
+  index_copy(rec->dec,sizeof(rec->dec),info->dec,0);
+  index_copy(rec->filter,sizeof(rec->filter),info->filter,0);
+  index_copy(rec->grating,sizeof(rec->grating),info->grating,0);
+  index_copy(rec->exposure,sizeof(rec->exposure),info->exposure,0);
+  index_copy(rec->key[INDEX_KEY_PROPID],INDEX_KEY_LEN,info->propid,1);
+  index_copy(rec->key[INDEX_KEY_GROUPID],INDEX_KEY_LEN,info->groupid,1);
+  index_copy(rec->key[INDEX_KEY_OBJECT],INDEX_KEY_LEN,info->object,1);
+  index_copy(rec->key[INDEX_KEY_INSTRUME],INDEX_KEY_LEN,info->instrume,1);
+}
+
+
+/*
+ * mmap() the index at path. Returns 0, -1 if there is no such file, or 1 if it is
+ * not an index this build can read.
+ */
+int index_open(ArchiveIndex *idx, const char *path)
+{
+  const IndexFileHeader *fhdr;
+  struct stat st;
+  size_t expect;
+  const char *base;
+  int fd,kk;
+
+  memset(idx,0,sizeof(ArchiveIndex));
+  fd = open(path,O_RDONLY);
+  if (fd < 0)
+    return -1;
+  if (fstat(fd,&st) != 0 || (size_t)st.st_size < sizeof(IndexFileHeader)) {
+    close(fd);
+    return 1;
+  }
+  idx->map_len = st.st_size;
+  idx->map = mmap(NULL,idx->map_len,PROT_READ,MAP_SHARED,fd,0);
+  close(fd);
+  if (idx->map == MAP_FAILED) {
+    idx->map = NULL;
+    return 1;
+  }
+
+  fhdr = (const IndexFileHeader *)idx->map;
+  expect = sizeof(IndexFileHeader) + (size_t)fhdr->nnights*sizeof(IndexNight)
+    + (size_t)fhdr->nrecords*(sizeof(IndexRecord)+INDEX_NKEYS*sizeof(unsigned int));
+  if (memcmp(fhdr->magic,AUTOLOG_INDEX_MAGIC,8) != 0 || fhdr->version != AUTOLOG_INDEX_VERSION
+      || fhdr->record_size != sizeof(IndexRecord) || expect != idx->map_len) {
+    index_close(idx);
+    return 1;
+  }
+
+  base = (const char *)idx->map + sizeof(IndexFileHeader);
+  idx->nnights = fhdr->nnights;
+  idx->nrecords = fhdr->nrecords;
+  idx->nights = (const IndexNight *)base;
+  base += idx->nnights*sizeof(IndexNight);
+  idx->records = (const IndexRecord *)base;
+  base += idx->nrecords*sizeof(IndexRecord);
+  for (kk=0; kk<INDEX_NKEYS; kk++) {
+    idx->keys[kk] = (const unsigned int *)base;
+    base += idx->nrecords*sizeof(unsigned int);
+  }
+  return 0;
+}
+
+
+void index_close(ArchiveIndex *idx)
+{
+  if (idx->map)
+    munmap(idx->map,idx->map_len);
+  memset(idx,0,sizeof(ArchiveIndex));
+}
+
+
+/* The first record with an MJD of at least mjd, or nrecords if there is none */
+unsigned int index_find_mjd(const ArchiveIndex *idx, double mjd)
+{
+  unsigned int lo,hi,mid;
+
+  lo = 0;
+  hi = idx->nrecords;
+  while (lo < hi) {
+    mid = lo + (hi-lo)/2;
+    if (idx->records[mid].mjd < mjd)
+      lo = mid+1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+
+/* The first position in keys[kk] from lo to hi whose key compares with value at least
+ * as much as above (0 for >=, 1 for >) */
+static unsigned int index_key_bound(const ArchiveIndex *idx, int kk, const char *value, unsigned int lo, unsigned int hi, int above)
+{
+  unsigned int mid;
+  int cmp;
+
+  while (lo < hi) {
+    mid = lo + (hi-lo)/2;
+    cmp = strncmp(idx->records[idx->keys[kk][mid]].key[kk],value,INDEX_KEY_LEN);
+    if (cmp < 0 || (above && cmp == 0))
+      lo = mid+1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+
+/* The same for the MJD of records whose key is the same from lo to hi */
+static unsigned int index_key_mjd(const ArchiveIndex *idx, int kk, double mjd, unsigned int lo, unsigned int hi)
+{
+  unsigned int mid;
+
+  while (lo < hi) {
+    mid = lo + (hi-lo)/2;
+    if (idx->records[idx->keys[kk][mid]].mjd < mjd)
+      lo = mid+1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+
+/*
+ * The records whose key kk (INDEX_KEY_*) is value and whose MJD is from from up to but
+ * not including to, as keys[kk][*first] to keys[kk][*last-1], in MJD order. value is
+ * cut to INDEX_KEY_LEN-1 characters, as the keys in the records were.
+ */
+void index_find_key(const ArchiveIndex *idx, int kk, const char *value, double from, double to, unsigned int *first, unsigned int *last)
+{
+  char key[INDEX_KEY_LEN];
+  unsigned int lo,hi;
+
+  index_copy(key,sizeof(key),value,1);
+  lo = index_key_bound(idx,kk,key,0,idx->nrecords,0);
+  hi = index_key_bound(idx,kk,key,lo,idx->nrecords,1);
+  *first = index_key_mjd(idx,kk,from,lo,hi);
+  *last = MAX(*first,index_key_mjd(idx,kk,to,*first,hi));
+}
+
+
+/* Whether key kk of rec is value, cut as the keys were */
+int index_key_matches(const IndexRecord *rec, int kk, const char *value)
+{
+  char key[INDEX_KEY_LEN];
+
+  index_copy(key,sizeof(key),value,1);
+  return strncmp(rec->key[kk],key,INDEX_KEY_LEN) == 0;
+}
+
+
+/* The order records are kept in */
+static int index_compare(const IndexRecord *ra, const IndexRecord *rb)
+{
+  if (ra->mjd < rb->mjd) return -1;
+  if (ra->mjd > rb->mjd) return 1;
+  if (ra->night != rb->night)
+    return ra->night < rb->night ? -1 : 1;
+  return strcmp(ra->exposure,rb->exposure);
+}
+
+
+static int index_compare_records(const void *aa, const void *bb)
+{
+  return index_compare((const IndexRecord *)aa,(const IndexRecord *)bb);
+}
+
+
+/* A new record's value of one key, for qsort() of the new records on that key */
+typedef struct IndexSortKey_Struct{
+  const char *key;
+  unsigned int rec;
+}IndexSortKey;
+
+static int index_compare_key(const void *aa, const void *bb)
+{
+  const IndexSortKey *ka = (const IndexSortKey *)aa;
+  const IndexSortKey *kb = (const IndexSortKey *)bb;
+  int cmp;
+
+  cmp = strncmp(ka->key,kb->key,INDEX_KEY_LEN);
+  if (cmp != 0)
+    return cmp;
+  return ka->rec < kb->rec ? -1 : (ka->rec > kb->rec);
+}
+
+
+/*
+ * Write the index, the old one with up merged into it, to fp. nights has room for
+ * every night, and replaced, old_to_new, new_to_new, order and sorting for the rest.
+ */
+static void index_merge(IndexUpdate *up, const ArchiveIndex *old, IndexNight *nights, unsigned char *replaced,
+			unsigned int *old_to_new, unsigned int *new_to_new, unsigned int *order,
+			IndexSortKey *sorting, FILE *fp)
+{
+  IndexFileHeader fhdr;
+  const IndexRecord *ro,*rn;
+  unsigned int nnights,nold,nkept,ii,jj,recno,from_old;
+  int kk,cmp;
+
+  /* The old nights keep their numbers. Those read again this run get their old one */
+  nold = old->nrecords;
+  if (old->nnights)
+    memcpy(nights,old->nights,old->nnights*sizeof(IndexNight));
+  nnights = old->nnights;
+  for (jj=0; jj<up->nnights; jj++) {
+    for (ii=0; ii<old->nnights; ii++) {
+      if (strcmp(old->nights[ii].dirname,up->nights[jj].dirname) == 0)
+	break;
+    }
+    if (ii == old->nnights)
+      nights[ii = nnights++] = up->nights[jj];
+    replaced[ii] = 1;
+    order[jj] = ii;
+  }
+  for (ii=0; ii<up->nrecords; ii++)
+    up->records[ii].night = order[up->records[ii].night];
+  qsort(up->records,up->nrecords,sizeof(IndexRecord),index_compare_records);
+
+  nkept = 0;
+  for (ii=0; ii<nold; ii++) {
+    if (replaced[old->records[ii].night])
+      old_to_new[ii] = INDEX_DROPPED;
+    else
+      nkept++;
+  }
+
+  memset(&fhdr,0,sizeof(fhdr));
+  memcpy(fhdr.magic,AUTOLOG_INDEX_MAGIC,8);
+  fhdr.version = AUTOLOG_INDEX_VERSION;
+  fhdr.record_size = sizeof(IndexRecord);
+  fhdr.nrecords = nkept + up->nrecords;
+  fhdr.nnights = nnights;
+  fwrite(&fhdr,sizeof(fhdr),1,fp);
+  fwrite(nights,sizeof(IndexNight),nnights,fp);
+
+  /* Both lots are already in order, so the records are a straight merge */
+  ii = jj = recno = 0;
+  while (ii < nold || jj < up->nrecords) {
+    if (ii < nold && old_to_new[ii] == INDEX_DROPPED) {
+      ii++;
+      continue;
+    }
+    from_old = (jj == up->nrecords) || (ii < nold && index_compare(&old->records[ii],&up->records[jj]) <= 0);
+    if (from_old) {
+      fwrite(&old->records[ii],sizeof(IndexRecord),1,fp);
+      old_to_new[ii++] = recno++;
+    }
+    else {
+      fwrite(&up->records[jj],sizeof(IndexRecord),1,fp);
+      new_to_new[jj++] = recno++;
+    }
+  }
+
+  /* And so is each key array, once the new records have been sorted on that key */
+  for (kk=0; kk<INDEX_NKEYS; kk++) {
+    for (jj=0; jj<up->nrecords; jj++) {
+      sorting[jj].key = up->records[jj].key[kk];
+      sorting[jj].rec = jj;
+    }
+    qsort(sorting,up->nrecords,sizeof(IndexSortKey),index_compare_key);
+    for (jj=0; jj<up->nrecords; jj++)
+      order[jj] = sorting[jj].rec;
+
+    ii = jj = 0;
+    while (ii < nold || jj < up->nrecords) {
+      if (ii < nold && old_to_new[old->keys[kk][ii]] == INDEX_DROPPED) {
+	ii++;
+	continue;
+      }
+      from_old = (jj == up->nrecords);
+      if (!from_old && ii < nold) {
+	ro = &old->records[old->keys[kk][ii]];
+	rn = &up->records[order[jj]];
+	cmp = strncmp(ro->key[kk],rn->key[kk],INDEX_KEY_LEN);
+	from_old = cmp < 0 || (cmp == 0 && old_to_new[old->keys[kk][ii]] < new_to_new[order[jj]]);
+      }
+      if (from_old)
+	fwrite(&old_to_new[old->keys[kk][ii++]],sizeof(unsigned int),1,fp);
+      else
+	fwrite(&new_to_new[order[jj++]],sizeof(unsigned int),1,fp);
+    }
+  }
+}
+
+
+/*
+ * Take the lock on the index at path, waiting for any other run which holds it.
+ * Returns the descriptor to close() to let it go, or -1 if it could not be had.
+ */
+static int index_lock(const char *path)
+{
+  char *lockpath;
+  int fd,err;
+
+  lockpath = (char *)malloc(strlen(path)+8);
+  if (lockpath == NULL)
+    return -1;
+  sprintf(lockpath,"%s.lock",path);
+  fd = open(lockpath,O_RDWR|O_CREAT,0644);
+  free(lockpath);
+  if (fd < 0)
+    return -1;
+
+  while ((err = flock(fd,LOCK_EX)) != 0 && errno == EINTR)
+    ;
+  if (err != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+
+/*
+ * Merge the nights in up into the index at up->path, replacing any rows they had there
+ * before. Returns 0, or 1 if it could not be written, or 2 if there is a file there
+ * which is not an index this build can read. Either way the old file is left as it was.
+ * Any other run merging into the same index waits until this one is done.
+ */
+int index_update_write(IndexUpdate *up)
+{
+  ArchiveIndex old;
+  IndexNight *nights;
+  unsigned char *replaced;
+  unsigned int *old_to_new,*new_to_new,*order;
+  IndexSortKey *sorting;
+  char *tmppath;
+  FILE *fp;
+  int have_old,err,lockfd;
+
+  lockfd = index_lock(up->path);
+  if (lockfd < 0)
+    return 1;
+  have_old = index_open(&old,up->path);
+  if (have_old > 0) {
+    close(lockfd);
+    return 2;
+  }
+
+  nights = (IndexNight *)malloc((old.nnights+up->nnights+1)*sizeof(IndexNight));
+  replaced = (unsigned char *)calloc(old.nnights+up->nnights+1,1);
+  old_to_new = (unsigned int *)malloc((old.nrecords+1)*sizeof(unsigned int));
+  new_to_new = (unsigned int *)malloc((up->nrecords+1)*sizeof(unsigned int));
+  order = (unsigned int *)malloc((MAX(up->nrecords,up->nnights)+1)*sizeof(unsigned int));
+  sorting = (IndexSortKey *)malloc((up->nrecords+1)*sizeof(IndexSortKey));
+  tmppath = (char *)malloc(strlen(up->path)+32);
+  err = (nights == NULL || replaced == NULL || old_to_new == NULL || new_to_new == NULL || order == NULL
+	 || sorting == NULL || tmppath == NULL);
+
+  /* Written under a temporary name and renamed, as the cache is */
+  fp = NULL;
+  if (!err) {
+    sprintf(tmppath,"%s.%ld.tmp",up->path,(long)getpid());
+    fp = fopen(tmppath,"w");
+    err = (fp == NULL);
+  }
+  if (!err) {
+    setvbuf(fp,NULL,_IOFBF,1024*1024);
+    index_merge(up,&old,nights,replaced,old_to_new,new_to_new,order,sorting,fp);
+    err = (fflush(fp) != 0) || ferror(fp) || (fsync(fileno(fp)) != 0);
+    if (fclose(fp) != 0)
+      err = 1;
+    if (!err && rename(tmppath,up->path) != 0)
+      err = 1;
+    if (err)
+      remove(tmppath);
+  }
+
+  if (have_old == 0)
+    index_close(&old);
+  free(nights);
+  free(replaced);
+  free(old_to_new);
+  free(new_to_new);
+  free(order);
+  free(sorting);
+  free(tmppath);
+  close(lockfd);
+  return err;
+}
@@ -0,0 +1,291 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+Keeping out of Dp(RT)'s way. autolog usually runs on the pipeline machine while the night
+is being reduced, and every file it looks at leaves its header, and whatever the kernel
+read ahead after it, in the page cache at the expense of frames the pipeline still wants.
+
+--pagecache=drop turns off readahead where autolog does the reading itself (the raw and
+uring readers, and compressed files), and looks at which pages of the first IOPOLICY_WINDOW
+bytes of each file were already in the page cache before opening it. Once the header is
+read, the pages which were not are dropped again. Pages someone else had cached are never
+touched, so the pipeline's own working set stays where it was. cFITSIO does its own reads
+and readahead, but the pages it pulls in within the window are dropped all the same.
+
+--io-files caps the number of files being read at once over all the worker threads and
+io_uring slots, and --io-rate the header bytes read per second. A file only starts once
+both allow it, so autolog reads at a steady trickle however many threads it has.
+
+Everything here does nothing unless it was asked for, and mincore() and posix_fadvise()
+are left out where the system does not have them.
+*/
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+
+void iopolicy_init(IoPolicy *io)
+{
+  io->drop = 0;
+  io->max_files = 0;
+  io->max_rate = 0;
+  io->nfiles = 0;
+  io->ready_at = 0;
+  pthread_mutex_init(&io->lock,NULL);
+  pthread_cond_init(&io->free,NULL);
+}
+
+
+void iopolicy_free(IoPolicy *io)
+{
+  pthread_cond_destroy(&io->free);
+  pthread_mutex_destroy(&io->lock);
+}
+
+
+/* Whether any of the policies are in force */
+int iopolicy_active(const IoPolicy *io)
+{
+  return io->drop || io->max_files > 0 || io->max_rate > 0;
+}
+
+
+/*
+ * A --io-rate value: bytes per second, with an optional K, M or G (powers of 1024).
+ * 0 is no limit. Returns 0, or 1 if str is not a rate.
+ */
+int iopolicy_parse_rate(const char *str, double *rate)
+{
+  char *end;
+
+  *rate = strtod(str,&end);
+  switch (*end) {
+    case 'k': case 'K': *rate *= 1024; end++; break;
+    case 'm': case 'M': *rate *= 1024*1024; end++; break;
+    case 'g': case 'G': *rate *= 1024*1024*1024.0; end++; break;
+  }
+  return end == str || *end != '\0' || !(*rate >= 0);
+}
+
+
+/* Write the policies in force into the status log */
+void iopolicy_describe(const IoPolicy *io, FILE *fp)
+{
+  if (io->drop)
+    fprintf(fp,"Page cache: no readahead, and header pages not already cached are dropped after reading.\n");
+  if (io->max_files > 0)
+    fprintf(fp,"I/O limited to %d file%s at once.\n",io->max_files,io->max_files==1 ? "" : "s");
+  if (io->max_rate > 0)
+    fprintf(fp,"I/O limited to %.2f MB/s of headers.\n",io->max_rate/(1024*1024));
+}
+
+
+/* Sleep until trace_now() reaches when */
+static void iopolicy_sleep_until(double when)
+{
+  struct timespec ts;
+  double secs;
+
+  secs = when - trace_now();
+  if (secs <= 0)
+    return;
+  ts.tv_sec = (time_t)secs;
+  ts.tv_nsec = (long)((secs-ts.tv_sec)*1e9);
+  nanosleep(&ts,NULL);
+}
+
+
+/*
+ * Wait until another file may be read, and count it as being read.
+ * Returns the seconds spent waiting. Every call must be matched by an iopolicy_end().
+ */
+double iopolicy_begin(IoPolicy *io)
+{
+  double start,ready_at;
+
+  if (io->max_files <= 0 && io->max_rate <= 0)
+    return 0;
+
+  start = trace_now();
+  pthread_mutex_lock(&io->lock);
+  while (io->max_files > 0 && io->nfiles >= io->max_files)
+    pthread_cond_wait(&io->free,&io->lock);
+  io->nfiles++;
+  ready_at = io->ready_at;
+  pthread_mutex_unlock(&io->lock);
+
+  iopolicy_sleep_until(ready_at);
+  return trace_now() - start;
+}
+
+
+/*
+ * iopolicy_begin() without the waiting, for the io_uring reader, which has files of
+ * its own to get on with. Returns 1 if a file may be read now, 0 if not.
+ */
+int iopolicy_try_begin(IoPolicy *io)
+{
+  int ok;
+
+  if (io->max_files <= 0 && io->max_rate <= 0)
+    return 1;
+
+  pthread_mutex_lock(&io->lock);
+  ok = (io->max_files <= 0 || io->nfiles < io->max_files) && io->ready_at <= trace_now();
+  if (ok)
+    io->nfiles++;
+  pthread_mutex_unlock(&io->lock);
+  return ok;
+}
+
+
+/*
+ * A file which was counted by iopolicy_begin() is finished with, and bytes were read
+ * from it. The next may not start until those bytes have had their share of --io-rate.
+ */
+void iopolicy_end(IoPolicy *io, long bytes)
+{
+  double now;
+
+  if (io->max_files <= 0 && io->max_rate <= 0)
+    return;
+
+  pthread_mutex_lock(&io->lock);
+  io->nfiles--;
+  if (io->max_rate > 0) {
+    now = trace_now();
+    io->ready_at = MAX(io->ready_at,now) + bytes/io->max_rate;
+  }
+  pthread_cond_signal(&io->free);
+  pthread_mutex_unlock(&io->lock);
+}
+
+
+/*
+ * With --pagecache=drop, turn off readahead on fd, so only the blocks actually asked for
+ * are read. This is per open file, so only helps on an fd we do the reading through.
+ */
+void iopolicy_no_readahead(const IoPolicy *io, int fd)
+{
+#ifdef POSIX_FADV_RANDOM
+  if (io != NULL && io->drop)
+    posix_fadvise(fd,0,0,POSIX_FADV_RANDOM);
+#endif
+}
+
+
+/*
+ * With --pagecache=drop, note which pages of the first IOPOLICY_WINDOW bytes of the file
+ * are in the page cache, before it is read. fd is the file, or -1 to open path for the
+ * purpose. The page cache belongs to the file, not the fd, so either will do.
+ * Without --pagecache=drop snap is left empty.
+ */
+void iopolicy_snapshot(const IoPolicy *io, const char *path, int fd, PageSnapshot *snap)
+{
+  struct stat st;
+  void *map;
+  size_t len;
+
+  snap->fd = -1;
+  snap->own_fd = 0;
+  snap->npages = 0;
+  if (io == NULL || !io->drop)
+    return;
+
+  if (fd < 0) {
+    fd = open(path,O_RDONLY);
+    if (fd < 0)
+      return;
+    snap->own_fd = 1;
+  }
+  snap->fd = fd;
+
+  snap->pagesize = sysconf(_SC_PAGESIZE);
+  if (fstat(fd,&st) != 0 || st.st_size == 0 || snap->pagesize <= 0)
+    return;
+  len = MIN((off_t)IOPOLICY_WINDOW,st.st_size);
+  len = MIN(len,sizeof(snap->resident)*snap->pagesize);
+  snap->npages = (len+snap->pagesize-1)/snap->pagesize;
+
+  /* Mapping the file does not read it. mincore() only asks what is there */
+  map = mmap(NULL,len,PROT_READ,MAP_SHARED,fd,0);
+  if (map == MAP_FAILED) {
+    snap->npages = 0;
+    return;
+  }
+  if (mincore(map,len,(void *)snap->resident) != 0)
+    snap->npages = 0;
+  munmap(map,len);
+}
+
+
+/*
+ * The file snap was taken of has been read. Drop the pages which are in the page cache
+ * now but were not before, and close the fd if iopolicy_snapshot() opened it.
+ * Returns the number of pages dropped.
+ */
+unsigned int iopolicy_release(const IoPolicy *io, PageSnapshot *snap)
+{
+  unsigned char now[sizeof(snap->resident)];
+  unsigned int dropped;
+  size_t ii,first,len;
+  void *map;
+
+  dropped = 0;
+  len = snap->npages*snap->pagesize;
+  map = snap->npages ? mmap(NULL,len,PROT_READ,MAP_SHARED,snap->fd,0) : MAP_FAILED;
+  if (map != MAP_FAILED) {
+    if (mincore(map,len,(void *)now) != 0)
+      memset(now,0,sizeof(now));
+    munmap(map,len);
+
+#ifdef POSIX_FADV_DONTNEED
+    for (ii=0; ii<snap->npages; ii++) {
+      if ((snap->resident[ii] & 1) || !(now[ii] & 1))
+	continue;
+      first = ii;
+      while (ii+1 < snap->npages && !(snap->resident[ii+1] & 1) && (now[ii+1] & 1))
+	ii++;
+      posix_fadvise(snap->fd,(off_t)first*snap->pagesize,(off_t)(ii-first+1)*snap->pagesize,POSIX_FADV_DONTNEED);
+      dropped += ii-first+1;
+    }
+#endif
+  }
+
+  if (snap->own_fd)
+    close(snap->fd);
+  snap->fd = -1;
+  snap->own_fd = 0;
+  snap->npages = 0;
+  return dropped;
+}
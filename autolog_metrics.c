@@ -0,0 +1,254 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+The --metrics option. Writes what happened to the files of each night, how long each phase
+took and how much was read, in the Prometheus text format, for the node_exporter textfile
+collector. Point it at a .prom file in the collector's directory.
+
+Every sample has a night label, the directory as given on the command line, so one file
+covers every night of a --batch run. The counts are those of this run, so they start again
+from zero each time autolog runs, as a counter does when its process restarts.
+
+The file is written under a temporary name in the same directory, which the collector
+ignores as it does not end in .prom, flushed to disk and then renamed over the old one.
+A scrape sees either the old file or the new one, never part of one.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+
+/* The first column made with the l1stat rule, or NULL if the schema has none */
+static const SchemaColumn *metrics_l1stat_column(const Schema *schema)
+{
+  int ii;
+
+  for (ii=0; ii<schema->ncolumns; ii++) {
+    if (schema->columns[ii].rule == SCHEMA_RULE_L1STAT)
+      return &schema->columns[ii];
+  }
+  return NULL;
+}
+
+
+/*
+ * Count one file, as collected by main(). Called before collect_LogJob() puts
+ * any FITSIO status into the error column, so it still holds the L1STAT flags.
+ */
+void metrics_job(LogRun *run, const LogJob *job)
+{
+  NightCounts *nc;
+  const SchemaColumn *col;
+  int error,kk;
+
+  nc = &run->counts;
+  if (!job->from_cache) {
+    nc->pages_dropped += job->pages_dropped;
+    nc->io_wait += job->t_wait;
+  }
+  if (job->status == 41) {
+    nc->open_failed++;
+    return;
+  }
+  if (job->from_cache)
+    nc->cached++;
+  if (job->status)
+    nc->fitsio_errors++;
+  nc->bytes_read += job->bytes_read;
+
+  /* Each L1STAT keyword which was not +-1 took 2<<n off the column. See schema_extract() */
+  col = metrics_l1stat_column(run->cfg.schema);
+  if (col == NULL)
+    return;
+  memcpy(&error,(const char *)&job->info + col->field.offset,sizeof(error));
+  if (error >= 0)
+    return;
+  for (kk=0; kk<col->nkeywords; kk++) {
+    if ((-error) & (2 << kk))
+      nc->l1stat[kk]++;
+  }
+}
+
+
+/* A label value, with \, " and newline escaped */
+static void metrics_label(FILE *fp, const char *value)
+{
+  for (; *value; value++) {
+    if (*value == '\\' || *value == '"')
+      fprintf(fp,"\\%c",*value);
+    else if (*value == '\n')
+      fputs("\\n",fp);
+    else
+      fputc(*value,fp);
+  }
+}
+
+
+static void metrics_header(FILE *fp, const char *name, const char *type, const char *help)
+{
+  fprintf(fp,"# HELP %s %s\n# TYPE %s %s\n",name,help,name,type);
+}
+
+
+/* One sample of name for run, with an extra label if label is not NULL */
+static void metrics_sample(FILE *fp, const char *name, const LogRun *run, const char *label, const char *value, double sample)
+{
+  fprintf(fp,"%s{night=\"",name);
+  metrics_label(fp,run->cfg.dirname);
+  if (label) {
+    fprintf(fp,"\",%s=\"",label);
+    metrics_label(fp,value);
+  }
+  fprintf(fp,"\"} %.17g\n",sample);
+}
+
+
+/* A count in NightCounts, for each night. offset is offsetof() it */
+static void metrics_count(FILE *fp, const char *name, const char *help, const LogRun *runs, int nruns, size_t offset)
+{
+  unsigned int count;
+  int ii;
+
+  metrics_header(fp,name,"counter",help);
+  for (ii=0; ii<nruns; ii++) {
+    memcpy(&count,(const char *)&runs[ii].counts + offset,sizeof(count));
+    metrics_sample(fp,name,&runs[ii],NULL,NULL,count);
+  }
+}
+
+
+/* Everything, for nruns nights */
+static void metrics_print(FILE *fp, const LogRun *runs, int nruns)
+{
+  const SchemaColumn *col;
+  const Schema *schema;
+  char keyword[9],phase[32];
+  char *ptr;
+  int ii,kk;
+
+  metrics_header(fp,"autolog_last_run_timestamp_seconds","gauge","When autolog last wrote these metrics.");
+  fprintf(fp,"autolog_last_run_timestamp_seconds %ld\n",(long)time(NULL));
+
+  metrics_header(fp,"autolog_night_ok","gauge","1 if the directory and its status log could be opened.");
+  for (ii=0; ii<nruns; ii++)
+    metrics_sample(fp,"autolog_night_ok",&runs[ii],NULL,NULL,runs[ii].ok);
+
+  metrics_count(fp,"autolog_files_scanned_total","Names in the directory listing, other than . and ..",
+		runs,nruns,offsetof(NightCounts,scanned));
+  metrics_header(fp,"autolog_files_read_total","counter","Files in the log, whether read or taken from the cache.");
+  for (ii=0; ii<nruns; ii++)
+    metrics_sample(fp,"autolog_files_read_total",&runs[ii],NULL,NULL,runs[ii].filect);
+  metrics_count(fp,"autolog_files_cached_total","Files taken from the --cache file instead of being read.",
+		runs,nruns,offsetof(NightCounts,cached));
+  metrics_count(fp,"autolog_files_superseded_total","Files skipped for a more reduced version of the same exposure.",
+		runs,nruns,offsetof(NightCounts,superseded));
+  metrics_count(fp,"autolog_files_open_failed_total","FITS files which could not be opened (error 41).",
+		runs,nruns,offsetof(NightCounts,open_failed));
+  metrics_count(fp,"autolog_files_not_lt_total","Names with .fits in them which are not LT file names (error 31).",
+		runs,nruns,offsetof(NightCounts,not_lt));
+  metrics_count(fp,"autolog_files_not_fits_total","LT file names which are not FITS files, and names skipped on their type or for not having .fits in them.",
+		runs,nruns,offsetof(NightCounts,not_fits));
+  metrics_count(fp,"autolog_files_fitsio_error_total","Files read, but with some other FITSIO error.",
+		runs,nruns,offsetof(NightCounts,fitsio_errors));
+
+  /* The keywords of the l1stat column are the same for every night */
+  schema = nruns > 0 ? runs[0].cfg.schema : NULL;
+  col = schema ? metrics_l1stat_column(schema) : NULL;
+  if (col) {
+    metrics_header(fp,"autolog_l1stat_errors_total","counter","Files where this Dp(RT) L1STAT flag was neither 1 nor -1.");
+    for (kk=0; kk<col->nkeywords; kk++) {
+      strcpy(keyword,schema->keywords[col->keywords[kk]]);
+      for (ptr=keyword+strlen(keyword); ptr>keyword && ptr[-1]==' '; ptr--)
+	;
+      *ptr = '\0';
+      for (ii=0; ii<nruns; ii++)
+	metrics_sample(fp,"autolog_l1stat_errors_total",&runs[ii],"keyword",keyword,runs[ii].counts.l1stat[kk]);
+    }
+  }
+
+  metrics_header(fp,"autolog_bytes_read_total","counter","Bytes read from the FITS files to get to the END of each header.");
+  for (ii=0; ii<nruns; ii++)
+    metrics_sample(fp,"autolog_bytes_read_total",&runs[ii],NULL,NULL,runs[ii].counts.bytes_read);
+
+  metrics_header(fp,"autolog_pages_dropped_total","counter","Pages --pagecache=drop took back out of the page cache.");
+  for (ii=0; ii<nruns; ii++)
+    metrics_sample(fp,"autolog_pages_dropped_total",&runs[ii],NULL,NULL,runs[ii].counts.pages_dropped);
+  metrics_header(fp,"autolog_io_wait_seconds_total","counter","Time files waited for --io-files and --io-rate, over all threads.");
+  for (ii=0; ii<nruns; ii++)
+    metrics_sample(fp,"autolog_io_wait_seconds_total",&runs[ii],NULL,NULL,runs[ii].counts.io_wait);
+
+  metrics_header(fp,"autolog_phase_seconds","gauge","Wall clock time spent in each phase of the night.");
+  for (kk=0; kk<TRACE_NPHASES; kk++) {
+    strcpy(phase,trace_phase_names[kk]);
+    for (ptr=phase; *ptr; ptr++)
+      if (*ptr == ' ') *ptr = '_';
+    for (ii=0; ii<nruns; ii++)
+      metrics_sample(fp,"autolog_phase_seconds",&runs[ii],"phase",phase,runs[ii].timing.phase[kk]);
+  }
+  metrics_header(fp,"autolog_night_seconds","gauge","Wall clock time from starting the night to its summary.");
+  for (ii=0; ii<nruns; ii++)
+    metrics_sample(fp,"autolog_night_seconds",&runs[ii],NULL,NULL,runs[ii].timing.total);
+}
+
+
+/*
+ * Write the metrics of nruns nights to path, atomically.
+ * Returns 0, or 1 if it could not be written. Any old file is then left as it was.
+ */
+int metrics_write(const char *path, const LogRun *runs, int nruns)
+{
+  char *tmppath;
+  FILE *fp;
+  int err;
+
+  tmppath = (char *)malloc(strlen(path)+32);
+  if (tmppath == NULL)
+    return 1;
+  sprintf(tmppath,"%s.%ld.tmp",path,(long)getpid());
+
+  fp = fopen(tmppath,"w");
+  if (fp == NULL) {
+    free(tmppath);
+    return 1;
+  }
+  metrics_print(fp,runs,nruns);
+
+  err = (fflush(fp) != 0) || ferror(fp) || (fsync(fileno(fp)) != 0);
+  if (fclose(fp) != 0)
+    err = 1;
+  if (!err && rename(tmppath,path) != 0)
+    err = 1;
+  if (err)
+    remove(tmppath);
+
+  free(tmppath);
+  return err;
+}
@@ -0,0 +1,832 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+The extraction core of autolog, with nothing of the command line in it. Each directory is
+a LogRun, which goes through these in turn:
+
+ night_init()     set it up
+ night_scan()     read the listing, open the status log and hand the files over to be read
+ night_collect()  wait for them and gather up what was read, in the order they were listed
+ night_sort()     put the rows in order
+ night_name_log() decide what the log is called
+ night_write()    write it, in each format asked for
+ night_free()     and let it all go
+
+main() in autolog.c runs them for each directory on the command line, and autolog_api.c
+for a program which has linked libautolog. Errors go into the status log, and on stdout too
+if run->screen is set. The command line always sets it, so nothing it prints has changed.
+*/
+
+#define _ISOC99_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>		/* File permissions */
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+
+static void collect_LogJob(LogRun *run, LogJob *job);
+static void read_batch(LogRun *run, WorkQueue *wq, DirScan *scan, unsigned int from, unsigned int to, unsigned int *idx, int deferred, int last);
+static int write_spilled(LogRun *run, FormatWriter *writers, int nwriters, FILE **sinks, int nsinks);
+
+
+
+/*
+ * Set up run for the directory dirname. outname is the log name given on the command
+ * line, or NULL to make one up. dirname must stay put until run is freed.
+ */
+void night_init(LogRun *run, const char *dirname, const char *outname, AutologOptions *opt)
+{
+  logtable_init(&run->table,&opt->schema);	/* Sized once we know how many files there are */
+  spill_init(&run->spill,opt->memory,&opt->sort_spec,&run->table);
+  run->order = NULL;
+
+  run->badfilect = 0;		/* Number of files in the designated directory which were rejected and not read */
+  run->filect = 0;		/* Number of files for which data if currently held in run->table */
+  run->date_year = run->date_month = run->date_day = 0;
+  run->cache = NULL;
+  run->quiet = opt->quiet;
+  run->screen = opt->screen;
+  run->pending = 0;
+  run->ok = 0;
+  memset(&run->counts,0,sizeof(run->counts));
+
+  run->proglog = NULL;
+  run->report = NULL;
+  run->watch_fd = -1;
+
+  run->cfg.dirname = dirname;
+  run->cfg.reader = opt->reader;
+  run->cfg.schema = &opt->schema;
+  run->cfg.io = iopolicy_active(&opt->io) ? &opt->io : NULL;
+
+  /* Set a dummy value to enable us to identify the first run through the directory reading loop */
+  sprintf(run->putative_outlogdate,"00000000");
+  run->multiple_nights_data = 0;
+
+  run->create_outlog_name = (outname == NULL);
+  if(outname)
+    strcpy(run->outlog_name,outname);
+}
+
+
+
+/*
+ * Open the status log for run's directory and hand every file which needs reading to
+ * wq. In serial mode they are all read (and collected) before this returns. With names
+ * NULL every file in the directory is looked at, otherwise only the nnames named.
+ * Returns 0, or the Autolog_Error main() exits with if the directory could not be scanned:
+ * -21 if it could not be read, -23 if the status log could not be opened.
+ */
+int night_scan(LogRun *run, const AutologOptions *opt, WorkQueue *wq, char **names, int nnames)
+{
+  int skip_this_file,no_dprt,deferred;
+  unsigned int ii,batch,batch_from,*batch_idx;
+  char *dirname;
+  char logpath[1040];
+  LTFileName cur;
+  LogJob *job;
+
+  /* Everything in the directory, read before any file is opened */
+  DirScan scan;
+  DirEntry *entry;
+  const char *name;
+  unsigned int ient;
+  double tt;
+
+  dirname = (char *)run->cfg.dirname;
+
+  /* red_report created its log before reading the directory, so it was in the listing */
+  if(opt->report_out){
+    sprintf(logpath,"%s/red_report.log",dirname);
+    run->report = fopen(logpath,"w");
+  }
+
+  /* With --watch, watch before listing, or a frame which lands while the night is read
+   * would be in neither. Its event waits for watch_directory() */
+  if(opt->watch && names==NULL)
+    run->watch_fd = watch_begin(dirname);
+
+  /* Read the input directory. If it cannot be opened, give an error and quit */
+  tt = trace_now();
+  if(names)
+    ii = dirscan_names(dirname,names,nnames,&scan,run->report!=NULL);
+  else
+    ii = dirscan_read(dirname,&scan,run->report!=NULL);
+  if (ii != 0){
+    if(run->screen)
+      printf("Error opening directory (%d) - %s\n\n",-21,dirname);
+    return -21;
+  }
+  tt = trace_phase(run,TRACE_READDIR,tt);
+
+  /* Create and open progress/error log file */
+  sprintf(logpath,"%s/autolog_status.log",dirname);
+  run->proglog = fopen(logpath,"w");
+  if(run->proglog==0){
+    if(run->screen){
+      printf("Could not open progress log (%d): %s\n",-23,logpath);
+      printf("Proceding no further\n");
+    }
+    dirscan_free(&scan);
+    if(run->report)
+      fclose(run->report);
+    run->report = NULL;
+    return -23;
+  }
+  run->ok = 1;
+  fprintf(run->proglog,"First line of the log.\n"); fflush(run->proglog);
+  if(opt->report_out && run->report==NULL){
+    if(run->screen)
+      printf("Could not open %s/red_report.log (%d). Carrying on without --red-report\n",dirname,-23);
+    fprintf(run->proglog,"Could not open %s/red_report.log (%d). Carrying on without --red-report\n",dirname,-23);
+  }
+  if(run->report && report_plan(&scan)){
+    fprintf(run->proglog,"Out of memory (%d) planning the reduction report. Carrying on without --red-report\n",-25);
+    fclose(run->report);
+    run->report = NULL;
+  }
+  if(opt->reader==READER_RAW)
+    fprintf(run->proglog,"Reading primary headers directly, without cFITSIO.\n");
+  else if(opt->reader==READER_URING)
+    fprintf(run->proglog,"Reading primary headers directly, without cFITSIO, through io_uring if possible.\n");
+  else if(opt->reader==READER_MMAP)
+    fprintf(run->proglog,"Reading primary headers directly, without cFITSIO, through mmap().\n");
+  iopolicy_describe(&opt->io,run->proglog);
+
+  /* Headers read by previous runs, if we are using the cache */
+  if(opt->use_cache){
+    run->cache = &run->cachebuf;
+    tt = trace_now();
+    fprintf(run->proglog,"%5d files in the header cache %s\n",cache_load(run->cache,dirname,opt->schema.checksum),run->cache->path);
+    trace_phase(run,TRACE_CACHE_LOAD,tt);
+  }
+
+  /* Work out which version of each exposure we want from the names alone. That also
+   * tells us how many files we are going to read, so allocate for them all in one go */
+  tt = trace_now();
+  ii = scan.nfits - dirscan_resolve(&scan);
+  tt = trace_phase(run,TRACE_RESOLVE,tt);
+  if(scan.nskipped)
+    fprintf(run->proglog,"%5u names skipped, as not regular files or not named .fits\n",scan.nskipped);
+  run->counts.scanned += scan.nskipped;
+  run->counts.not_fits += scan.nskipped;
+
+  /* The order to open the files in, which need not be the order they are listed and logged in */
+  deferred = 0;
+  if(opt->open_order!=OPEN_ORDER_DIR){
+    deferred = (dirscan_order(dirname,&scan,opt->open_order)==0);
+    if(deferred && opt->open_order==OPEN_ORDER_EXTENT)
+      fprintf(run->proglog,"Opening files in disk order. FIEMAP placed %u of %u, the rest go by inode.\n",scan.nextents,scan.norder);
+    else if(deferred)
+      fprintf(run->proglog,"Opening files in inode order.\n");
+    tt = trace_phase(run,TRACE_ORDER,tt);
+  }
+  /* The store only ever holds a batch of files, each packed into the table as the batch is
+   * collected. With --memory the batch is what the budget allows, and the table grows as it
+   * must. --red-report needs every job for its report, so it keeps them all */
+  batch = run->spill.budget ? run->spill.batch : (run->report ? 0 : LOGSTORE_BATCH);
+  batch_from = 0;
+  batch_idx = NULL;
+  if(run->spill.budget)
+    fprintf(run->proglog,"Memory for the rows limited to %.1f MB. Reading %u files at a time.\n",
+	    run->spill.budget/(1024*1024.0),run->spill.batch);
+  else
+    logtable_reserve(&run->table,ii>0 ? ii : 1);
+  if(batch){
+    logstore_init(&run->store,MIN(ii,batch));
+    if(deferred){
+      batch_idx = (unsigned int *)malloc(batch*sizeof(unsigned int));
+      deferred = (batch_idx!=NULL);
+    }
+  }
+  else
+    logstore_init(&run->store,ii);
+
+  /* Loop over all the files in the directory, reading one at a time. Those kept only
+   * for --red-report have been counted already */
+  for(ient=0; ient<scan.nentries; ient++){
+    entry = &scan.entries[ient];
+    name = dirscan_name(&scan,ient);
+    if( entry->wanted && strcmp(name,".") && strcmp(name,"..") && strcmp(name,logpath) 
+	&& strcmp(name,AUTOLOG_CACHE_NAME) ){
+      run->counts.scanned++;
+      /* The standard LT filename was checked by dirscan_read(), and is chopped into its parts
+       * again here. If it is not a valid LT filename, give and error and proceeed to next file */
+      if(!entry->lt_ok){
+	fprintf(run->proglog,"Not an LT file name (%d): %s\n",31,name);
+	if (DEBUG) { printf("Not an LT file name (%d): %s\n",31,name); fflush(NULL); }
+	run->badfilect++;
+	run->counts.not_lt++;
+      }				/* Flow returns to for(ient) */
+      else{
+	dirscan_chop(&scan,ient,&cur);
+	/* Ignore non FITS files. There could be reduced data products in the directory which 
+	 * have valid LT names, but are not FITS */
+	if(entry->is_fits){
+	  if(DEBUG) { printf("current exposure : %s\n",cur.exposure); fflush(NULL); }
+	  fprintf(run->proglog,"current exposure : %s\n",cur.exposure);
+
+	  /* Check the date in this filename against all the others in the directory. If at the end
+	   * this directory contains only files from a single night, we will use that date as the 
+	   * log filename. If however there is a mix, we will resort to making up a semi-random filename
+	   * based on the UTSTART in the last file read. This is about the best guess we can come up
+	   * with as to a sensible default filename 
+	   */
+	  if( (run->create_outlog_name==1) && (run->multiple_nights_data==0) ) {
+	    /* This is first run through because dummy value is still in putative_outlogdate */
+	    if(strcmp(run->putative_outlogdate,"00000000")==0) {
+	      strcpy(run->putative_outlogdate,cur.date);
+	    } else {
+	      /* Check current file against putative_outlogdate, i.e., the first one read */
+	      if(strcmp(cur.date,run->putative_outlogdate)!=0) {
+		run->multiple_nights_data = 1;
+	      }
+	    }
+	  }
+	  
+
+	  /* Several FITS header keywords are set by Dp(RT). If the current file is unreduced,
+	   * we first check to see if a reduced version exists. If it does, we bale out and ignore the
+	   * unreduced version. The reduced one will get read in turn. If no reduced version exists,
+	   * we do read it, but error messages will crop up in the logs.
+	   * dirscan_resolve() has already looked for the reduced versions, so this costs nothing. */
+	  skip_this_file = 0;
+	  no_dprt = 0;		/* Initially assume there is dp(rt) output */
+	  if(cur.p[0] == '0'){
+	    fprintf(run->proglog,"File %s has not been reduced. Checking to see if a reduced version exists\n",cur.exposure);
+	    if(entry->superseded){
+	      fprintf(run->proglog,"Reduced data is available, so we will ignore this file.\n");
+	      skip_this_file = 1;		/* Used later to ignore errors on this file. We know why it failed */
+	      run->counts.superseded++;
+	    }
+	    else{
+	      fprintf(run->proglog,"No reduced data exists, so we are going to get some errors from this file.\n");
+	      no_dprt = 1;		/* Informational flag that none of the dp(rt) data will be available */
+	    }
+
+	  }
+	  else if(entry->superseded){
+	    fprintf(run->proglog,"A more reduced version of %s is available, so we will ignore this file.\n",cur.exposure);
+	    skip_this_file = 1;
+	    run->counts.superseded++;
+	  }
+
+	  if(skip_this_file==0 || entry->report==REPORT_READ){
+	    /* Hand the file over to be read. In serial mode it has already been read
+	     * by the time workqueue_submit() returns, so collect it straight away and the 
+	     * status log comes out exactly as it always has. With -j the results are
+	     * collected in this same order once all the workers have finished.
+	     * With --open-order other than dir the job is only made ready here, and handed
+	     * over below once the batch is full, or with --red-report once every file has one.
+	     * A file skipped here may still be read for --red-report, but only the report sees it. */
+	    job = logstore_new_job(&run->store);
+	    if(job==NULL){
+	      fprintf(run->proglog,"Out of memory (%d) at %s\n",-25,cur.exposure);
+	      break;
+	    }
+	    job->cur = cur;
+	    job->no_dprt = no_dprt;
+	    job->report_only = skip_this_file;
+	    job->from_cache = 0;
+	    job->inode = 0;
+	    job->worker = 0;
+	    job->cfg = &run->cfg;
+	    job->pending = &run->pending;
+	    entry->job = job;
+	    if(!deferred){
+	      /* Unless we already read this very file last time */
+	      if( (run->cache==NULL) || !cache_fill_job(run->cache,dirname,job) )
+		workqueue_submit(wq,job);
+	      if(wq->nthreads==0){
+		collect_LogJob(run,job);
+	      }
+	    }
+	    /* Read and collect each batch before going on to the next */
+	    if(batch && run->store.njobs==batch){
+	      read_batch(run,wq,&scan,batch_from,ient+1,batch_idx,deferred,0);
+	      batch_from = ient+1;
+	    }
+	  }
+
+
+	}  /* End of if(cur_ext=="fits") */
+	else
+	  run->counts.not_fits++;
+
+      }  /* End of `this is a valid filename' */ 
+    } /* End of `this is not . or .. */
+
+  } /* End of for(ient) over the incoming directory */
+
+  /* Now hand them over in the order they are to be opened. Serially they are read as they
+   * go, and collected afterwards in the order they were listed, just as -j collects them */
+  if(batch){
+    read_batch(run,wq,&scan,batch_from,scan.nentries,batch_idx,deferred,1);
+    free(batch_idx);
+  }
+  else if(deferred){
+    for(ii=0; ii<scan.norder; ii++){
+      job = scan.entries[scan.order[ii]].job;
+      if(job==NULL)
+	continue;
+      if( (run->cache==NULL) || !cache_fill_job(run->cache,dirname,job) )
+	workqueue_submit(wq,job);
+    }
+    if(wq->nthreads==0){
+      for(ii=0; ii<run->store.njobs; ii++)
+	collect_LogJob(run,logstore_job(&run->store,ii));
+    }
+  }
+  /* The report goes through the whole listing again, once everything is read */
+  if(run->report)
+    run->scan = scan;
+  else
+    dirscan_free(&scan);
+  trace_phase(run,TRACE_READ,tt);
+
+  return 0;
+}
+
+
+
+/*
+ * Wait for the rest of run's files to be read and collect them, then write the
+ * --red-report and save the --cache. Afterwards run->table has every row, in the
+ * order the files were listed, and the LogJobs they were read into are gone.
+ * With --memory it has only those which were not spilled to run->spill.
+ */
+void night_collect(LogRun *run, const AutologOptions *opt, WorkQueue *wq)
+{
+  unsigned int jj;
+  double tt;
+
+  /* Wait for the worker threads (if any) and collect what they read */
+  if(wq->nthreads!=0){
+    tt = trace_now();
+    workqueue_wait(wq,&run->pending);
+    for(jj=0; jj<run->store.njobs; jj++)
+      collect_LogJob(run,logstore_job(&run->store,jj));
+    trace_phase(run,TRACE_WAIT,tt);
+  }
+
+  /* Everything red_report would have read has been, so write what it would have said */
+  if(run->report){
+    tt = trace_now();
+    report_write(run,opt->report_out);
+    fclose(run->report);
+    run->report = NULL;
+    dirscan_free(&run->scan);
+    trace_phase(run,TRACE_REPORT,tt);
+  }
+
+  fprintf(run->proglog,"%5d files successfully read into log\n",run->filect); 
+  fprintf(run->proglog,"%5d bad files not read\n",run->badfilect); fflush(run->proglog);
+  if(run->spill.nruns){
+    fprintf(run->proglog,"%5u rows spilled to %d temporary file%s, to be merged with the %u still in memory\n",
+	    run->filect-run->table.nrows,run->spill.nruns,run->spill.nruns==1 ? "" : "s",run->table.nrows);
+    fflush(run->proglog);
+  }
+
+  if(run->cache){
+    fprintf(run->proglog,"%5d files taken from the header cache\n",run->cache->hits);
+    tt = trace_now();
+    if(cache_save(run->cache))
+      fprintf(run->proglog,"Could not write the header cache %s\n",run->cache->path);
+    cache_close(run->cache);
+    trace_phase(run,TRACE_CACHE_SAVE,tt);
+    fflush(run->proglog);
+  }
+
+  /* Every row is in the table now, and each job is over a kilobyte */
+  logstore_free(&run->store);
+}
+
+
+
+/*
+ * Put the rows in order. By default that is by MJD, as it always has been. Rows which
+ * tie on every --sort key come out in the order the files were read. We then read out
+ * the data in order, row order[ii] of run->table where 0 < ii < filect.
+ * May be called again to sort the same rows another way. With --memory only the rows
+ * still in the table are sorted here. Those spilled were sorted as they went.
+ */
+void night_sort(LogRun *run, const SortSpec *spec)
+{
+  double tt;
+
+  tt = trace_now();
+  free(run->order);
+  run->order = (unsigned int *)malloc(sizeof(unsigned int) * (run->table.nrows>0 ? run->table.nrows : 1));
+  if(sort_log_rows(&run->table,spec,run->order))
+    fprintf(run->proglog,"Out of memory sorting the log. Rows are in the order read.\n");
+  trace_phase(run,TRACE_SORT,tt);
+}
+
+
+
+/*
+ * Set run->logpath. Without a name from the command line the log is named after the
+ * night the files are from, or failing that the DATE-OBS of the last one.
+ */
+void night_name_log(LogRun *run)
+{
+  const char *dirname;
+
+  dirname = run->cfg.dirname;
+  if ( run->create_outlog_name == 1) {
+    if( run->multiple_nights_data == 1) {
+      if(run->date_year==0 || run->date_month==0 || run->date_day==0){
+	if(run->screen)
+	  printf("Error reading observations date. Log will be called autolog.log\n");
+        fprintf(run->proglog,"Error reading observations date. Log will be called autolog.log\n");
+        sprintf(run->logpath,"%s/autolog.log",dirname);
+      }
+      else {
+        sprintf(run->logpath,"%s/%4d%02d%02d.log",dirname,run->date_year,run->date_month,run->date_day);
+      }
+    } else {
+      sprintf(run->logpath,"%s/%s.log",dirname,run->putative_outlogdate);	
+    }
+  }
+  /* Otherwise use the name provide on the command line */
+  else 
+    sprintf(run->logpath,"%s/%s",dirname,run->outlog_name);
+}
+
+
+
+/*
+ * Write the sorted rows to run->logpath in each of formats (FORMAT_*), to stdout unless
+ * run->quiet, and to merged if that is not NULL. With --memory, if any rows were spilled,
+ * they are merged with those in the table as they are written.
+ * Returns 0, or 1 if any of the files could not be written. The status log says which.
+ */
+int night_write(LogRun *run, const AutologOptions *opt, int formats, FILE *merged)
+{
+  static const int other_formats[3] = {FORMAT_CSV,FORMAT_JSONL,FORMAT_FITSTABLE};
+  static const char *other_suffixes[3] = {".csv",".jsonl",".fits"};
+  FILE *outlog;
+  FILE *sinks[3];		/* Where the rows of the log go */
+  FormatWriter writers[3];	/* The --format outputs other than text */
+  char otherpath[1040];
+  LogInfo info;
+  unsigned int row;
+  int nsinks,nwriters,ii,jj,status,err;
+  double tt;
+
+  err = 0;
+  tt = trace_now();
+  outlog = NULL;
+  if(formats & FORMAT_TEXT)
+    outlog = fopen(run->logpath,"w");
+  if( (formats & FORMAT_TEXT) && (outlog==0) ){
+    if(run->screen){
+      printf("Could not open output file (%d): %s\n",-53,run->logpath);
+      printf("Proceeding, but writing only to screen\n");
+    }
+    fprintf(run->proglog,"Could not open output file (%d): %s\n",-53,run->logpath);
+    err = 1;
+  }
+
+  /* Every row is formatted just once and the same buffer written to each of these */
+  nsinks = 0;
+  if(!run->quiet){
+    log_header_write(stdout);
+    printf("\n");
+    sinks[nsinks++] = stdout;
+  }
+  if(outlog){
+    log_header_write(outlog);
+    sinks[nsinks++] = outlog;
+  }
+  if(merged)
+    sinks[nsinks++] = merged;
+
+  /* The same rows again in any other formats asked for */
+  nwriters = 0;
+  for(ii=0; ii<3; ii++){
+    if(!(formats & other_formats[ii]))
+      continue;
+    format_path(run->logpath,other_suffixes[ii],otherpath);
+    if( (status = format_open(&writers[nwriters],other_formats[ii],otherpath,opt->schema.fields,opt->schema.ncolumns,run->filect)) ){
+      if(other_formats[ii]==FORMAT_FITSTABLE)
+	fprintf(run->proglog,"Could not write %s. A FITSIO error has occured: %d\n",otherpath,status);
+      else
+	fprintf(run->proglog,"Could not write %s\n",otherpath);
+      err = 1;
+    }
+    else
+      nwriters++;
+  }
+
+  if(run->spill.nruns){
+    if(write_spilled(run,writers,nwriters,sinks,nsinks))
+      err = 1;
+    tt = trace_phase(run,TRACE_SPILL,tt);
+  }
+  else{
+    if(output_log_rows(&run->table,run->order,run->filect,opt->nthreads,sinks,nsinks)){
+      fprintf(run->proglog,"Error writing the log\n");
+      err = 1;
+    }
+    tt = trace_phase(run,TRACE_OUTPUT,tt);
+    for(row=0; row<run->filect && nwriters; row++){
+      logtable_row(&run->table,run->order[row],&info);
+      for(jj=0; jj<nwriters; jj++)
+	format_row(&writers[jj],&info);
+    }
+  }
+  if(outlog)
+    fclose(outlog);
+
+  for(jj=0; jj<nwriters; jj++){
+    if( (status = format_close(&writers[jj])) ){
+      if(writers[jj].format==FORMAT_FITSTABLE)
+	fprintf(run->proglog,"Could not write %s. A FITSIO error has occured: %d\n",writers[jj].path,status);
+      else
+	fprintf(run->proglog,"Could not write %s\n",writers[jj].path);
+      err = 1;
+    }
+  }
+  if(formats & ~FORMAT_TEXT)
+    trace_phase(run,TRACE_FORMATS,tt);
+
+  return err;
+}
+
+
+
+/* Everything held for run, and its status log */
+void night_free(LogRun *run)
+{
+  free(run->order);
+  logtable_free(&run->table);
+  logstore_free(&run->store);
+  spill_free(&run->spill);
+  run->order = NULL;
+
+  if(run->proglog)
+    fclose(run->proglog);
+  run->proglog = NULL;
+  if(run->watch_fd >= 0)
+    close(run->watch_fd);
+  run->watch_fd = -1;
+}
+
+
+
+/*
+ * Take the result of one extract_LogInfo() and add it to the end of run->table, writing
+ * the same messages into the status log as the old inline loop did.
+ * This is only ever called from the main thread, in the order the files were found.
+ */
+static void collect_LogJob(LogRun *run, LogJob *job)
+{
+  double tt;
+
+  trace_file(run,job);
+  /* Read for --red-report alone. It is only remembered, for next time */
+  if(job->report_only){
+    if(run->cache && job->status!=41)
+      cache_add(run->cache,job);
+    return;
+  }
+  metrics_job(run,job);
+
+  if(job->status==41){
+    fprintf(run->proglog,"Failed to open FITS (%d)- %s\n",41,job->cur.exposure);
+    if(run->screen)
+      printf("Failed to open FITS (%d)- %s\n",41,job->cur.exposure);
+    run->badfilect++;
+    return;
+  }
+
+  if(job->date_read){
+    run->date_year = job->date_year;
+    run->date_month = job->date_month;
+    run->date_day = job->date_day;
+  }
+
+  /* Remember what was read so the next run need not read it again */
+  if(run->cache)
+    cache_add(run->cache,job);
+
+  if(job->status){
+    job->info.error = job->status;
+    fprintf(run->proglog,"A FITSIO error has occured: %d\n",job->status);
+  }
+
+  /* The row is packed into run->table, and the job is not needed again */
+  if(logtable_add(&run->table,&job->info)){
+    fprintf(run->proglog,"Out of memory (%d) at %s\n",-25,job->cur.exposure);
+    run->badfilect++;
+    return;
+  }
+
+  fprintf(run->proglog,"Finished with %s\n",job->cur.exposure); fflush(run->proglog);
+  run->filect++;
+
+  /* With --memory, a table which has grown too big is sorted and written out. If that
+   * cannot be done the rows stay where they are, and so will the rest */
+  if(spill_due(&run->spill,&run->table)){
+    tt = trace_now();
+    if(spill_table(&run->spill,&run->table)){
+      fprintf(run->proglog,"Could not spill rows to a temporary file (%d). Keeping the rest in memory\n",-25);
+      run->spill.table_bytes = (size_t)-1;
+    }
+    trace_phase(run,TRACE_SPILL,tt);
+  }
+}
+
+
+
+/*
+ * Hand over the files of scan's entries from to to-1, if that was deferred, and then,
+ * unless this is the last batch, which night_collect() waits for, wait for them all and
+ * collect them, so the store can be used again. idx is scratch for a batch of entry
+ * numbers.
+ */
+static void read_batch(LogRun *run, WorkQueue *wq, DirScan *scan, unsigned int from, unsigned int to, unsigned int *idx, int deferred, int last)
+{
+  unsigned int ii,n;
+  LogJob *job;
+
+  if(deferred){
+    n = 0;
+    for(ii=from; ii<to; ii++){
+      if(scan->entries[ii].job)
+	idx[n++] = ii;
+    }
+    dirscan_order_some(scan,idx,n);
+    for(ii=0; ii<n; ii++){
+      job = scan->entries[idx[ii]].job;
+      if( (run->cache==NULL) || !cache_fill_job(run->cache,run->cfg.dirname,job) )
+	workqueue_submit(wq,job);
+    }
+    if(wq->nthreads==0){
+      for(ii=0; ii<run->store.njobs; ii++)
+	collect_LogJob(run,logstore_job(&run->store,ii));
+    }
+  }
+  if(last)
+    return;
+
+  if(wq->nthreads!=0){
+    workqueue_wait(wq,&run->pending);
+    for(ii=0; ii<run->store.njobs; ii++)
+      collect_LogJob(run,logstore_job(&run->store,ii));
+  }
+  for(ii=from; ii<to; ii++)
+    scan->entries[ii].job = NULL;
+  logstore_reset(&run->store);
+}
+
+
+
+/*
+ * --memory. Merge the spilled runs with the rows left in the table, and write each row
+ * to the text sinks and the other format writers as it comes.
+ * Returns 0, or 1 if anything could not be read back or written.
+ */
+static int write_spilled(LogRun *run, FormatWriter *writers, int nwriters, FILE **sinks, int nsinks)
+{
+  LogInfo info;
+  char line[OUTPUT_MAX_ROW];
+  int len,ii,rc,err;
+
+  err = 0;
+  rc = spill_merge_start(&run->spill,&run->table,run->order) ? -1 : 1;
+  while(rc>0 && (rc = spill_merge_next(&run->spill,&info))>0){
+    len = format_log_row(line,sizeof(line),&info);
+    len = MIN(len,(int)sizeof(line)-1);
+    for(ii=0; ii<nsinks; ii++){
+      if(fwrite(line,1,len,sinks[ii])!=(size_t)len)
+	err = 1;
+    }
+    for(ii=0; ii<nwriters; ii++)
+      format_row(&writers[ii],&info);
+  }
+  if(rc<0){
+    fprintf(run->proglog,"Could not read back the rows spilled to a temporary file\n");
+    err = 1;
+  }
+  for(ii=0; ii<nsinks; ii++){
+    if(fflush(sinks[ii])!=0 || ferror(sinks[ii]))
+      err = 1;
+  }
+  if(err && rc>=0)
+    fprintf(run->proglog,"Error writing the log\n");
+  return err;
+}
+
+
+
+/* The column headings of the log, to fp */
+void log_header_write(FILE *fp)
+{
+  int ii;
+
+  for (ii=0; ii<LOG_HEADER_LINES; ii++)
+    fputs(log_header[ii],fp);
+}
+
+
+/*
+ * Format one line of the log into buf, exactly as it is printed by main(). Returns the
+ * length of the line, including the newline, as snprintf() does.
+ */
+int format_log_row(char *buf, size_t buflen, const LogInfo *info)
+{
+  return snprintf(buf,buflen,LOG_ROW_FORMAT,
+	info->utstart,
+	info->object,
+	info->propid,
+	info->ra,
+	info->dec,
+	info->airmass,
+	info->instrume,
+	info->filter,
+	info->binning,
+	info->grating,
+	info->exptime,
+	info->l1seeing,
+/*	info->l1photom, */
+	info->l1skybrt,
+	info->exposure,
+	info->groupid,
+	info->error);
+}
+
+
+/*
+ * Copy exposure into base, less its final `_p' pipeline flag. Raw and reduced versions
+ * of the same exposure, e.g. h_e_20200624_12_1_1_0 and h_e_20200624_12_1_1_1,
+ * have the same base.
+ */
+void night_exposure_base(const char *exposure, char *base)
+{
+  const char *last;
+
+  last = strrchr(exposure,'_');
+  if(last==NULL) {
+    strcpy(base,exposure);
+    return;
+  }
+  memcpy(base,exposure,last-exposure);
+  base[last-exposure] = '\0';
+}
+
+
+
+/* Blank strings and mostly zero values, for extract_LogInfo() to fill in */
+void night_init_LogInfo(LogInfo *to_init){
+
+  sprintf(to_init->object,"                  ");
+  sprintf(to_init->exposure,"                          ");
+  sprintf(to_init->ra,"             ");
+  sprintf(to_init->dec,"             ");
+  sprintf(to_init->utstart,"            ");
+  to_init->mjd = 0;
+  to_init->airmass = 0;
+  sprintf(to_init->instrume,"            ");
+  sprintf(to_init->propid,"         ");
+  to_init->exptime = 0;
+  sprintf(to_init->grating,"           ");
+  sprintf(to_init->filter,"                        ");
+  to_init->binning = 0;
+  to_init->l1seeing = 999;
+  to_init->l1photom = -999;
+  to_init->l1skybrt = 99.9;
+  to_init->error = 0;
+  memset(to_init->extra,0,sizeof(to_init->extra));
+
+  return;
+
+}
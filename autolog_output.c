@@ -0,0 +1,197 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+Writes the rows of the log.
+
+Each row used to be formatted twice, by printf() for the screen and again by fprintf() for
+the log file. Now every row is formatted once, with format_log_row(), into one big buffer
+and that buffer goes to each output (the log file, and stdout unless --quiet) with a
+single writev().
+
+With -j and a lot of rows, the rows are split into one contiguous chunk per thread and the
+chunks are formatted at the same time, each into its own buffer. The writev() then simply
+takes the chunk buffers in order, so the output is the same as formatting them one by one.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+/* One contiguous run of rows, formatted into its own buffer */
+typedef struct OutputChunk_Struct{
+  const LogTable *table;
+  const unsigned int *order;
+  unsigned int first,last;	/* Rows order[first] to order[last-1] */
+  char *buf;
+  size_t len,nalloc;
+  int failed;			/* Out of memory */
+  pthread_t thread;
+}OutputChunk;
+
+
+static void *output_format_chunk(void *arg)
+{
+  OutputChunk *chunk;
+  LogInfo info;
+  char *newbuf;
+  unsigned int ii;
+  int len;
+
+  chunk = (OutputChunk *)arg;
+  chunk->len = 0;
+  chunk->nalloc = (size_t)(chunk->last-chunk->first)*OUTPUT_ROW_GUESS + OUTPUT_MAX_ROW;
+  chunk->buf = (char *)malloc(chunk->nalloc);
+  chunk->failed = (chunk->buf == NULL);
+
+  for (ii=chunk->first; ii<chunk->last && !chunk->failed; ii++) {
+    /* Always room for the longest row, so snprintf() never has to be repeated */
+    if (chunk->nalloc - chunk->len < OUTPUT_MAX_ROW) {
+      newbuf = (char *)realloc(chunk->buf,2*chunk->nalloc);
+      if (newbuf == NULL) {
+	chunk->failed = 1;
+	break;
+      }
+      chunk->buf = newbuf;
+      chunk->nalloc *= 2;
+    }
+    logtable_row(chunk->table,chunk->order[ii],&info);
+    len = format_log_row(chunk->buf+chunk->len,OUTPUT_MAX_ROW,&info);
+    if (len >= OUTPUT_MAX_ROW)
+      len = OUTPUT_MAX_ROW-1;
+    chunk->len += len;
+  }
+
+  return NULL;
+}
+
+
+/* writev() all of iov to fd, carrying on after short writes. iov is modified. */
+static int output_writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+  ssize_t done;
+
+  while (iovcnt > 0) {
+    done = writev(fd,iov,iovcnt);
+    if (done < 0) {
+      if (errno == EINTR)
+	continue;
+      return 1;
+    }
+    while (iovcnt > 0 && (size_t)done >= iov->iov_len) {
+      done -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + done;
+      iov->iov_len -= done;
+    }
+  }
+  return 0;
+}
+
+
+/*
+ * Write rows order[0] to order[n-1] of table to each of the nsinks open files.
+ * Anything already buffered in those FILEs (e.g. the header) is flushed first.
+ * With nthreads > 1 and at least OUTPUT_PARALLEL_MIN rows, the rows are formatted in
+ * nthreads chunks at once.
+ * Returns 0, or 1 if anything could not be written.
+ */
+int output_log_rows(const LogTable *table, const unsigned int *order, unsigned int n, int nthreads, FILE **sinks, int nsinks)
+{
+  OutputChunk *chunks;
+  struct iovec *iov;
+  unsigned int nchunks,ii,per;
+  int ss,started,err,formatfail;
+
+  if (nsinks == 0)
+    return 0;
+
+  nchunks = 1;
+  if (nthreads > 1 && n >= OUTPUT_PARALLEL_MIN)
+    nchunks = MIN(nthreads,OUTPUT_MAX_CHUNKS);
+
+  chunks = (OutputChunk *)calloc(nchunks,sizeof(OutputChunk));
+  iov = (struct iovec *)malloc(nchunks*sizeof(struct iovec));
+  if (chunks == NULL || iov == NULL) {
+    free(chunks);
+    free(iov);
+    return 1;
+  }
+
+  per = (n+nchunks-1)/nchunks;
+  for (ii=0; ii<nchunks; ii++) {
+    chunks[ii].table = table;
+    chunks[ii].order = order;
+    chunks[ii].first = MIN(ii*per,n);
+    chunks[ii].last = MIN((ii+1)*per,n);
+  }
+
+  /* The first chunk is always done by this thread. Any chunk whose thread will not
+   * start is done here too */
+  started = 0;
+  for (ii=1; ii<nchunks; ii++) {
+    if (pthread_create(&chunks[ii].thread,NULL,output_format_chunk,&chunks[ii]) != 0)
+      break;
+    started++;
+  }
+  output_format_chunk(&chunks[0]);
+  for (ii=1+started; ii<nchunks; ii++)
+    output_format_chunk(&chunks[ii]);
+  for (ii=1; ii<=(unsigned int)started; ii++)
+    pthread_join(chunks[ii].thread,NULL);
+
+  formatfail = 0;
+  for (ii=0; ii<nchunks; ii++) {
+    if (chunks[ii].failed)
+      formatfail = 1;
+  }
+  err = formatfail;
+
+  /* A sink which fails does not stop the others being written */
+  for (ss=0; ss<nsinks && !formatfail; ss++) {
+    fflush(sinks[ss]);
+    for (ii=0; ii<nchunks; ii++) {
+      iov[ii].iov_base = chunks[ii].buf;
+      iov[ii].iov_len = chunks[ii].len;
+    }
+    if (output_writev_all(fileno(sinks[ss]),iov,nchunks))
+      err = 1;
+  }
+
+  for (ii=0; ii<nchunks; ii++)
+    free(chunks[ii].buf);
+  free(chunks);
+  free(iov);
+
+  return err;
+}
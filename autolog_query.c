@@ -0,0 +1,218 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+autolog_query. Finds frames in the archive index autolog --index keeps, without going
+near the nights themselves.
+
+  autolog_query [--from=DATE] [--to=DATE] [--propid=X] [--groupid=X] [--object=X]
+                [--instrume=X] [--count] INDEX
+
+prints the rows of every frame which matches all of the options given, in MJD order, as
+they are in the nightly logs, under the log's own header. Each night's rows have a line
+starting # with the night's directory before them. --count prints only how many there are.
+
+DATE is an MJD, or a night as YYYYMMDD, which runs from noon UT on that date to noon the
+next day, as the logs are named. --from is the first MJD or night wanted and --to the
+first MJD not wanted, or the last night wanted. The keys must match whole, but only their
+first INDEX_KEY_LEN-1 characters are kept in the index.
+
+The index is mmap()ed and searched in place, so only the pages holding what is found are
+ever read. See autolog_index.c.
+*/
+
+#define _ISOC99_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+#define QUERY_MJD_1970	40587	/* MJD of 1970-01-01 */
+
+
+static void query_usage(void)
+{
+  printf("autolog_query [--from=DATE] [--to=DATE] [--propid=X] [--groupid=X] [--object=X] [--instrume=X] [--count] INDEX\n");
+  printf("Prints the rows of every frame in INDEX, the file autolog --index writes, which matches all of the\n");
+  printf("options given, in MJD order.\n");
+  printf("DATE is an MJD, or a night as YYYYMMDD, from noon UT that day to noon the next.\n");
+  printf("--from is the first wanted, --to the first MJD not wanted or the last night wanted.\n");
+  printf("--count prints only the number of rows.\n");
+}
+
+
+/* Days from 1970-01-01 to the given date in the Gregorian calendar */
+static long query_days(long year, int month, int day)
+{
+  long era,yoe,doy;
+
+  year -= (month <= 2);
+  era = (year >= 0 ? year : year-399) / 400;
+  yoe = year - era*400;
+  doy = (153*(month + (month > 2 ? -3 : 9)) + 2)/5 + day-1;
+  return era*146097 + yoe*365 + yoe/4 - yoe/100 + doy - 719468;
+}
+
+
+/*
+ * A --from or --to value as an MJD. A night (YYYYMMDD) starts at noon UT, and with end
+ * set is taken to mean the noon after it. Returns 0, or 1 if str is neither.
+ */
+static int query_date(const char *str, int end, double *mjd)
+{
+  char *rest;
+  double value;
+  long date;
+
+  value = strtod(str,&rest);
+  if (rest == str || *rest != '\0')
+    return 1;
+  if (value < 10000000) {
+    *mjd = value;
+    return 0;
+  }
+  date = (long)value;
+  if (date != value || (date/100)%100 < 1 || (date/100)%100 > 12 || date%100 < 1 || date%100 > 31)
+    return 1;
+  *mjd = query_days(date/10000,(date/100)%100,date%100) + QUERY_MJD_1970 + 0.5 + (end ? 1 : 0);
+  return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+  ArchiveIndex idx;
+  const IndexRecord *rec;
+  const char *path,*value[INDEX_NKEYS];
+  double from,to;
+  unsigned int first,last,ii,pos,count,best_first,best_last,night;
+  int kk,best,count_only,matches,err;
+
+  path = NULL;
+  from = -1e30;
+  to = 1e30;
+  count_only = 0;
+  for (kk=0; kk<INDEX_NKEYS; kk++)
+    value[kk] = NULL;
+
+  err = 0;
+  for (ii=1; ii<(unsigned int)argc && !err; ii++) {
+    if (strncmp(argv[ii],"--from=",7) == 0)
+      err = query_date(argv[ii]+7,0,&from);
+    else if (strncmp(argv[ii],"--to=",5) == 0)
+      err = query_date(argv[ii]+5,1,&to);
+    else if (strcmp(argv[ii],"--count") == 0)
+      count_only = 1;
+    else if (strncmp(argv[ii],"--",2) == 0) {
+      for (kk=0; kk<INDEX_NKEYS; kk++) {
+	if (strncmp(argv[ii]+2,index_key_names[kk],strlen(index_key_names[kk])) == 0
+	    && argv[ii][2+strlen(index_key_names[kk])] == '=') {
+	  value[kk] = argv[ii]+3+strlen(index_key_names[kk]);
+	  break;
+	}
+      }
+      err = (kk == INDEX_NKEYS);
+    }
+    else if (argv[ii][0] == '-' || path != NULL)
+      err = 1;
+    else
+      path = argv[ii];
+  }
+  if (err || path == NULL) {
+    query_usage();
+    return 1;
+  }
+
+  switch (index_open(&idx,path)) {
+    case -1:
+      printf("No index %s\n",path);
+      return 2;
+    case 1:
+      printf("%s is not an index this autolog_query can read\n",path);
+      return 2;
+  }
+
+  /* Search on whichever key narrows it down most, and check the others as we go.
+   * Without any, the records themselves are in MJD order */
+  best = -1;
+  best_first = index_find_mjd(&idx,from);
+  best_last = MAX(best_first,index_find_mjd(&idx,to));
+  for (kk=0; kk<INDEX_NKEYS; kk++) {
+    if (value[kk] == NULL)
+      continue;
+    index_find_key(&idx,kk,value[kk],from,to,&first,&last);
+    if (best < 0 || last-first < best_last-best_first) {
+      best = kk;
+      best_first = first;
+      best_last = last;
+    }
+  }
+
+  if (!count_only) {
+    for (kk=0; kk<LOG_HEADER_LINES; kk++)
+      fputs(log_header[kk],stdout);
+  }
+  count = 0;
+  night = idx.nnights;
+  for (pos=best_first; pos<best_last; pos++) {
+    rec = &idx.records[best < 0 ? pos : idx.keys[best][pos]];
+    matches = 1;
+    for (kk=0; kk<INDEX_NKEYS && matches; kk++) {
+      if (kk != best && value[kk] != NULL)
+	matches = index_key_matches(rec,kk,value[kk]);
+    }
+    if (!matches)
+      continue;
+    count++;
+    if (count_only)
+      continue;
+
+    if (rec->night != night) {
+      night = rec->night;
+      printf("# %s\n",night < idx.nnights ? idx.nights[night].dirname : "");
+    }
+    printf(LOG_ROW_FORMAT,
+	   rec->utstart,
+	   rec->key[INDEX_KEY_OBJECT],
+	   rec->key[INDEX_KEY_PROPID],
+	   rec->ra,
+	   rec->dec,
+	   rec->airmass,
+	   rec->key[INDEX_KEY_INSTRUME],
+	   rec->filter,
+	   rec->binning,
+	   rec->grating,
+	   rec->exptime,
+	   rec->l1seeing,
+	   rec->l1skybrt,
+	   rec->exposure,
+	   rec->key[INDEX_KEY_GROUPID],
+	   rec->error);
+  }
+  if (count_only)
+    printf("%u\n",count);
+
+  index_close(&idx);
+  return 0;
+}
@@ -0,0 +1,574 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+A minimal FITS primary header reader which does not use cFITSIO at all. All autolog
+ever wants is a couple of dozen keywords from the primary header, so we pread() the
+file one 2880 byte block at a time and stop as soon as the END card turns up. The data
+unit is never touched. With --reader=mmap the blocks are mapped instead of read, and the
+cards are scanned where they sit in the page cache (see rawhdr_map()). Looking for END
+and pulling out values is done by autolog_cardscan.c, with SIMD where the CPU has it.
+
+Archived nights are compressed, and these are read the same way. A gzipped frame goes
+through zlib's gzread(), which only inflates as far as the blocks asked for, so the image
+is never decompressed. A tile compressed (fpack) frame is not compressed in its headers at
+all: the one we want is simply the header of the first extension, after an empty primary.
+
+The value conversions deliberately behave like the cFITSIO ones they replace (ffgkys
+and ffgky), including the status codes and the habit of doing nothing at all if *status
+is already set, so a value comes out the same whichever reader found the card.
+*/
+
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <zlib.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+
+/* Where the header blocks come from */
+typedef struct RawSource_Struct{
+  int fd;			/* Plain and tile compressed files. -1 for gzip */
+  gzFile gz;			/* Gzipped files, inflated as they are read */
+  off_t offset;			/* Of the next block in fd */
+  long nread;			/* Bytes of blocks read so far */
+}RawSource;
+
+
+/*
+ * Which kind of compression path has, going by its name: RAWHDR_GZIP for .gz,
+ * RAWHDR_TILE for .fz and RAWHDR_PLAIN for anything else.
+ */
+int rawhdr_compression(const char *path)
+{
+  size_t len;
+
+  len = strlen(path);
+  if (len > 3 && strcmp(path+len-3,".gz") == 0)
+    return RAWHDR_GZIP;
+  if (len > 3 && strcmp(path+len-3,".fz") == 0)
+    return RAWHDR_TILE;
+  return RAWHDR_PLAIN;
+}
+
+
+/* The next 2880 bytes of src. Returns 0, or 1 if there is not a whole block left */
+static int rawhdr_read_block(RawSource *src, char *block)
+{
+  ssize_t nread;
+
+  if (src->gz != NULL)
+    nread = gzread(src->gz,block,RAWHDR_BLOCK_LEN);
+  else
+    nread = pread(src->fd,block,RAWHDR_BLOCK_LEN,src->offset);
+  if (nread != RAWHDR_BLOCK_LEN)
+    return 1;
+
+  src->offset += nread;
+  src->nread += nread;
+  return 0;
+}
+
+
+/*
+ * Make room at the end of hdr->cards for one more block. Returns where it goes, or NULL
+ * if there is no memory. The block is only counted once rawhdr_add_block() has seen it.
+ */
+char *rawhdr_block_space(RawHeader *hdr)
+{
+  char *newcards;
+
+  newcards = (char *)realloc(hdr->cards,(hdr->ncards+RAWHDR_CARDS_PER_BLOCK)*RAWHDR_CARD_LEN);
+  if (newcards == NULL)
+    return NULL;
+  hdr->cards = newcards;
+  return hdr->cards+hdr->ncards*RAWHDR_CARD_LEN;
+}
+
+
+/*
+ * Add the block just read into rawhdr_block_space() to the cards of hdr. first is where
+ * in hdr->cards this header started. Its first card has to be SIMPLE for a primary header,
+ * XTENSION otherwise. Returns 0 if the block held the END card, RAWHDR_MORE if the header
+ * carries on into the next block, or END_OF_FILE if this is not a FITS header after all.
+ */
+int rawhdr_add_block(RawHeader *hdr, int first, int primary)
+{
+  const char *block;
+  int ii;
+
+  block = hdr->cards+hdr->ncards*RAWHDR_CARD_LEN;
+  if (hdr->ncards == first && strncmp(block,primary ? "SIMPLE  =" : "XTENSION=",9) != 0)
+    return END_OF_FILE;
+
+  ii = cardscan_find(block,RAWHDR_CARDS_PER_BLOCK,"END     ");
+  hdr->ncards += ii;
+  if (ii < RAWHDR_CARDS_PER_BLOCK)
+    return 0;
+
+  if (hdr->ncards-first >= RAWHDR_MAX_BLOCKS*RAWHDR_CARDS_PER_BLOCK)
+    return END_OF_FILE;
+  return RAWHDR_MORE;
+}
+
+
+/*
+ * Add the cards of the header which starts at the next block of src to hdr, stopping at
+ * the block containing END. Returns 0, or END_OF_FILE if there was no END.
+ */
+static int rawhdr_read_cards(RawSource *src, RawHeader *hdr, int primary)
+{
+  int first,status;
+  char *block;
+
+  first = hdr->ncards;
+  status = RAWHDR_MORE;
+  while (status == RAWHDR_MORE) {
+    block = rawhdr_block_space(hdr);
+    if (block == NULL || rawhdr_read_block(src,block))
+      return END_OF_FILE;
+    status = rawhdr_add_block(hdr,first,primary);
+  }
+
+  return status;
+}
+
+
+/* Size of the data unit after the primary header hdr, in whole blocks. -1 if it cannot tell */
+static off_t rawhdr_data_size(const RawHeader *hdr)
+{
+  char keyword[16];
+  int status,bitpix,naxis,axis,ii;
+  off_t size;
+
+  status = 0;
+  rawhdr_read_key(hdr,TINT,"BITPIX",&bitpix,&status);
+  rawhdr_read_key(hdr,TINT,"NAXIS",&naxis,&status);
+  if (status)
+    return -1;
+  if (naxis == 0)
+    return 0;
+
+  size = abs(bitpix)/8;
+  for (ii=1; ii<=naxis; ii++) {
+    sprintf(keyword,"NAXIS%d",ii);
+    if (rawhdr_read_key(hdr,TINT,keyword,&axis,&status))
+      return -1;
+    size *= axis;
+  }
+  return (size+RAWHDR_BLOCK_LEN-1)/RAWHDR_BLOCK_LEN*RAWHDR_BLOCK_LEN;
+}
+
+
+/*
+ * A tile compressed (fpack) file has an empty primary header and keeps the image, and
+ * its header, in a binary table extension marked ZIMAGE = T. src is just past the primary
+ * header in hdr. If the next HDU is such a table, its cards are put in front of the primary
+ * ones, so where a keyword is in both the image's own value is the one found first.
+ */
+static void rawhdr_read_tile_header(RawSource *src, RawHeader *hdr)
+{
+  RawHeader ext;
+  char *newcards;
+  off_t skip;
+  int status,zimage;
+
+  skip = rawhdr_data_size(hdr);
+  if (skip < 0)
+    return;
+  src->offset += skip;
+
+  ext.cards = NULL;
+  ext.ncards = 0;
+  ext.map = NULL;
+  status = 0;
+  zimage = 0;
+  if (rawhdr_read_cards(src,&ext,0) == 0)
+    rawhdr_read_key(&ext,TINT,"ZIMAGE",&zimage,&status);
+
+  if (status == 0 && zimage) {
+    newcards = (char *)realloc(ext.cards,(ext.ncards+hdr->ncards)*RAWHDR_CARD_LEN);
+    if (newcards != NULL) {
+      memcpy(newcards+ext.ncards*RAWHDR_CARD_LEN,hdr->cards,hdr->ncards*RAWHDR_CARD_LEN);
+      free(hdr->cards);
+      hdr->cards = newcards;
+      hdr->ncards += ext.ncards;
+      ext.cards = NULL;
+    }
+  }
+  rawhdr_close(&ext);
+}
+
+
+/*
+ * Read the primary header of path into hdr. Reading stops at the block containing END.
+ * A gzipped file is inflated only as far as that block, and a tile compressed one
+ * has the header of its compressed image added. See rawhdr_compression().
+ * With --pagecache=drop in io (which may be NULL) there is no readahead beyond the blocks read.
+ * Returns 0 on success or a FITSIO-like error: FILE_NOT_OPENED if the file cannot be
+ * opened, END_OF_FILE if it is not a FITS file or it ends before the END card.
+ */
+int rawhdr_open(const char *path, const IoPolicy *io, RawHeader *hdr)
+{
+  RawSource src;
+  int compression,status;
+
+  hdr->cards = NULL;
+  hdr->ncards = 0;
+  hdr->bytes_read = 0;
+  hdr->map = NULL;
+  hdr->map_len = 0;
+
+  src.gz = NULL;
+  src.offset = 0;
+  src.nread = 0;
+
+  src.fd = open(path,O_RDONLY);
+  if (src.fd < 0)
+    return FILE_NOT_OPENED;
+  iopolicy_no_readahead(io,src.fd);
+
+  /* gzclose() closes the fd as well */
+  compression = rawhdr_compression(path);
+  if (compression == RAWHDR_GZIP) {
+    src.gz = gzdopen(src.fd,"rb");
+    if (src.gz == NULL) {
+      close(src.fd);
+      return FILE_NOT_OPENED;
+    }
+    src.fd = -1;
+  }
+
+  status = rawhdr_read_cards(&src,hdr,1);
+  if (status == 0 && compression == RAWHDR_TILE)
+    rawhdr_read_tile_header(&src,hdr);
+
+  /* For a gzipped file, what came off the disk rather than what it inflated to */
+  if (src.gz != NULL) {
+    hdr->bytes_read = gzoffset(src.gz);
+    gzclose(src.gz);
+  }
+  else {
+    hdr->bytes_read = src.nread;
+    close(src.fd);
+  }
+
+  if (status) {
+    rawhdr_close(hdr);
+    return status;
+  }
+
+  return 0;
+}
+
+
+/*
+ * --reader=mmap. As rawhdr_open() for a plain file, but the first RAWHDR_MAP_BLOCKS blocks
+ * are mmap()ed and hdr->cards points straight at them, so the cards are looked at where
+ * they are in the page cache and never copied. If END is not among them the mapping is
+ * made twice as big, up to RAWHDR_MAX_BLOCKS, and the search carries on where it left off.
+ * Only whole blocks within the file are mapped, as touching a page past its end would
+ * raise SIGBUS. Compressed files have to go through rawhdr_open().
+ */
+int rawhdr_map(const char *path, const IoPolicy *io, RawHeader *hdr)
+{
+  struct stat st;
+  size_t nblocks,mapped,want;
+  void *map;
+  int fd,status;
+
+  hdr->cards = NULL;
+  hdr->ncards = 0;
+  hdr->bytes_read = 0;
+  hdr->map = NULL;
+  hdr->map_len = 0;
+
+  fd = open(path,O_RDONLY);
+  if (fd < 0)
+    return FILE_NOT_OPENED;
+  if (fstat(fd,&st) != 0) {
+    close(fd);
+    return FILE_NOT_OPENED;
+  }
+  nblocks = (size_t)MIN(st.st_size/RAWHDR_BLOCK_LEN,RAWHDR_MAX_BLOCKS);
+
+  status = RAWHDR_MORE;
+  while (status == RAWHDR_MORE) {
+    /* The next block has not been mapped yet */
+    mapped = hdr->map_len/RAWHDR_BLOCK_LEN;
+    if ((size_t)hdr->ncards/RAWHDR_CARDS_PER_BLOCK == mapped) {
+      if (mapped == nblocks) {
+	status = END_OF_FILE;
+	break;
+      }
+      want = MIN(mapped ? 2*mapped : RAWHDR_MAP_BLOCKS,nblocks);
+      if (hdr->map != NULL)
+	munmap(hdr->map,hdr->map_len);
+      hdr->map_len = 0;
+      map = mmap(NULL,want*RAWHDR_BLOCK_LEN,PROT_READ,MAP_SHARED,fd,0);
+      if (map == MAP_FAILED) {
+	hdr->map = NULL;
+	hdr->cards = NULL;
+	status = FILE_NOT_OPENED;
+	break;
+      }
+      hdr->map = map;
+      hdr->map_len = want*RAWHDR_BLOCK_LEN;
+      hdr->cards = (char *)map;
+#ifdef POSIX_MADV_RANDOM
+      /* The mmap() equivalent of iopolicy_no_readahead() */
+      if (io != NULL && io->drop)
+	posix_madvise(map,hdr->map_len,POSIX_MADV_RANDOM);
+#endif
+    }
+    status = rawhdr_add_block(hdr,0,1);
+  }
+
+  /* The blocks looked at, up to the one with END */
+  hdr->bytes_read = (long)(hdr->ncards/RAWHDR_CARDS_PER_BLOCK+1)*RAWHDR_BLOCK_LEN;
+  close(fd);
+
+  if (status) {
+    rawhdr_close(hdr);
+    return status;
+  }
+  return 0;
+}
+
+
+void rawhdr_close(RawHeader *hdr)
+{
+  if (hdr->map != NULL)
+    munmap(hdr->map,hdr->map_len);
+  else
+    free(hdr->cards);
+  hdr->cards = NULL;
+  hdr->ncards = 0;
+  hdr->map = NULL;
+  hdr->map_len = 0;
+}
+
+
+/*
+ * Find the card for keyword. Returns a pointer to the 80 characters of the card, which
+ * are not \0 terminated, or NULL if the keyword is not in the header.
+ */
+const char *rawhdr_find_card(const RawHeader *hdr, const char *keyword)
+{
+  char padded[8];
+  int ii,len;
+
+  /* Keywords are blank padded to 8 characters on the card */
+  len = strlen(keyword);
+  if (len > 8)
+    return NULL;
+  memset(padded,' ',8);
+  memcpy(padded,keyword,len);
+
+  ii = cardscan_find(hdr->cards,hdr->ncards,padded);
+  if (ii == hdr->ncards)
+    return NULL;
+  return hdr->cards+ii*RAWHDR_CARD_LEN;
+}
+
+
+/*
+ * Pull the value field out of a card. The same as cFITSIO's ffgkey(), i.e.
+ * a string value keeps its quotes, anything else is trimmed of blanks and stops
+ * at the comment '/'. Cards without "= " in columns 9-10 have no value, so give "".
+ */
+void rawhdr_card_value(const char *card, char *value)
+{
+  int start,len;
+
+  start = cardscan_value(card,&len);
+  memcpy(value,card+start,len);
+  value[len] = '\0';
+}
+
+
+/*
+ * Convert a card value (as given by rawhdr_card_value) to a string. Same as cFITSIO ffc2s():
+ * quotes removed, '' unescaped and trailing blanks dropped. An unquoted value is copied as is.
+ */
+static int rawhdr_c2s(const char *instr, char *outstr, int *status)
+{
+  int ii,len;
+
+  if (*status > 0)
+    return *status;
+
+  if (instr[0] != '\'') {
+    if (instr[0] == '\0') {
+      outstr[0] = '\0';
+      return (*status = VALUE_UNDEFINED);
+    }
+    strcpy(outstr,instr);
+    return *status;
+  }
+
+  len = 0;
+  for (ii=1; instr[ii]!='\0'; ii++) {
+    if (instr[ii] == '\'') {
+      if (instr[ii+1] == '\'')
+	ii++;
+      else
+	break;
+    }
+    outstr[len++] = instr[ii];
+  }
+  while (len > 0 && outstr[len-1] == ' ')
+    len--;
+  outstr[len] = '\0';
+
+  return *status;
+}
+
+
+/*
+ * The value of a card as a string, as ffgkys() would give it. Does nothing if *status
+ * is already set.
+ */
+int rawhdr_card_string(const char *card, char *value, int *status)
+{
+  char valstring[RAWHDR_CARD_LEN+1];
+
+  if (*status > 0)
+    return *status;
+
+  rawhdr_card_value(card,valstring);
+  value[0] = '\0';
+  return rawhdr_c2s(valstring,value,status);
+}
+
+
+/*
+ * The value of a card converted to datatype, as ffgky() would give it, for the datatypes
+ * autolog uses: TSTRING, TINT, TFLOAT and TDOUBLE. As in cFITSIO, a quoted number is still
+ * converted and a value which does not convert still gets whatever strtod() made of it,
+ * along with BAD_C2I, BAD_C2F or BAD_C2D.
+ */
+int rawhdr_card_key(const char *card, int datatype, void *value, int *status)
+{
+  char valstring[RAWHDR_CARD_LEN+1],numstring[RAWHDR_CARD_LEN+1];
+  char *endptr,*dd;
+  double dval;
+  int bad;
+
+  if (*status > 0)
+    return *status;
+
+  if (datatype == TSTRING)
+    return rawhdr_card_string(card,(char *)value,status);
+
+  rawhdr_card_value(card,valstring);
+  if (valstring[0] == '\0')
+    return (*status = VALUE_UNDEFINED);
+
+  if (valstring[0] == '\'')
+    rawhdr_c2s(valstring,numstring,status);
+  else
+    strcpy(numstring,valstring);
+
+  if (strcmp(numstring,"T") == 0) {
+    dval = 1;
+    bad = 0;
+  }
+  else if (strcmp(numstring,"F") == 0) {
+    dval = 0;
+    bad = 0;
+  }
+  else {
+    /* FITS allows a Fortran style D exponent */
+    dd = strchr(numstring,'D');
+    if (dd != NULL) *dd = 'E';
+    dval = strtod(numstring,&endptr);
+    bad = (endptr == numstring) || (*endptr != '\0' && *endptr != ' ');
+  }
+
+  switch (datatype) {
+    case TINT:
+      *(int *)value = (int)dval;
+      if (bad) *status = BAD_C2I;
+      break;
+    case TFLOAT:
+      *(float *)value = (float)dval;
+      if (bad) *status = BAD_C2F;
+      break;
+    case TDOUBLE:
+      *(double *)value = dval;
+      if (bad) *status = BAD_C2D;
+      break;
+    default:
+      *status = BAD_DATATYPE;
+      break;
+  }
+
+  return *status;
+}
+
+
+/*
+ * Equivalent of ffgkys(). Reads a string keyword. Does nothing if *status is already set.
+ */
+int rawhdr_read_string(const RawHeader *hdr, const char *keyword, char *value, int *status)
+{
+  const char *card;
+
+  if (*status > 0)
+    return *status;
+
+  card = rawhdr_find_card(hdr,keyword);
+  if (card == NULL) {
+    value[0] = '\0';
+    return (*status = KEY_NO_EXIST);
+  }
+  return rawhdr_card_string(card,value,status);
+}
+
+
+/*
+ * Equivalent of ffgky(). See rawhdr_card_key() for the datatypes.
+ */
+int rawhdr_read_key(const RawHeader *hdr, int datatype, const char *keyword, void *value, int *status)
+{
+  const char *card;
+
+  if (*status > 0)
+    return *status;
+
+  if (datatype == TSTRING)
+    return rawhdr_read_string(hdr,keyword,(char *)value,status);
+
+  card = rawhdr_find_card(hdr,keyword);
+  if (card == NULL)
+    return (*status = KEY_NO_EXIST);
+  return rawhdr_card_key(card,datatype,value,status);
+}
@@ -0,0 +1,317 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+The --red-report option. red_report.c walks the directory exactly as autolog does and
+opens every FITS file again, just to read INSTRUME, FILTERI1/2 and the L1STATOV/DA/FL
+flags. With --red-report those keywords are picked out of the header autolog is reading
+anyway (they are in the schema's perfect hash, like DATE-OBS), kept in the LogJob, and
+red_report.log and the report on the screen are written from them once the night is read.
+
+The output is what red_report gives, quirks and all:
+ - every name in the listing gets a line, in the order the directory lists them, so
+   dirscan_read() keeps the names it would otherwise drop on sight
+ - only names ending in exactly .fits are read, so .fits.gz frames are reported by
+   their extension
+ - an unreduced frame is skipped only if the _1 version of it is there. red_report looked
+   for that in the current directory; this looks in the listing, which is the same thing
+   when red_report is run from the night's directory
+ - a frame which is skipped or fails to open is shown with the INSTRUME and filters of
+   the frame before it, and once INSTRUME or FILTERI1 is missing the filters are not read
+So that these all come out the same, red_report.log is created before the directory
+is read, just as red_report creates it before its first readdir().
+
+Frames red_report would read but autolog does not (a _1 with a _2 alongside it, say)
+are read anyway, for the report only. They never reach the log.
+*/
+
+#define _ISOC99_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+/* The keywords red_report reads, in the order it reads them. See ReportValues */
+const char *report_keywords[REPORT_NKEYWORDS] = {
+  "INSTRUME","FILTERI1","FILTERI2","L1STATOV","L1STATDA","L1STATFL"
+};
+
+/* What check_header_flag() in red_report.c says it is checking */
+static const char *report_tasks[REPORT_NFLAGS] = {
+  "Overscan subtraction","Dark frame subtraction","Flatfielding"
+};
+
+
+/*
+ * ffgkys() on the card for keyword kk, as red_report.c calls it: nothing happens if
+ * *status is already set, and value is emptied before a missing keyword is reported.
+ */
+static void report_string(const Schema *schema, const char **found, int kk, char *value, int *status)
+{
+  const char *card;
+
+  if (*status > 0)
+    return;
+  card = found[schema->report[kk]];
+  value[0] = '\0';
+  if (card == NULL)
+    *status = KEY_NO_EXIST;
+  else
+    rawhdr_card_string(card,value,status);
+}
+
+
+/*
+ * Keep what red_report would read from this header, from the cards found by
+ * schema_match(). Called by extract_cards() for every file, so that the --cache
+ * has it whether or not this run is making the report.
+ */
+void report_extract(const Schema *schema, const char **found, ReportValues *report)
+{
+  char value[RAWHDR_CARD_LEN+1],filter1[RAWHDR_CARD_LEN+1],filter2[RAWHDR_CARD_LEN+1];
+  const char *card;
+  int status,ii;
+
+  status = 0;
+  report_string(schema,found,0,value,&status);
+  snprintf(report->instrume,sizeof(report->instrume),"%s",value);
+  report_string(schema,found,1,filter1,&status);
+  report_string(schema,found,2,filter2,&status);
+  report->status = status;
+  report->filters[0] = '\0';
+  if (status == 0)
+    snprintf(report->filters,sizeof(report->filters),"%s %s",filter1,filter2);
+
+  /* Each flag is read with a status of its own */
+  for (ii=0; ii<REPORT_NFLAGS; ii++) {
+    card = found[schema->report[3+ii]];
+    report->flag[ii] = 0;
+    report->flag_status[ii] = 0;
+    if (card == NULL)
+      report->flag_status[ii] = KEY_NO_EXIST;
+    else
+      rawhdr_card_key(card,TINT,&report->flag[ii],&report->flag_status[ii]);
+  }
+}
+
+
+/* FNV-1a, as dirscan_hash() */
+static unsigned int report_hash(const char *str)
+{
+  unsigned int hash = 2166136261u;
+
+  while (*str) {
+    hash ^= (unsigned char)*str++;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+
+/*
+ * Decide which entries of scan red_report would read, and set entry->report to
+ * REPORT_READ or REPORT_REDUCED for each. Call it after dirscan_read(), with the
+ * whole listing kept, and before anything else looks at the entries.
+ * Returns 0, or 1 if out of memory.
+ */
+int report_plan(DirScan *scan)
+{
+  LTFileName cur,reduced;
+  char name[FILENAME_LENGTH+16];
+  int *table;
+  unsigned int tablesize,ii,slot;
+  DirEntry *entry;
+
+  /* Open addressing on the names, to see whether each _1 is there */
+  tablesize = 64;
+  while (tablesize < 2*scan->nentries)
+    tablesize *= 2;
+  table = (int *)malloc(tablesize*sizeof(int));
+  if (table == NULL)
+    return 1;
+  for (ii=0; ii<tablesize; ii++)
+    table[ii] = -1;
+  for (ii=0; ii<scan->nentries; ii++) {
+    slot = report_hash(dirscan_name(scan,ii)) & (tablesize-1);
+    while (table[slot] >= 0)
+      slot = (slot+1) & (tablesize-1);
+    table[slot] = ii;
+  }
+
+  for (ii=0; ii<scan->nentries; ii++) {
+    entry = &scan->entries[ii];
+    entry->report = REPORT_NONE;
+    /* dirscan_read() kept no more of a name than whether it understood it, and did not
+     * chop those it kept only for this. night_scan() skips those, so one red_report would
+     * read, a directory called .fits say, fails to open */
+    if (!entry->wanted || entry->lt_ok)
+      entry->lt_ok = (dirscan_chop(scan,ii,&cur) == 0);
+    if (!entry->lt_ok || strcmp(cur.ext,"fits") != 0)
+      continue;
+    entry->report = REPORT_READ;
+    if (cur.p[0] != '0')
+      continue;
+
+    reduced = cur;
+    reduced.p[0] = '1';
+    construct_filename(&reduced,name);
+    slot = report_hash(name) & (tablesize-1);
+    while (table[slot] >= 0 && strcmp(dirscan_name(scan,table[slot]),name) != 0)
+      slot = (slot+1) & (tablesize-1);
+    if (table[slot] >= 0)
+      entry->report = REPORT_REDUCED;
+  }
+
+  free(table);
+  return 0;
+}
+
+
+/* check_header_flag() of red_report.c, for flag ii of a file which was opened */
+static void report_flag(FILE *log, FILE *out, const ReportValues *report, int ii)
+{
+  fprintf(out,"%s : ",report_tasks[ii]);
+  if (report->flag_status[ii] == VALUE_UNDEFINED || report->flag_status[ii] == KEY_NO_EXIST) {
+    fprintf(out,"File has not been reduced\n");
+    fprintf(log,"File has not been reduced\n");
+    return;
+  }
+  switch (report->flag[ii]) {
+    case 1:
+      fprintf(out,"Done\n");
+      fprintf(log,"Done\n");
+      break;
+    case -1:
+      fprintf(out,"Not requested\n");
+      fprintf(log,"Not requested\n");
+      break;
+    case 0:
+      fprintf(out,"Pending. This seems improbable. Is it an error?\n");
+      fprintf(log,"Pending. This seems improbable. Is it an error?\n");
+      break;
+    default:
+      if (report->flag[ii] > 0) {
+	fprintf(out,"Non-");
+	fprintf(log,"Non-");
+      }
+      fprintf(out,"Critical error during operation : %d",report->flag[ii]);
+      fprintf(log,"Critical error during operation : %d",report->flag[ii]);
+      break;
+  }
+}
+
+
+/*
+ * Write run's reduction status report, from run->scan and the jobs its entries point at,
+ * to red_report.log (run->report) and out, just as red_report would have written them to
+ * red_report.log and the screen. Every job must have been read.
+ */
+void report_write(const LogRun *run, FILE *out)
+{
+  char instrument[FLEN_VALUE],filters[2*FLEN_VALUE],reduced_name[FILENAME_LENGTH+16];
+  const DirEntry *entry;
+  const LogJob *job;
+  LTFileName cur,reduced;
+  FILE *log;
+  unsigned int ii,filect,badfilect;
+  int fits_stat,skip_this_file,opened,kk;
+
+  log = run->report;
+  instrument[0] = filters[0] = '\0';
+  filect = badfilect = 0;
+
+  for (ii=0; ii<run->scan.nentries; ii++) {
+    entry = &run->scan.entries[ii];
+    fprintf(out,"%s ",dirscan_name(&run->scan,ii));
+
+    if (!entry->lt_ok) {
+      fprintf(log,"Not an LT file name (%d): %s\n",31,dirscan_name(&run->scan,ii));
+      fprintf(out,"Not an LT file name (%d): %s\n",31,dirscan_name(&run->scan,ii));
+      badfilect++;
+      continue;
+    }
+    dirscan_chop(&run->scan,ii,&cur);
+    if (entry->report == REPORT_NONE) {
+      fprintf(out,"Extension is %s\n",cur.ext);
+      continue;
+    }
+
+    fits_stat = 0;
+    skip_this_file = 0;
+    if (cur.p[0] == '0') {
+      reduced = cur;
+      reduced.p[0] = '1';
+      construct_filename(&reduced,reduced_name);
+      fprintf(log,"File %s may not have been reduced. Checking to see if %s exists\n",cur.exposure,reduced_name);
+      if (entry->report == REPORT_REDUCED) {
+	fprintf(log,"Reduced data is available, so we will ignore this file.\n");
+	skip_this_file = 1;
+	fits_stat = 1;
+      }
+      else
+	fprintf(log,"No obviously reduced data exists, so we will give this file a try.\n");
+    }
+
+    opened = 0;
+    job = entry->job;
+    if (!skip_this_file) {
+      if (job == NULL || job->status == 41) {
+	fprintf(log,"Failed to open FITS (%d)- %s\n",41,cur.exposure);
+	fprintf(out,"Failed to open FITS (%d)- %s\n",41,cur.exposure);
+	badfilect++;
+	fits_stat = 1;
+      }
+      else
+	opened = 1;
+    }
+
+    /* A file which was not opened leaves the last one's values where they were */
+    if (opened) {
+      strcpy(instrument,job->report.instrume);
+      fits_stat = job->report.status;
+    }
+    fprintf(out,"(%s) ",instrument);
+    if (opened) {
+      for (kk=0; kk<REPORT_NFLAGS; kk++)
+	report_flag(log,out,&job->report,kk);
+    }
+    if (opened && fits_stat == 0)
+      strcpy(filters,job->report.filters);
+    fprintf(out,"Filters: %s\n",filters);
+
+    /* Closing the file only sets the status if nothing else had */
+    if (opened && fits_stat == 0)
+      fits_stat = job->status;
+    if (fits_stat && !skip_this_file)
+      fprintf(log,"A FITSIO error has occured: %d\n",fits_stat);
+    if (!skip_this_file) {
+      fprintf(log,"Finished with %s\n",cur.exposure);
+      filect++;
+    }
+  }
+
+  fprintf(log,"%5d files successfully read into log\n",filect);
+  fprintf(log,"%5d bad files not read\n",badfilect);
+  fflush(out);
+}
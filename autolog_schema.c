@@ -0,0 +1,647 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+The keyword schema. Which FITS keywords go into which column of the log, what type they
+are, what to try if a keyword is missing and what to put if nothing is found, all in one
+table instead of spread through extract_LogInfo() as a separate read of the header for
+every keyword and every fallback.
+
+The table is plain text, one column per line:
+
+  # column  type    keywords                default     options
+  object    string  CAT-NAME,OBJECT         -           underscore
+  groupid   string  GROUPID                 Unknown     underscore
+  rotskypa  float   ROTSKYPA                -           unit=deg
+
+type is string, double, float or int. keywords are tried in turn and the first one in the
+header wins (for a string, the first one which is not blank). A default of - means the
+column is left as night_init_LogInfo() set it. Values containing blanks go in double quotes.
+The options are
+	dprt		Only read from frames which have been through Dp(RT)
+	underscore	Blanks in the value become '_'
+	space		A blank is appended to the value (the GRATING column)
+	filters		Join all the keywords with ',', leaving out Clear and NONE
+	l1stat		Dp(RT) error flags. See SCHEMA_RULE_L1STAT
+	unit=...	Unit of the column in the FITS table
+Columns named after a field of LogInfo (see log_fields[]) fill that field. Any other name
+is a new column, kept in LogInfo.extra, which the --format writers and --sort know about
+but the fixed width text log does not show.
+
+schema_builtin[] below is the table autolog has always used. --schema=FILE replaces it.
+
+Once the table is loaded, every distinct keyword is put in a perfect hash: the 8 keyword
+characters of a card, taken as a 64 bit number, are multiplied by a constant picked so that
+the top bits are different for every keyword in the table. Matching a header is then one
+walk over its cards, with a multiply, a shift and a compare for each, however many columns
+there are.
+*/
+
+#define _ISOC99_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+
+/* Multipliers tried for each size of hash table before trying a bigger one */
+#define SCHEMA_HASH_TRIES	1000
+
+static const char *schema_builtin[] = {
+  "# column  type    keywords                   default                 options",
+  "utstart   string  UTSTART",
+  "object    string  CAT-NAME,OBJECT            -                       underscore",
+  "propid    string  PROPID",
+  "ra        string  RA",
+  "dec       string  DEC",
+  "airmass   float   AIRMASS",
+  "instrume  string  INSTRUME",
+  "filter    string  FILTER1,FILTER2,FILTER3    Error_reading_FITS      filters",
+  "binning   int     CCDXBIN",
+  "grating   string  GRATID                     \" NA \"                  space",
+  "exptime   float   EXPTIME",
+  "l1seeing  float   L1SEESEC,L1SEEING          -                       dprt",
+  "l1skybrt  float   SCHEDSKY                   -                       dprt",
+  "exposure  string  -",
+  "groupid   string  GROUPID                    Unknown                 underscore",
+  "error     int     L1STATOV,L1STATZE,L1STATTR,L1STATFL,L1STATDA,L1STATFR  -  dprt,l1stat",
+  "mjd       double  MJD",
+  "l1photom  float   L1PHOTOM                   -                       dprt",
+  NULL
+};
+
+/* Indexed by LOG_FIELD_* */
+static const char *schema_type_names[] = {"string","double","float","int"};
+static const int schema_fits_types[] = {TSTRING,TDOUBLE,TFLOAT,TINT};
+
+
+/* FNV-1a, carried on from *sum */
+static void schema_checksum(unsigned int *sum, const char *str)
+{
+  while (*str) {
+    *sum ^= (unsigned char)*str++;
+    *sum *= 16777619u;
+  }
+  /* Keep "ab","c" different from "a","bc" */
+  *sum ^= 0xff;
+  *sum *= 16777619u;
+}
+
+
+/*
+ * Split line into blank separated tokens, in place. A token in double quotes may contain
+ * blanks. A # at the start of a token ends the line.
+ * Returns the number of tokens, or -1 for an unmatched quote or too many tokens.
+ */
+static int schema_tokens(char *line, char **tokens, int maxtokens)
+{
+  int ntokens;
+  char *ptr;
+
+  ntokens = 0;
+  ptr = line;
+  while (1) {
+    while (*ptr == ' ' || *ptr == '\t' || *ptr == '\r' || *ptr == '\n')
+      ptr++;
+    if (*ptr == '\0' || *ptr == '#')
+      return ntokens;
+    if (ntokens == maxtokens)
+      return -1;
+
+    if (*ptr == '"') {
+      tokens[ntokens++] = ++ptr;
+      ptr = strchr(ptr,'"');
+      if (ptr == NULL)
+	return -1;
+    }
+    else {
+      tokens[ntokens++] = ptr;
+      while (*ptr && *ptr != ' ' && *ptr != '\t' && *ptr != '\r' && *ptr != '\n')
+	ptr++;
+      if (*ptr == '\0')
+	return ntokens;
+    }
+    *ptr++ = '\0';
+  }
+}
+
+
+/*
+ * Index of keyword in schema->keywords, adding it if it is new.
+ * Returns -1 if it is not a valid keyword or there are too many.
+ */
+static int schema_keyword(Schema *schema, const char *keyword)
+{
+  char padded[9];
+  int ii,len;
+
+  len = strlen(keyword);
+  if (len == 0 || len > 8)
+    return -1;
+  memset(padded,' ',8);
+  padded[8] = '\0';
+  for (ii=0; ii<len; ii++)
+    padded[ii] = toupper((unsigned char)keyword[ii]);
+
+  for (ii=0; ii<schema->nkeywords; ii++) {
+    if (strcmp(schema->keywords[ii],padded) == 0)
+      return ii;
+  }
+  if (schema->nkeywords == SCHEMA_MAX_KEYWORDS)
+    return -1;
+  strcpy(schema->keywords[schema->nkeywords],padded);
+  return schema->nkeywords++;
+}
+
+
+/*
+ * One line of the table. where and lineno are only for the error messages.
+ * Returns 0, or 1 if the line is wrong. What is wrong is printed.
+ */
+static int schema_parse_line(Schema *schema, char *line, const char *where, int lineno)
+{
+  char *tokens[6],*ptr,*comma,*endptr;
+  SchemaColumn *col;
+  const LogField *builtin;
+  int ntokens,ii,type;
+
+  ntokens = schema_tokens(line,tokens,6);
+  if (ntokens == 0)
+    return 0;
+  if (ntokens < 3 || ntokens > 5) {
+    printf("%s line %d: expected column type keywords [default] [options]\n",where,lineno);
+    return 1;
+  }
+  for (ii=0; ii<ntokens; ii++)
+    schema_checksum(&schema->checksum,tokens[ii]);
+
+  if (schema->ncolumns == SCHEMA_MAX_COLUMNS) {
+    printf("%s line %d: no more than %d columns\n",where,lineno,SCHEMA_MAX_COLUMNS);
+    return 1;
+  }
+  col = &schema->columns[schema->ncolumns];
+  memset(col,0,sizeof(SchemaColumn));
+
+  /* Column name */
+  if (strlen(tokens[0]) >= sizeof(col->name)) {
+    printf("%s line %d: column name %s is too long\n",where,lineno,tokens[0]);
+    return 1;
+  }
+  for (ii=0; ii<schema->ncolumns; ii++) {
+    if (strcmp(schema->columns[ii].name,tokens[0]) == 0) {
+      printf("%s line %d: column %s is given twice\n",where,lineno,tokens[0]);
+      return 1;
+    }
+  }
+  strcpy(col->name,tokens[0]);
+
+  /* Type */
+  for (type=0; type<4; type++) {
+    if (strcmp(tokens[1],schema_type_names[type]) == 0)
+      break;
+  }
+  if (type == 4) {
+    printf("%s line %d: type %s is not string, double, float or int\n",where,lineno,tokens[1]);
+    return 1;
+  }
+
+  /* Either one of the fields LogInfo already has, or one of the extras */
+  builtin = log_field_find(col->name);
+  if (builtin != NULL) {
+    if (builtin->type != type) {
+      printf("%s line %d: column %s has to be a %s\n",where,lineno,col->name,schema_type_names[builtin->type]);
+      return 1;
+    }
+    col->field = *builtin;
+    strcpy(col->unit,builtin->unit);
+  }
+  else {
+    if (schema->nextra == SCHEMA_MAX_EXTRA) {
+      printf("%s line %d: no more than %d new columns\n",where,lineno,SCHEMA_MAX_EXTRA);
+      return 1;
+    }
+    col->field.type = type;
+    col->field.offset = offsetof(LogInfo,extra) + schema->nextra*sizeof(LogExtra);
+    switch (type) {
+    case LOG_FIELD_STRING:	col->field.size = SCHEMA_EXTRA_LEN; break;
+    case LOG_FIELD_DOUBLE:	col->field.size = sizeof(double); break;
+    case LOG_FIELD_FLOAT:	col->field.size = sizeof(float); break;
+    default:			col->field.size = sizeof(int); break;
+    }
+    schema->nextra++;
+  }
+
+  /* Keywords, most wanted first */
+  if (strcmp(tokens[2],"-") == 0) {
+    if (builtin == NULL) {
+      printf("%s line %d: new column %s needs at least one keyword\n",where,lineno,col->name);
+      return 1;
+    }
+  }
+  else {
+    for (ptr=tokens[2]; ptr!=NULL; ptr=comma) {
+      comma = strchr(ptr,',');
+      if (comma)
+	*comma++ = '\0';
+      if (col->nkeywords == SCHEMA_MAX_CHAIN) {
+	printf("%s line %d: no more than %d keywords in a column\n",where,lineno,SCHEMA_MAX_CHAIN);
+	return 1;
+      }
+      col->keywords[col->nkeywords] = schema_keyword(schema,ptr);
+      if (col->keywords[col->nkeywords] < 0) {
+	printf("%s line %d: bad keyword %s, or too many keywords\n",where,lineno,ptr);
+	return 1;
+      }
+      col->nkeywords++;
+    }
+  }
+
+  /* Default */
+  if (ntokens > 3 && strcmp(tokens[3],"-") != 0) {
+    if (strlen(tokens[3]) >= sizeof(col->dflt)) {
+      printf("%s line %d: default %s is too long\n",where,lineno,tokens[3]);
+      return 1;
+    }
+    strcpy(col->dflt,tokens[3]);
+    if (type != LOG_FIELD_STRING) {
+      col->dflt_num = strtod(col->dflt,&endptr);
+      if (endptr == col->dflt || *endptr != '\0') {
+	printf("%s line %d: default %s is not a number\n",where,lineno,col->dflt);
+	return 1;
+      }
+    }
+    col->has_default = 1;
+  }
+
+  /* Options */
+  if (ntokens > 4 && strcmp(tokens[4],"-") != 0) {
+    for (ptr=tokens[4]; ptr!=NULL; ptr=comma) {
+      comma = strchr(ptr,',');
+      if (comma)
+	*comma++ = '\0';
+      if (strcmp(ptr,"dprt") == 0)
+	col->dprt = 1;
+      else if (strcmp(ptr,"underscore") == 0 && type == LOG_FIELD_STRING)
+	col->underscore = 1;
+      else if (strcmp(ptr,"space") == 0 && type == LOG_FIELD_STRING)
+	col->space = 1;
+      else if (strcmp(ptr,"filters") == 0 && type == LOG_FIELD_STRING)
+	col->rule = SCHEMA_RULE_FILTERS;
+      else if (strcmp(ptr,"l1stat") == 0 && type == LOG_FIELD_INT)
+	col->rule = SCHEMA_RULE_L1STAT;
+      else if (strncmp(ptr,"unit=",5) == 0 && strlen(ptr+5) < sizeof(col->unit))
+	strcpy(col->unit,ptr+5);
+      else {
+	printf("%s line %d: option %s is not known, or not for a %s column\n",where,lineno,ptr,schema_type_names[type]);
+	return 1;
+      }
+    }
+  }
+
+  col->field.name = col->name;
+  col->field.unit = col->unit;
+  schema->ncolumns++;
+  return 0;
+}
+
+
+/* The next of a sequence of 64 bit numbers (Knuth's MMIX generator) */
+static uint64_t schema_next_mult(uint64_t *state)
+{
+  *state = *state * (((uint64_t)0x5851f42d << 32) | 0x4c957f2d)
+    + (((uint64_t)0x14057b7e << 32) | 0xf767814f);
+  /* The low bits of an LCG are poor, so use the top half twice. Has to be odd */
+  return ((*state >> 32) << 32 | (*state >> 32)) | 1;
+}
+
+
+/*
+ * Find a multiplier which puts every keyword in a slot of its own, using the smallest
+ * table which will do. Returns 0, or 1 if none was found.
+ */
+static int schema_build_hash(Schema *schema)
+{
+  uint64_t keys[SCHEMA_MAX_KEYWORDS];
+  uint64_t state,mult;
+  unsigned int slot;
+  int bits,nslots,tries,ii;
+
+  for (ii=0; ii<schema->nkeywords; ii++)
+    memcpy(&keys[ii],schema->keywords[ii],8);
+
+  /* Start with the table at most half full */
+  bits = 1;
+  while ((1 << bits) < 2*schema->nkeywords)
+    bits++;
+
+  state = 1;
+  for ( ; bits<=SCHEMA_MAX_HASH_BITS; bits++) {
+    nslots = 1 << bits;
+    free(schema->hash_keys);
+    free(schema->hash_index);
+    schema->hash_keys = (uint64_t *)malloc(nslots*sizeof(uint64_t));
+    schema->hash_index = (short *)malloc(nslots*sizeof(short));
+    if (schema->hash_keys == NULL || schema->hash_index == NULL)
+      return 1;
+
+    for (tries=0; tries<SCHEMA_HASH_TRIES; tries++) {
+      mult = schema_next_mult(&state);
+      for (ii=0; ii<nslots; ii++)
+	schema->hash_index[ii] = -1;
+      for (ii=0; ii<schema->nkeywords; ii++) {
+	slot = (unsigned int)((keys[ii]*mult) >> (64-bits));
+	if (schema->hash_index[slot] >= 0)
+	  break;
+	schema->hash_index[slot] = ii;
+	schema->hash_keys[slot] = keys[ii];
+      }
+      if (ii == schema->nkeywords) {
+	schema->hash_mult = mult;
+	schema->hash_shift = 64-bits;
+	return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+
+/*
+ * Load the schema from the file path, or the built in one if path is NULL, and build the
+ * perfect hash for its keywords.
+ * Returns 0, or 1 if the schema could not be used. Why not is printed.
+ */
+int schema_load(const char *path, Schema *schema)
+{
+  FILE *fp;
+  char line[1024];
+  int lineno,ii;
+
+  schema->ncolumns = 0;
+  schema->nextra = 0;
+  schema->nkeywords = 0;
+  schema->hash_keys = NULL;
+  schema->hash_index = NULL;
+  schema->checksum = 2166136261u;
+
+  if (path == NULL) {
+    for (lineno=0; schema_builtin[lineno]!=NULL; lineno++) {
+      strcpy(line,schema_builtin[lineno]);
+      if (schema_parse_line(schema,line,"built in schema",lineno+1))
+	return 1;
+    }
+  }
+  else {
+    fp = fopen(path,"r");
+    if (fp == NULL) {
+      printf("Could not open schema file %s\n",path);
+      return 1;
+    }
+    lineno = 0;
+    while (fgets(line,sizeof(line),fp)) {
+      lineno++;
+      if (schema_parse_line(schema,line,path,lineno)) {
+	fclose(fp);
+	return 1;
+      }
+    }
+    fclose(fp);
+    if (schema->ncolumns == 0) {
+      printf("%s has no columns in it\n",path);
+      return 1;
+    }
+  }
+
+  for (ii=0; ii<schema->ncolumns; ii++)
+    schema->fields[ii] = schema->columns[ii].field;
+
+  /* Not a column, but always wanted. See extract_LogInfo() */
+  schema->dateobs = schema_keyword(schema,"DATE-OBS");
+  if (schema->dateobs < 0) {
+    printf("Too many keywords in the schema\n");
+    return 1;
+  }
+  /* Nor are these, but --red-report wants them. See report_extract() */
+  for (ii=0; ii<REPORT_NKEYWORDS; ii++) {
+    schema->report[ii] = schema_keyword(schema,report_keywords[ii]);
+    if (schema->report[ii] < 0) {
+      printf("Too many keywords in the schema\n");
+      return 1;
+    }
+  }
+
+  if (schema_build_hash(schema)) {
+    printf("Could not build the keyword hash for the schema\n");
+    return 1;
+  }
+  return 0;
+}
+
+
+void schema_free(Schema *schema)
+{
+  free(schema->hash_keys);
+  free(schema->hash_index);
+  schema->hash_keys = NULL;
+  schema->hash_index = NULL;
+}
+
+
+/* The column called name, or failing that any field of LogInfo called name, or NULL */
+const LogField *schema_field_find(const Schema *schema, const char *name)
+{
+  int ii;
+
+  for (ii=0; ii<schema->ncolumns; ii++) {
+    if (strcmp(name,schema->fields[ii].name) == 0)
+      return &schema->fields[ii];
+  }
+  return log_field_find(name);
+}
+
+
+/*
+ * The one walk over the header. ncards cards of 80 characters start at cards.
+ * found[ii] is left pointing at the first card for schema->keywords[ii], or NULL.
+ * found must have room for schema->nkeywords.
+ */
+void schema_match(const Schema *schema, const char *cards, int ncards, const char **found)
+{
+  uint64_t key;
+  unsigned int slot;
+  int ii,kk;
+
+  for (ii=0; ii<schema->nkeywords; ii++)
+    found[ii] = NULL;
+
+  for (ii=0; ii<ncards; ii++, cards+=RAWHDR_CARD_LEN) {
+    memcpy(&key,cards,8);
+    slot = (unsigned int)((key*schema->hash_mult) >> schema->hash_shift);
+    kk = schema->hash_index[slot];
+    if (kk >= 0 && schema->hash_keys[slot] == key && found[kk] == NULL)
+      found[kk] = cards;
+  }
+}
+
+
+/* The string value of card into value, which has room for a whole card. 1 if it is not blank */
+static int schema_string(const char *card, char *value)
+{
+  int status;
+
+  status = 0;
+  value[0] = '\0';
+  if (card == NULL || rawhdr_card_string(card,value,&status))
+    return 0;
+  return (value[0] != '\0');
+}
+
+
+/* The numeric value of card into value, a double, float or int as type. 1 if it converted */
+static int schema_number(const char *card, int type, void *value)
+{
+  int status;
+
+  status = 0;
+  if (card == NULL)
+    return 0;
+  return (rawhdr_card_key(card,schema_fits_types[type],value,&status) == 0);
+}
+
+
+static void schema_store_string(const SchemaColumn *col, char *dest, char *value)
+{
+  char *ptr;
+
+  if (col->underscore) {
+    for (ptr=value; *ptr; ptr++) {
+      if (*ptr == ' ')
+	*ptr = '_';
+    }
+  }
+  snprintf(dest,col->field.size,"%s%s",value,col->space ? " " : "");
+}
+
+
+static void schema_store_default(const SchemaColumn *col, char *dest)
+{
+  double dval;
+  float fval;
+  int ival;
+
+  switch (col->field.type) {
+  case LOG_FIELD_STRING:
+    snprintf(dest,col->field.size,"%s",col->dflt);
+    break;
+  case LOG_FIELD_DOUBLE:
+    dval = col->dflt_num;
+    memcpy(dest,&dval,sizeof(dval));
+    break;
+  case LOG_FIELD_FLOAT:
+    fval = (float)col->dflt_num;
+    memcpy(dest,&fval,sizeof(fval));
+    break;
+  default:
+    ival = (int)col->dflt_num;
+    memcpy(dest,&ival,sizeof(ival));
+    break;
+  }
+}
+
+
+/*
+ * Fill in info from the cards found by schema_match(). info must already have been
+ * through night_init_LogInfo(). Columns marked dprt are left alone if no_dprt is set.
+ */
+void schema_extract(const Schema *schema, const char **found, int no_dprt, LogInfo *info)
+{
+  const SchemaColumn *col;
+  char value[RAWHDR_CARD_LEN+1];
+  char joined[SCHEMA_MAX_CHAIN*(RAWHDR_CARD_LEN+1)];
+  LogExtra number;
+  char *dest;
+  int ii,kk,done,flag,error;
+
+  for (ii=0; ii<schema->ncolumns; ii++) {
+    col = &schema->columns[ii];
+    if (col->nkeywords == 0 || (col->dprt && no_dprt))
+      continue;
+    dest = (char *)info + col->field.offset;
+    done = 0;
+
+    switch (col->rule) {
+    case SCHEMA_RULE_FILTERS:
+      /* Nothing at all if the first one is missing, otherwise as many as there are in a row */
+      if (found[col->keywords[0]] == NULL)
+	break;
+      joined[0] = '\0';
+      for (kk=0; kk<col->nkeywords && found[col->keywords[kk]]!=NULL; kk++) {
+	if (!schema_string(found[col->keywords[kk]],value))
+	  continue;
+	if (strcmp(value,"Clear") == 0 || strcmp(value,"clear") == 0 || strcmp(value,"NONE") == 0)
+	  continue;
+	if (joined[0])
+	  strcat(joined,",");
+	strcat(joined,value);
+      }
+      if (joined[0] == '\0')
+	strcpy(joined,"None");
+      schema_store_string(col,dest,joined);
+      done = 1;
+      break;
+
+    case SCHEMA_RULE_L1STAT:
+      /* Values of 1 or -1 mean Dp(RT) found nothing wrong. A missing one is taken as fine */
+      memcpy(&error,dest,sizeof(error));
+      for (kk=0; kk<col->nkeywords; kk++) {
+	if (schema_number(found[col->keywords[kk]],LOG_FIELD_INT,&flag) && abs(flag) != 1)
+	  error -= 2 << kk;
+      }
+      memcpy(dest,&error,sizeof(error));
+      done = 1;
+      break;
+
+    default:
+      for (kk=0; kk<col->nkeywords && !done; kk++) {
+	if (col->field.type == LOG_FIELD_STRING) {
+	  if (schema_string(found[col->keywords[kk]],value)) {
+	    schema_store_string(col,dest,value);
+	    done = 1;
+	  }
+	}
+	else if (schema_number(found[col->keywords[kk]],col->field.type,&number)) {
+	  memcpy(dest,&number,col->field.size);
+	  done = 1;
+	}
+      }
+      break;
+    }
+
+    if (!done && col->has_default)
+      schema_store_default(col,dest);
+  }
+}
@@ -0,0 +1,307 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+The --sort option. Orders the log on any list of LogInfo fields, e.g. --sort=propid,mjd
+
+This replaces indexx_dble(), the Numerical Recipes heapsort, which could only sort on MJD
+and was not stable, so frames with equal (or missing) MJDs came out in no particular order.
+Every sort here is stable, and a multi-key sort is done the usual way: one stable pass per
+key, starting from the last key in the list and finishing with the first. Rows which tie on
+every key stay in the order the files were read.
+
+Numeric keys are turned into unsigned integers which sort in the same order as the numbers
+(flip the sign bit of positives, all bits of negatives) and radix sorted a byte at a time.
+Passes where every row has the same byte are skipped, so a night of MJDs which only differ
+in the low bytes costs only a few passes. The rows are in a LogTable (see autolog_table.c),
+so a string is a number in its string pool. The distinct strings of a string key are put
+in strcmp() order, and the key is radix sorted on their places in that order like any other.
+All of this walks memory in order, unlike the heapsort, and sorting on MJD only reads the
+table's array of MJDs.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+
+/*
+ * Parse a comma separated list of field names, e.g. "instrume,filter,mjd", into spec.
+ * Any column of schema may be used, as well as any field of LogInfo. Returns 0, or 1 if a name is not known or there are too many keys. The offending
+ * name is printed.
+ */
+int sort_parse(const char *list, const Schema *schema, SortSpec *spec)
+{
+  char name[32];
+  const char *ptr,*comma;
+  const LogField *field;
+  size_t len;
+
+  spec->nkeys = 0;
+  ptr = list;
+  while (1) {
+    comma = strchr(ptr,',');
+    len = comma ? (size_t)(comma-ptr) : strlen(ptr);
+    if (len == 0 || len >= sizeof(name)) {
+      printf("Empty or overlong --sort key in %s\n",list);
+      return 1;
+    }
+    memcpy(name,ptr,len);
+    name[len] = '\0';
+
+    field = schema_field_find(schema,name);
+    if (field == NULL) {
+      printf("Unknown --sort key %s\n",name);
+      return 1;
+    }
+    if (spec->nkeys == SORT_MAX_KEYS) {
+      printf("No more than %d --sort keys may be given\n",SORT_MAX_KEYS);
+      return 1;
+    }
+    spec->keys[spec->nkeys++] = *field;
+
+    if (comma == NULL)
+      break;
+    ptr = comma+1;
+  }
+
+  return 0;
+}
+
+
+/* A string of the pool and its number, for qsort() in sort_rank_strings() */
+typedef struct SortString_Struct{
+  const char *str;
+  unsigned int id;
+}SortString;
+
+static int sort_compare_strings(const void *aa, const void *bb)
+{
+  return strcmp(((const SortString *)aa)->str,((const SortString *)bb)->str);
+}
+
+
+/*
+ * Set rank[id] to the place of string id in strcmp() order among the strings of the
+ * string field slot, for each string the field has in any row of table. The strings
+ * of the pool are all different, so no two have the same rank. rank and ids are
+ * scratch of table->pool.nstrings each.
+ */
+static void sort_rank_strings(const LogTable *table, const LogTableSlot *slot, unsigned int *rank, SortString *ids)
+{
+  unsigned int ii,id,nids;
+
+  for (ii=0; ii<table->pool.nstrings; ii++)
+    rank[ii] = 0xffffffffu;
+  nids = 0;
+  for (ii=0; ii<table->nrows; ii++) {
+    id = table->cells[(size_t)ii*table->ncells + slot->cell];
+    if (rank[id] == 0xffffffffu) {
+      rank[id] = 0;
+      ids[nids].str = strpool_str(&table->pool,id);
+      ids[nids++].id = id;
+    }
+  }
+
+  qsort(ids,nids,sizeof(SortString),sort_compare_strings);
+  for (ii=0; ii<nids; ii++)
+    rank[ids[ii].id] = ii;
+}
+
+
+/* A numeric field of type, at field, as an unsigned integer in the same order as the value */
+static uint64_t sort_bits(const void *field, int type)
+{
+  uint64_t bits;
+  uint32_t bits32;
+
+  if (type == LOG_FIELD_DOUBLE) {
+    memcpy(&bits,field,sizeof(bits));
+    return (bits >> 63) ? ~bits : bits ^ ((uint64_t)1 << 63);
+  }
+  memcpy(&bits32,field,sizeof(bits32));
+  if (type == LOG_FIELD_FLOAT)
+    return (bits32 >> 31) ? (uint32_t)~bits32 : bits32 ^ ((uint32_t)1 << 31);
+  return bits32 ^ ((uint32_t)1 << 31);
+}
+
+
+/* The key of row ii as an unsigned integer in the same order as the value */
+static uint64_t sort_numeric_key(const LogTable *table, unsigned int ii, const LogTableSlot *slot, const unsigned int *rank)
+{
+  const uint32_t *cell;
+
+  if (slot->cell < 0)
+    return sort_bits(&table->mjd[ii],LOG_FIELD_DOUBLE);
+
+  cell = table->cells + (size_t)ii*table->ncells + slot->cell;
+  if (slot->type == LOG_FIELD_STRING)
+    return rank[*cell];
+  return sort_bits(cell,slot->type);
+}
+
+
+/*
+ * Stable LSD radix sort of order[] on one key. tmporder, keys and tmpkeys are
+ * scratch of n elements each. rank is from sort_rank_strings(), for a string key.
+ * The result ends up in either order or tmporder, and that one is returned.
+ */
+static unsigned int *sort_radix_pass(const LogTable *table, const LogTableSlot *slot, const unsigned int *rank,
+				     unsigned int *order, unsigned int *tmporder,
+				     uint64_t *keys, uint64_t *tmpkeys)
+{
+  unsigned int count[256];
+  unsigned int ii,n,sum,cc,nbytes,byte,shift;
+  uint64_t *swapkeys;
+  unsigned int *swaporder;
+
+  n = table->nrows;
+  for (ii=0; ii<n; ii++)
+    keys[ii] = sort_numeric_key(table,order[ii],slot,rank);
+
+  nbytes = (slot->type == LOG_FIELD_DOUBLE) ? 8 : 4;
+  for (byte=0; byte<nbytes; byte++) {
+    shift = 8*byte;
+    memset(count,0,sizeof(count));
+    for (ii=0; ii<n; ii++)
+      count[(keys[ii] >> shift) & 0xff]++;
+
+    /* Every row has the same value in this byte, so this pass would change nothing */
+    if (count[(keys[0] >> shift) & 0xff] == n)
+      continue;
+
+    sum = 0;
+    for (ii=0; ii<256; ii++) {
+      cc = count[ii];
+      count[ii] = sum;
+      sum += cc;
+    }
+    for (ii=0; ii<n; ii++) {
+      cc = count[(keys[ii] >> shift) & 0xff]++;
+      tmpkeys[cc] = keys[ii];
+      tmporder[cc] = order[ii];
+    }
+
+    swapkeys = keys; keys = tmpkeys; tmpkeys = swapkeys;
+    swaporder = order; order = tmporder; tmporder = swaporder;
+  }
+
+  return order;
+}
+
+
+/*
+ * Fill order[] so that rows order[0], order[1], ... order[n-1] of table are sorted as
+ * described by spec. The table itself is not changed.
+ * Returns 0, or 1 if out of memory (order[] is then simply 0 to n-1).
+ */
+int sort_log_rows(const LogTable *table, const SortSpec *spec, unsigned int *order)
+{
+  const LogTableSlot *slots[SORT_MAX_KEYS];
+  unsigned int *work,*tmporder,*result,*rank;
+  SortString *ids;
+  uint64_t *keys;
+  unsigned int ii,n;
+  int kk,strings;
+
+  n = table->nrows;
+  for (ii=0; ii<n; ii++)
+    order[ii] = ii;
+  if (n < 2 || spec->nkeys == 0)
+    return 0;
+
+  /* sort_parse() only takes fields the table has */
+  strings = 0;
+  for (kk=0; kk<spec->nkeys; kk++) {
+    slots[kk] = logtable_slot(table,&spec->keys[kk]);
+    if (slots[kk] == NULL)
+      return 1;
+    if (slots[kk]->type == LOG_FIELD_STRING)
+      strings = 1;
+  }
+
+  tmporder = (unsigned int *)malloc(n*sizeof(unsigned int));
+  keys = (uint64_t *)malloc(2*(size_t)n*sizeof(uint64_t));
+  rank = NULL;
+  ids = NULL;
+  if (strings) {
+    rank = (unsigned int *)malloc(((size_t)table->pool.nstrings+1)*sizeof(unsigned int));
+    ids = (SortString *)malloc(((size_t)table->pool.nstrings+1)*sizeof(SortString));
+  }
+  if (tmporder == NULL || keys == NULL || (strings && (rank == NULL || ids == NULL))) {
+    free(tmporder);
+    free(keys);
+    free(rank);
+    free(ids);
+    return 1;
+  }
+
+  /* Least significant key first. Each pass is stable, so it keeps the order of the
+   * passes before it among rows which tie on this key */
+  work = order;
+  for (kk=spec->nkeys-1; kk>=0; kk--) {
+    if (slots[kk]->type == LOG_FIELD_STRING)
+      sort_rank_strings(table,slots[kk],rank,ids);
+    result = sort_radix_pass(table,slots[kk],rank,work,work==order ? tmporder : order,keys,keys+n);
+    work = result;
+  }
+
+  if (work != order)
+    memcpy(order,work,n*sizeof(unsigned int));
+
+  free(tmporder);
+  free(keys);
+  free(rank);
+  free(ids);
+  return 0;
+}
+
+
+
+/*
+ * Compare two rows as sort_log_rows() orders them: <0 if aa comes first, >0 if bb does,
+ * 0 if they tie on every key of spec. For merging rows which were sorted apart.
+ */
+int sort_compare_rows(const LogInfo *aa, const LogInfo *bb, const SortSpec *spec)
+{
+  const LogField *key;
+  uint64_t ka,kb;
+  int kk,cmp;
+
+  for (kk=0; kk<spec->nkeys; kk++) {
+    key = &spec->keys[kk];
+    if (key->type == LOG_FIELD_STRING) {
+      cmp = strcmp((const char *)aa + key->offset,(const char *)bb + key->offset);
+      if (cmp != 0)
+	return cmp;
+      continue;
+    }
+    ka = sort_bits((const char *)aa + key->offset,key->type);
+    kb = sort_bits((const char *)bb + key->offset,key->type);
+    if (ka != kb)
+      return ka < kb ? -1 : 1;
+  }
+  return 0;
+}
@@ -0,0 +1,366 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+The --memory option, for directories too big to hold every row of at once. An external
+merge sort: whenever the night's LogTable grows past its share of the budget, its rows
+are sorted on the --sort keys and written out to a temporary file as a sorted run, and
+the table is emptied for the next lot. Once every file is read the rows left in the table
+are sorted as usual, and night_write() takes the rows from spill_merge_next(), which
+merges the runs and the table on the same keys, so the log is written a row at a time.
+
+The budget is split four ways: a quarter for the table, a quarter for the LogJobs being
+read (night_scan() hands the files over a batch at a time), and the rest for the merge,
+which needs a buffer and a LogInfo for each run, and for the rest of autolog. No more than
+SPILL_MAX_RUNS runs are kept. Once there are that many they are merged into one, which
+costs another pass over the rows spilled so far but keeps the merge a fixed size.
+
+Rows which tie on every key come out of the merge from the earliest run first, and the
+table last, which is the order they were read in, so the log is exactly as it would be
+without --memory. A row is written out field by field, in the order of the table's
+slots: strings with their terminating \0, numbers as they are in memory. The files are
+only ever read back by the process which wrote them, and are unlinked as soon as made.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+
+/*
+ * Set up spill for a night read into table, to sort the runs as spec does, within
+ * budget bytes. A budget of 0 means no limit, and nothing is ever spilled.
+ */
+void spill_init(SpillSet *spill, size_t budget, const SortSpec *spec, const LogTable *table)
+{
+  spill->budget = budget;
+  spill->table_bytes = 0;
+  spill->batch = 0;
+  spill->spec = *spec;
+  memcpy(spill->slots,table->slots,sizeof(spill->slots));
+  spill->nslots = table->nslots;
+  spill->nruns = 0;
+  spill->table = NULL;
+  spill->order = NULL;
+  spill->nheap = 0;
+  if (budget == 0)
+    return;
+
+  spill->budget = MAX(budget,SPILL_MIN_BUDGET);
+  spill->table_bytes = spill->budget/4;
+  spill->batch = MAX(spill->budget/4/sizeof(LogJob),SPILL_MIN_BATCH);
+}
+
+
+/* Whether table has outgrown its share of the budget, and should be spilled */
+int spill_due(const SpillSet *spill, const LogTable *table)
+{
+  return spill->budget != 0 && logtable_bytes(table) >= spill->table_bytes;
+}
+
+
+/* A new, empty run in $TMPDIR, or /tmp. NULL if it could not be made */
+static SpillRun *spill_new_run(void)
+{
+  char path[1040];
+  const char *dir;
+  SpillRun *run;
+  int fd;
+
+  dir = getenv("TMPDIR");
+  if (dir == NULL || dir[0] == '\0' || strlen(dir) > 1000)
+    dir = "/tmp";
+  sprintf(path,"%s/autolog_spill_XXXXXX",dir);
+
+  run = (SpillRun *)malloc(sizeof(SpillRun));
+  if (run == NULL)
+    return NULL;
+  memset(run,0,sizeof(SpillRun));
+  fd = mkstemp(path);
+  if (fd < 0) {
+    free(run);
+    return NULL;
+  }
+  unlink(path);
+  run->fp = fdopen(fd,"w+b");
+  if (run->fp == NULL) {
+    close(fd);
+    free(run);
+    return NULL;
+  }
+  return run;
+}
+
+
+static void spill_close_run(SpillRun *run)
+{
+  fclose(run->fp);
+  free(run);
+}
+
+
+/* Append info to fp, a field at a time */
+static void spill_write_row(const SpillSet *spill, FILE *fp, const LogInfo *info)
+{
+  const LogTableSlot *slot;
+  const char *field;
+  int ii;
+
+  for (ii=0; ii<spill->nslots; ii++) {
+    slot = &spill->slots[ii];
+    field = (const char *)info + slot->offset;
+    if (slot->type == LOG_FIELD_STRING)
+      fwrite(field,1,strlen(field)+1,fp);
+    else if (slot->type == LOG_FIELD_DOUBLE)
+      fwrite(field,1,sizeof(double),fp);
+    else
+      fwrite(field,1,sizeof(uint32_t),fp);
+  }
+}
+
+
+/* Read the next row written by spill_write_row() into info. Returns 0, or 1 if it could not be read */
+static int spill_read_row(const SpillSet *spill, FILE *fp, LogInfo *info)
+{
+  const LogTableSlot *slot;
+  char *field,*end;
+  size_t size;
+  int ii,cc;
+
+  for (ii=0; ii<spill->nslots; ii++) {
+    slot = &spill->slots[ii];
+    field = (char *)info + slot->offset;
+    if (slot->type == LOG_FIELD_STRING) {
+      end = (char *)info + sizeof(LogInfo) - 1;
+      while ((cc = getc(fp)) != EOF && cc != '\0' && field < end)
+	*field++ = (char)cc;
+      *field = '\0';
+      if (cc != '\0')
+	return 1;
+    }
+    else {
+      size = (slot->type == LOG_FIELD_DOUBLE) ? sizeof(double) : sizeof(uint32_t);
+      if (fread(field,1,size,fp) != size)
+	return 1;
+    }
+  }
+  return 0;
+}
+
+
+/* Run ii of the merge. The one after the last spilled is the table */
+static SpillRun *spill_source(SpillSet *spill, int ii)
+{
+  return ii < spill->nruns ? spill->runs[ii] : &spill->tail;
+}
+
+
+/* Read the next row of run ii. Returns 0, 1 if it has no more, or -1 on a read error */
+static int spill_advance(SpillSet *spill, int ii)
+{
+  SpillRun *run;
+
+  run = spill_source(spill,ii);
+  if (run->next == run->nrows)
+    return 1;
+  if (run->fp == NULL)
+    logtable_row(spill->table,spill->order[run->next],&run->row);
+  else if (spill_read_row(spill,run->fp,&run->row))
+    return -1;
+  run->next++;
+  return 0;
+}
+
+
+/* Whether the row of run aa comes out before that of run bb */
+static int spill_before(SpillSet *spill, int aa, int bb)
+{
+  int cmp;
+
+  cmp = sort_compare_rows(&spill_source(spill,aa)->row,&spill_source(spill,bb)->row,&spill->spec);
+  return cmp < 0 || (cmp == 0 && aa < bb);
+}
+
+
+/* Move the run at heap[ii] down until the heap is in order again */
+static void spill_sift_down(SpillSet *spill, int ii)
+{
+  int child,swap;
+
+  while ((child = 2*ii+1) < spill->nheap) {
+    if (child+1 < spill->nheap && spill_before(spill,spill->heap[child+1],spill->heap[child]))
+      child++;
+    if (!spill_before(spill,spill->heap[child],spill->heap[ii]))
+      break;
+    swap = spill->heap[ii];
+    spill->heap[ii] = spill->heap[child];
+    spill->heap[child] = swap;
+    ii = child;
+  }
+}
+
+
+/*
+ * Get ready to merge every run spilled so far, and the rows of table in the order
+ * given by order, if table is not NULL. Returns 0, or 1 if a run could not be read.
+ */
+int spill_merge_start(SpillSet *spill, const LogTable *table, const unsigned int *order)
+{
+  int ii,nsources,rc;
+
+  spill->table = table;
+  spill->order = order;
+  memset(&spill->tail,0,sizeof(SpillRun));
+  spill->tail.nrows = table ? table->nrows : 0;
+
+  nsources = spill->nruns + (table ? 1 : 0);
+  spill->nheap = 0;
+  for (ii=0; ii<nsources; ii++) {
+    if (ii < spill->nruns) {
+      spill->runs[ii]->next = 0;
+      if (fflush(spill->runs[ii]->fp) || fseek(spill->runs[ii]->fp,0,SEEK_SET))
+	return 1;
+    }
+    rc = spill_advance(spill,ii);
+    if (rc < 0)
+      return 1;
+    if (rc == 0)
+      spill->heap[spill->nheap++] = ii;
+  }
+  for (ii=spill->nheap/2-1; ii>=0; ii--)
+    spill_sift_down(spill,ii);
+  return 0;
+}
+
+
+/*
+ * The next row of the merge, into info. Returns 1, 0 once there are no more, or -1 if
+ * a run could not be read back.
+ */
+int spill_merge_next(SpillSet *spill, LogInfo *info)
+{
+  int top,rc;
+
+  if (spill->nheap == 0)
+    return 0;
+  top = spill->heap[0];
+  memcpy(info,&spill_source(spill,top)->row,sizeof(LogInfo));
+
+  rc = spill_advance(spill,top);
+  if (rc < 0)
+    return -1;
+  if (rc > 0)
+    spill->heap[0] = spill->heap[--spill->nheap];
+  spill_sift_down(spill,0);
+  return 1;
+}
+
+
+/* Merge every run into one. Returns 0, or 1 if that could not be done, when they are left as they were */
+static int spill_collapse(SpillSet *spill)
+{
+  SpillRun *out;
+  LogInfo info;
+  int ii,rc;
+
+  out = spill_new_run();
+  if (out == NULL)
+    return 1;
+  rc = spill_merge_start(spill,NULL,NULL) ? -1 : 1;
+  while (rc > 0 && (rc = spill_merge_next(spill,&info)) > 0) {
+    spill_write_row(spill,out->fp,&info);
+    out->nrows++;
+  }
+  if (rc < 0 || ferror(out->fp)) {
+    spill_close_run(out);
+    return 1;
+  }
+
+  for (ii=0; ii<spill->nruns; ii++)
+    spill_close_run(spill->runs[ii]);
+  spill->runs[0] = out;
+  spill->nruns = 1;
+  return 0;
+}
+
+
+/*
+ * Sort the rows of table and write them out as a new run, then empty the table.
+ * Returns 0, or 1 if they could not be, when they are left in the table.
+ */
+int spill_table(SpillSet *spill, LogTable *table)
+{
+  SpillRun *run;
+  LogInfo info;
+  unsigned int *order;
+  unsigned int ii;
+
+  if (table->nrows == 0)
+    return 0;
+  if (spill->nruns == SPILL_MAX_RUNS && spill_collapse(spill))
+    return 1;
+
+  order = (unsigned int *)malloc(table->nrows*sizeof(unsigned int));
+  if (order == NULL)
+    return 1;
+  run = NULL;
+  if (sort_log_rows(table,&spill->spec,order) == 0)
+    run = spill_new_run();
+  if (run == NULL) {
+    free(order);
+    return 1;
+  }
+
+  for (ii=0; ii<table->nrows; ii++) {
+    logtable_row(table,order[ii],&info);
+    spill_write_row(spill,run->fp,&info);
+  }
+  free(order);
+  if (fflush(run->fp) || ferror(run->fp)) {
+    spill_close_run(run);
+    return 1;
+  }
+
+  run->nrows = table->nrows;
+  spill->runs[spill->nruns++] = run;
+  logtable_clear(table);
+  return 0;
+}
+
+
+/* Close and so delete every run */
+void spill_free(SpillSet *spill)
+{
+  int ii;
+
+  for (ii=0; ii<spill->nruns; ii++)
+    spill_close_run(spill->runs[ii]);
+  spill->nruns = 0;
+  spill->nheap = 0;
+  spill->table = NULL;
+  spill->order = NULL;
+}
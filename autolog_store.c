@@ -0,0 +1,112 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+Storage for the LogJobs (and so the LogInfos inside them) of one run.
+
+LogInfo_vec used to be realloc()ed one element at a time, copying everything read so far
+for every new file. Here the jobs live in fixed size chunks which are never moved once
+allocated, so a worker thread can be given a pointer to its job and write straight into
+it without any locking, while the directory scan carries on adding more. Only the small
+array of chunk pointers ever grows, and that doubles when it does.
+
+The store only ever holds one batch of files, LOGSTORE_BATCH of them or as many as
+--memory allows, and the first chunk is sized to fit, so everything goes into one
+allocation. As each batch is collected its rows are packed into the night's LogTable
+(see autolog_table.c) and the store is reset for the next. A night is never held as
+LogJobs all at once, which at over a kilobyte each would be several times the packed
+rows. --red-report is the exception: its report needs every job, so it keeps them all.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+
+/*
+ * hint is how many jobs we expect. It is only a guide, the store grows as needed.
+ */
+void logstore_init(LogStore *store, unsigned int hint)
+{
+  store->chunk_size = hint > LOGSTORE_MIN_CHUNK ? hint : LOGSTORE_MIN_CHUNK;
+  store->chunks = NULL;
+  store->nchunks = 0;
+  store->chunk_alloc = 0;
+  store->njobs = 0;
+}
+
+
+/*
+ * Hand out the next job. Its address never changes until logstore_free().
+ * Returns NULL if out of memory.
+ */
+LogJob *logstore_new_job(LogStore *store)
+{
+  LogJob **newchunks;
+  unsigned int chunk;
+
+  chunk = store->njobs / store->chunk_size;
+
+  if (chunk == store->nchunks) {
+    if (store->nchunks == store->chunk_alloc) {
+      store->chunk_alloc = store->chunk_alloc ? 2*store->chunk_alloc : 8;
+      newchunks = (LogJob **)realloc(store->chunks,store->chunk_alloc*sizeof(LogJob *));
+      if (newchunks == NULL)
+	return NULL;
+      store->chunks = newchunks;
+    }
+    store->chunks[chunk] = (LogJob *)malloc(store->chunk_size*sizeof(LogJob));
+    if (store->chunks[chunk] == NULL)
+      return NULL;
+    store->nchunks++;
+  }
+
+  return &store->chunks[chunk][store->njobs++ % store->chunk_size];
+}
+
+
+/* The ii'th job handed out, counting from 0 */
+LogJob *logstore_job(const LogStore *store, unsigned int ii)
+{
+  return &store->chunks[ii / store->chunk_size][ii % store->chunk_size];
+}
+
+
+/* Forget every job, keeping the chunks to hand out again. None may still be being read */
+void logstore_reset(LogStore *store)
+{
+  store->njobs = 0;
+}
+
+
+void logstore_free(LogStore *store)
+{
+  unsigned int ii;
+
+  for (ii=0; ii<store->nchunks; ii++)
+    free(store->chunks[ii]);
+  free(store->chunks);
+  store->chunks = NULL;
+  store->nchunks = store->chunk_alloc = 0;
+  store->njobs = 0;
+}
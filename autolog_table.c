@@ -0,0 +1,331 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+The rows of a night, once read. A LogInfo is nearly 1.4kB of fixed length strings, most
+of it blanks or the same few values: a night has a handful of instruments, proposals,
+filters and groups. Every LogJob in the LogStore has a whole LogInfo for the worker to fill
+in, but once collected the rows go in a LogTable and the store is freed.
+
+A row of the table is a few uint32_t cells, one for each field of LogInfo (two for a
+double), and each string is the number of that string in the table's StrPool, where it is
+kept only once however many rows have it. The MJD, which is what the log is sorted on,
+is kept apart in an array of its own. With the built in schema a row is 17 cells and a
+double, under 80 bytes, plus whatever strings are new to the night.
+
+logtable_row() gives a row back as a LogInfo, for the writers which want one. The sort
+works on the cells themselves. Strings in the pool compare equal only if they are the
+same string, so it can rank them once and sort on the rank.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+
+/* FNV-1a, as dirscan_hash() */
+static unsigned int strpool_hash(const char *str)
+{
+  unsigned int hash = 2166136261u;
+
+  while (*str) {
+    hash ^= (unsigned char)*str++;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+
+void strpool_init(StrPool *pool)
+{
+  pool->text = NULL;
+  pool->len = pool->alloc = 0;
+  pool->offsets = NULL;
+  pool->nstrings = pool->nalloc = 0;
+  pool->hash = NULL;
+  pool->hashsize = 0;
+}
+
+
+/* Double the hash table, or make the first one. Returns 0, or 1 if out of memory */
+static int strpool_rehash(StrPool *pool)
+{
+  unsigned int *newhash;
+  unsigned int size,ii,slot;
+
+  size = pool->hashsize ? 2*pool->hashsize : 256;
+  newhash = (unsigned int *)calloc(size,sizeof(unsigned int));
+  if (newhash == NULL)
+    return 1;
+  for (ii=0; ii<pool->nstrings; ii++) {
+    slot = strpool_hash(pool->text+pool->offsets[ii]) & (size-1);
+    while (newhash[slot])
+      slot = (slot+1) & (size-1);
+    newhash[slot] = ii+1;
+  }
+  free(pool->hash);
+  pool->hash = newhash;
+  pool->hashsize = size;
+  return 0;
+}
+
+
+/*
+ * Set *id to the number of str in pool, adding it if it is not there already.
+ * Returns 0, or 1 if out of memory.
+ */
+int strpool_add(StrPool *pool, const char *str, unsigned int *id)
+{
+  void *newspace;
+  unsigned int slot;
+  size_t len,alloc;
+
+  if (2*(pool->nstrings+1) > pool->hashsize && strpool_rehash(pool))
+    return 1;
+
+  slot = strpool_hash(str) & (pool->hashsize-1);
+  while (pool->hash[slot]) {
+    if (strcmp(pool->text+pool->offsets[pool->hash[slot]-1],str) == 0) {
+      *id = pool->hash[slot]-1;
+      return 0;
+    }
+    slot = (slot+1) & (pool->hashsize-1);
+  }
+
+  /* Offsets are 32 bits, which is a lot of distinct strings for one night */
+  len = strlen(str)+1;
+  if (pool->len+len > 0xffffffffu)
+    return 1;
+  if (pool->len+len > pool->alloc) {
+    alloc = MAX(2*pool->alloc,pool->len+len);
+    alloc = MAX(alloc,4096);
+    newspace = realloc(pool->text,alloc);
+    if (newspace == NULL)
+      return 1;
+    pool->text = (char *)newspace;
+    pool->alloc = alloc;
+  }
+  if (pool->nstrings == pool->nalloc) {
+    newspace = realloc(pool->offsets,(pool->nalloc ? 2*pool->nalloc : 256)*sizeof(unsigned int));
+    if (newspace == NULL)
+      return 1;
+    pool->offsets = (unsigned int *)newspace;
+    pool->nalloc = pool->nalloc ? 2*pool->nalloc : 256;
+  }
+
+  memcpy(pool->text+pool->len,str,len);
+  pool->offsets[pool->nstrings] = (unsigned int)pool->len;
+  pool->len += len;
+  pool->hash[slot] = ++pool->nstrings;
+  *id = pool->nstrings-1;
+  return 0;
+}
+
+
+/* String number id. Good until the next strpool_add() */
+const char *strpool_str(const StrPool *pool, unsigned int id)
+{
+  return pool->text+pool->offsets[id];
+}
+
+
+void strpool_free(StrPool *pool)
+{
+  free(pool->text);
+  free(pool->offsets);
+  free(pool->hash);
+  strpool_init(pool);
+}
+
+
+/* Add a slot for the field at offset in LogInfo, of type */
+static void logtable_add_slot(LogTable *table, size_t offset, int type)
+{
+  LogTableSlot *slot;
+
+  slot = &table->slots[table->nslots++];
+  slot->offset = offset;
+  slot->type = type;
+  if (offset == offsetof(LogInfo,mjd))
+    slot->cell = -1;
+  else {
+    slot->cell = table->ncells;
+    table->ncells += (type == LOG_FIELD_DOUBLE) ? 2 : 1;
+  }
+}
+
+
+/*
+ * An empty table for rows read with schema: every field of log_fields[], which
+ * format_log_row() wants whatever the schema, and the extra columns it adds.
+ */
+void logtable_init(LogTable *table, const Schema *schema)
+{
+  const LogField *field;
+  int ii;
+
+  strpool_init(&table->pool);
+  table->nslots = 0;
+  table->ncells = 0;
+  table->cells = NULL;
+  table->mjd = NULL;
+  table->nrows = table->nalloc = 0;
+
+  for (ii=0; ii<log_nfields; ii++)
+    logtable_add_slot(table,log_fields[ii].offset,log_fields[ii].type);
+  for (ii=0; ii<schema->ncolumns; ii++) {
+    field = &schema->columns[ii].field;
+    if (field->offset >= offsetof(LogInfo,extra))
+      logtable_add_slot(table,field->offset,field->type);
+  }
+}
+
+
+/* Make room for nrows rows in all. Returns 0, or 1 if out of memory */
+int logtable_reserve(LogTable *table, unsigned int nrows)
+{
+  void *newspace;
+
+  if (nrows <= table->nalloc)
+    return 0;
+  newspace = realloc(table->cells,(size_t)nrows*table->ncells*sizeof(uint32_t));
+  if (newspace == NULL)
+    return 1;
+  table->cells = (uint32_t *)newspace;
+  newspace = realloc(table->mjd,(size_t)nrows*sizeof(double));
+  if (newspace == NULL)
+    return 1;
+  table->mjd = (double *)newspace;
+  table->nalloc = nrows;
+  return 0;
+}
+
+
+/* Add info as the next row. Returns 0, or 1 if out of memory */
+int logtable_add(LogTable *table, const LogInfo *info)
+{
+  const LogTableSlot *slot;
+  const char *field;
+  uint32_t *row;
+  unsigned int id;
+  int ii;
+
+  if (table->nrows == table->nalloc
+      && logtable_reserve(table,table->nalloc ? 2*table->nalloc : 256))
+    return 1;
+
+  row = table->cells + (size_t)table->nrows*table->ncells;
+  for (ii=0; ii<table->nslots; ii++) {
+    slot = &table->slots[ii];
+    field = (const char *)info + slot->offset;
+    if (slot->cell < 0)
+      memcpy(&table->mjd[table->nrows],field,sizeof(double));
+    else if (slot->type == LOG_FIELD_STRING) {
+      if (strpool_add(&table->pool,field,&id))
+	return 1;
+      row[slot->cell] = id;
+    }
+    else if (slot->type == LOG_FIELD_DOUBLE)
+      memcpy(&row[slot->cell],field,sizeof(double));
+    else
+      memcpy(&row[slot->cell],field,sizeof(uint32_t));
+  }
+  table->nrows++;
+  return 0;
+}
+
+
+/*
+ * Roughly how much memory the rows of table take up: the cells and MJDs of each, and the
+ * strings of the pool with their offsets and hash slots. What is allocated may be up to
+ * twice this, as everything doubles when it grows.
+ */
+size_t logtable_bytes(const LogTable *table)
+{
+  return (size_t)table->nrows*(table->ncells*sizeof(uint32_t)+sizeof(double))
+    + table->pool.len + (size_t)table->pool.nstrings*3*sizeof(unsigned int);
+}
+
+
+/* Empty table of its rows and strings, keeping the memory for the next lot */
+void logtable_clear(LogTable *table)
+{
+  table->nrows = 0;
+  table->pool.len = 0;
+  table->pool.nstrings = 0;
+  if (table->pool.hash)
+    memset(table->pool.hash,0,table->pool.hashsize*sizeof(unsigned int));
+}
+
+
+/*
+ * Row ii as a LogInfo. Only the fields the table has are written, which is all of them
+ * but the extra columns the schema does not use.
+ */
+void logtable_row(const LogTable *table, unsigned int ii, LogInfo *info)
+{
+  const LogTableSlot *slot;
+  const uint32_t *row;
+  char *field;
+  int ss;
+
+  row = table->cells + (size_t)ii*table->ncells;
+  for (ss=0; ss<table->nslots; ss++) {
+    slot = &table->slots[ss];
+    field = (char *)info + slot->offset;
+    if (slot->cell < 0)
+      memcpy(field,&table->mjd[ii],sizeof(double));
+    else if (slot->type == LOG_FIELD_STRING)
+      strcpy(field,strpool_str(&table->pool,row[slot->cell]));
+    else if (slot->type == LOG_FIELD_DOUBLE)
+      memcpy(field,&row[slot->cell],sizeof(double));
+    else
+      memcpy(field,&row[slot->cell],sizeof(uint32_t));
+  }
+}
+
+
+/* Where field is kept, or NULL if the table does not have it */
+const LogTableSlot *logtable_slot(const LogTable *table, const LogField *field)
+{
+  int ii;
+
+  for (ii=0; ii<table->nslots; ii++) {
+    if (table->slots[ii].offset == field->offset)
+      return &table->slots[ii];
+  }
+  return NULL;
+}
+
+
+void logtable_free(LogTable *table)
+{
+  strpool_free(&table->pool);
+  free(table->cells);
+  free(table->mjd);
+  table->cells = NULL;
+  table->mjd = NULL;
+  table->nrows = table->nalloc = 0;
+}
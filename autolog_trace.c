@@ -0,0 +1,304 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+Where the time goes. Every run times each phase of each night (reading the directory,
+handing the files over, waiting for the workers, sorting, writing the log and so on, see
+TRACE_* in autolog.h) and each step of reading each file. At the end of the night a summary
+is added to autolog_status.log: the phases, a histogram of how long the files took from
+open to close and the slowest few by name, so one pathological file on a slow mount stands
+out straight away. Reading the clock costs a few tens of nanoseconds, so this is always on.
+
+With --trace=FILE every phase and every file also goes into FILE in the Chrome trace event
+format, which chrome://tracing and https://ui.perfetto.dev will both load. Each night is a
+process, and each thread (main, or worker N with -j) a thread of it. A file is one event
+on the thread which read it, with its open, keywords and close steps inside it.
+
+The workers only ever write the times into their own LogJob. Everything here is called
+from the main thread, as the jobs are collected.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+const char *trace_phase_names[TRACE_NPHASES] = {
+  "readdir","cache load","resolve","order","read","wait","cache save","sort","write log","write formats","red report","spill"
+};
+
+
+/* Seconds on the monotonic clock. Only differences mean anything */
+double trace_now(void)
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC,&ts) == 0)
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+#endif
+  {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return tv.tv_sec + tv.tv_usec*1e-6;
+  }
+}
+
+
+/* str as a JSON string, quotes and all */
+static void trace_json_string(FILE *fp, const char *str)
+{
+  unsigned char cc;
+
+  fputc('"',fp);
+  for (; *str; str++) {
+    cc = (unsigned char)*str;
+    if (cc == '"' || cc == '\\')
+      fprintf(fp,"\\%c",cc);
+    else if (cc < 0x20)
+      fprintf(fp,"\\u%04x",cc);
+    else
+      fputc(cc,fp);
+  }
+  fputc('"',fp);
+}
+
+
+/* Start the next event, and the comma before it if need be */
+static FILE *trace_event(TraceFile *trace)
+{
+  fputs(trace->nevents++ ? ",\n" : "\n",trace->fp);
+  return trace->fp;
+}
+
+
+/* A complete ("X") event. Times are trace_now() seconds, written as microseconds */
+static void trace_span(TraceFile *trace, const char *cat, const char *name, int pid, int tid, double start, double secs)
+{
+  FILE *fp;
+
+  fp = trace_event(trace);
+  fprintf(fp,"{\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":",
+	  cat,pid,tid,(start-trace->epoch)*1e6,secs*1e6);
+  trace_json_string(fp,name);
+  fputc('}',fp);
+}
+
+
+/* A process_name or thread_name ("M") event */
+static void trace_name(TraceFile *trace, const char *what, int pid, int tid, const char *name)
+{
+  FILE *fp;
+
+  fp = trace_event(trace);
+  fprintf(fp,"{\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"name\":\"%s\",\"args\":{\"name\":",pid,tid,what);
+  trace_json_string(fp,name);
+  fputs("}}",fp);
+}
+
+
+/*
+ * Start the --trace file at path. With path NULL there is no trace, and trace->fp is
+ * left NULL. Returns 0, or 1 if the file could not be created.
+ */
+int trace_open(TraceFile *trace, const char *path)
+{
+  trace->fp = NULL;
+  trace->epoch = trace_now();
+  trace->nevents = 0;
+
+  if (path == NULL)
+    return 0;
+  trace->fp = fopen(path,"w");
+  if (trace->fp == NULL)
+    return 1;
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[",trace->fp);
+  return 0;
+}
+
+
+void trace_close(TraceFile *trace)
+{
+  if (trace->fp == NULL)
+    return;
+  fputs("\n]}\n",trace->fp);
+  fclose(trace->fp);
+  trace->fp = NULL;
+}
+
+
+/*
+ * Start timing run. pid is its process in the trace, and nthreads the number of
+ * worker threads, so that each can be named.
+ */
+void trace_night_start(LogRun *run, TraceFile *trace, int pid, int nthreads)
+{
+  char name[32];
+  int ii;
+
+  memset(&run->timing,0,sizeof(run->timing));
+  run->timing.start = trace_now();
+  run->trace = trace;
+  run->trace_pid = pid;
+
+  if (trace->fp == NULL)
+    return;
+  trace_name(trace,"process_name",pid,0,run->cfg.dirname);
+  trace_name(trace,"thread_name",pid,0,"main");
+  for (ii=1; ii<=nthreads; ii++) {
+    sprintf(name,"worker %d",ii);
+    trace_name(trace,"thread_name",pid,ii,name);
+  }
+}
+
+
+/*
+ * The phase which began at start has just finished. Add it to the night's total,
+ * and the trace. Returns the time now, which is when the next phase starts.
+ */
+double trace_phase(LogRun *run, int phase, double start)
+{
+  double now;
+
+  now = trace_now();
+  run->timing.phase[phase] += now-start;
+  if (run->trace->fp)
+    trace_span(run->trace,"phase",trace_phase_names[phase],run->trace_pid,0,start,now-start);
+  return now;
+}
+
+
+/* Histogram bin for a file which took secs */
+static int trace_hist_bin(double secs)
+{
+  double edge;
+  int bin;
+
+  edge = 16e-6;
+  for (bin=0; bin<TRACE_HIST_BINS-1; bin++) {
+    if (secs < edge)
+      break;
+    edge *= 2;
+  }
+  return bin;
+}
+
+
+/* Add one file, as read by extract_LogInfo(). Those taken from the cache were not read */
+void trace_file(LogRun *run, const LogJob *job)
+{
+  NightTiming *tm;
+  TraceFile *trace;
+  double secs;
+  int ii;
+
+  if (job->from_cache)
+    return;
+
+  tm = &run->timing;
+  secs = job->t_open + job->t_keys + job->t_close;
+  tm->nfiles++;
+  tm->open += job->t_open;
+  tm->keys += job->t_keys;
+  tm->close += job->t_close;
+  tm->hist[trace_hist_bin(secs)]++;
+
+  /* Keep the slowest few, slowest first */
+  for (ii=TRACE_SLOWEST; ii>0 && tm->slowest[ii-1].secs < secs; ii--) {
+    if (ii < TRACE_SLOWEST)
+      tm->slowest[ii] = tm->slowest[ii-1];
+  }
+  if (ii < TRACE_SLOWEST) {
+    tm->slowest[ii].secs = secs;
+    strcpy(tm->slowest[ii].exposure,job->cur.exposure);
+  }
+
+  trace = run->trace;
+  if (trace->fp == NULL)
+    return;
+  trace_span(trace,"file",job->cur.exposure,run->trace_pid,job->worker,job->t_start,secs);
+  trace_span(trace,"step","open",run->trace_pid,job->worker,job->t_start,job->t_open);
+  if (job->status != 41) {
+    trace_span(trace,"step","keywords",run->trace_pid,job->worker,job->t_start+job->t_open,job->t_keys);
+    trace_span(trace,"step","close",run->trace_pid,job->worker,job->t_start+job->t_open+job->t_keys,job->t_close);
+  }
+}
+
+
+/* The timing summary, at the end of autolog_status.log */
+void trace_summary(LogRun *run)
+{
+  NightTiming *tm;
+  FILE *fp;
+  double lo,hi;
+  int ii,first,last;
+
+  tm = &run->timing;
+  fp = run->proglog;
+
+  tm->total = trace_now()-tm->start;
+  fprintf(fp,"Timing in seconds, %.6f in all\n",tm->total);
+  for (ii=0; ii<TRACE_NPHASES; ii++)
+    fprintf(fp,"  %-14s %10.6f\n",trace_phase_names[ii],tm->phase[ii]);
+  if (run->cfg.io) {
+    if (run->cfg.io->drop)
+      fprintf(fp,"%u pages dropped from the page cache after reading\n",run->counts.pages_dropped);
+    if (run->cfg.io->max_files > 0 || run->cfg.io->max_rate > 0)
+      fprintf(fp,"%.6f seconds waiting for --io-files and --io-rate, over all threads\n",run->counts.io_wait);
+  }
+  if (tm->nfiles == 0) {
+    fflush(fp);
+    return;
+  }
+
+  fprintf(fp,"%5d files read. Time spent on them, over all threads\n",tm->nfiles);
+  fprintf(fp,"  %-14s %10.6f\n","open",tm->open);
+  fprintf(fp,"  %-14s %10.6f\n","keywords",tm->keys);
+  fprintf(fp,"  %-14s %10.6f\n","close",tm->close);
+
+  first = 0;
+  while (tm->hist[first] == 0)
+    first++;
+  last = TRACE_HIST_BINS-1;
+  while (tm->hist[last] == 0)
+    last--;
+  fprintf(fp,"Files by time from open to close\n");
+  for (ii=first; ii<=last; ii++) {
+    lo = ii ? 16e-6*(1 << (ii-1)) : 0;
+    hi = 16e-6*(1 << ii);
+    if (ii == TRACE_HIST_BINS-1)
+      fprintf(fp,"  %9.6f -           %6d\n",lo,tm->hist[ii]);
+    else
+      fprintf(fp,"  %9.6f - %9.6f %6d\n",lo,hi,tm->hist[ii]);
+  }
+
+  fprintf(fp,"Slowest files\n");
+  for (ii=0; ii<TRACE_SLOWEST && tm->slowest[ii].secs>0; ii++)
+    fprintf(fp,"  %10.6f %s\n",tm->slowest[ii].secs,tm->slowest[ii].exposure);
+  fflush(fp);
+}
@@ -0,0 +1,490 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+--reader=uring. Reading a header is a handful of tiny reads, and on a busy or network mount
+nearly all of the time goes in waiting for each one to come back. The raw reader waits for
+them one at a time, and even -j N only has N in flight. Here each worker thread keeps up to
+URING_DEPTH files going at once through its own io_uring: an openat for each file as it
+comes off the work queue, then a read of its first 2880 byte block. As each block lands it
+goes through the same card scan as the raw reader (rawhdr_add_block()) and the next block is
+only asked for if the header has not reached END yet. The keywords are then picked out by
+extract_cards(), exactly as extract_LogInfo() would, so the log is the same either way.
+
+Compressed files are read on the spot by extract_LogInfo(), as gzread() has to inflate
+the blocks in order anyway.
+
+--io-files and --io-rate (autolog_iopolicy.c) are asked before each file is started. While
+the ring has files in flight it does not wait for them, but gets on with those instead.
+
+The ring is driven with the bare system calls, so there is no need for liburing. Where
+there is no io_uring (not Linux, a kernel older than 5.6, or a sandbox which blocks it)
+uring_available() says so and everything is read by the raw reader instead. If the ring
+fails part way through, the files it had in hand are read again the slow way.
+
+In a --trace, the files a worker has in flight overlap on its thread.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+/* IORING_OP_OPENAT and IORING_OP_READ came in with 5.6, as did this */
+#if defined(__linux__) && defined(IORING_FEAT_RW_CUR_POS)
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* One io_uring, mapped into our memory */
+typedef struct UringRing_Struct{
+  int fd;
+  unsigned int *sq_tail,*sq_mask,*sq_array;
+  unsigned int *cq_head,*cq_tail,*cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_map,*cq_map;		/* cq_map is sq_map if the kernel maps both rings at once */
+  size_t sq_len,cq_len,sqes_len;
+  unsigned int to_submit;	/* SQEs queued since the last io_uring_enter() */
+}UringRing;
+
+/* One file in flight */
+typedef struct UringSlot_Struct{
+  LogJob *job;			/* NULL if the slot is free */
+  int fd;			/* -1 until the openat has completed */
+  RawHeader hdr;		/* The cards read so far */
+  off_t offset;			/* Of the block being read */
+  PageSnapshot snap;		/* For --pagecache=drop */
+  double waited;		/* For --io-files and --io-rate, before the file was started */
+  char path[1024];
+}UringSlot;
+
+
+static void uring_teardown(UringRing *ring)
+{
+  if (ring->sqes != MAP_FAILED)
+    munmap(ring->sqes,ring->sqes_len);
+  if (ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map)
+    munmap(ring->cq_map,ring->cq_len);
+  if (ring->sq_map != MAP_FAILED)
+    munmap(ring->sq_map,ring->sq_len);
+  if (ring->fd >= 0)
+    close(ring->fd);
+}
+
+
+/*
+ * Create a ring with room for entries SQEs and map it. Returns 0, or 1 if
+ * the kernel will not give us one.
+ */
+static int uring_setup(UringRing *ring, unsigned int entries)
+{
+  struct io_uring_params params;
+
+  ring->sq_map = ring->cq_map = MAP_FAILED;
+  ring->sqes = MAP_FAILED;
+  ring->to_submit = 0;
+
+  memset(&params,0,sizeof(params));
+  ring->fd = syscall(__NR_io_uring_setup,entries,&params);
+  if (ring->fd < 0)
+    return 1;
+
+  ring->sq_len = params.sq_off.array + params.sq_entries*sizeof(unsigned int);
+  ring->cq_len = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    ring->sq_len = ring->cq_len = MAX(ring->sq_len,ring->cq_len);
+
+  ring->sq_map = mmap(NULL,ring->sq_len,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ring->fd,IORING_OFF_SQ_RING);
+  if (ring->sq_map == MAP_FAILED) {
+    uring_teardown(ring);
+    return 1;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    ring->cq_map = ring->sq_map;
+  else {
+    ring->cq_map = mmap(NULL,ring->cq_len,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ring->fd,IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED) {
+      uring_teardown(ring);
+      return 1;
+    }
+  }
+  ring->sqes_len = params.sq_entries*sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe *)mmap(NULL,ring->sqes_len,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,
+					   ring->fd,IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    uring_teardown(ring);
+    return 1;
+  }
+
+  ring->sq_tail = (unsigned int *)((char *)ring->sq_map + params.sq_off.tail);
+  ring->sq_mask = (unsigned int *)((char *)ring->sq_map + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned int *)((char *)ring->sq_map + params.sq_off.array);
+  ring->cq_head = (unsigned int *)((char *)ring->cq_map + params.cq_off.head);
+  ring->cq_tail = (unsigned int *)((char *)ring->cq_map + params.cq_off.tail);
+  ring->cq_mask = (unsigned int *)((char *)ring->cq_map + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_map + params.cq_off.cqes);
+  return 0;
+}
+
+
+/* Whether the kernel behind ring can do op */
+static int uring_supports(const UringRing *ring, int op)
+{
+  struct io_uring_probe *probe;
+  int ok;
+
+  probe = (struct io_uring_probe *)calloc(1,sizeof(struct io_uring_probe)+256*sizeof(struct io_uring_probe_op));
+  if (probe == NULL)
+    return 0;
+  ok = syscall(__NR_io_uring_register,ring->fd,IORING_REGISTER_PROBE,probe,256) == 0
+    && op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+  free(probe);
+  return ok;
+}
+
+
+/*
+ * The next free SQE, zeroed. There is always one, as each file in flight has at most
+ * one request outstanding and the ring has room for URING_DEPTH.
+ */
+static struct io_uring_sqe *uring_get_sqe(UringRing *ring)
+{
+  struct io_uring_sqe *sqe;
+
+  sqe = &ring->sqes[*ring->sq_tail & *ring->sq_mask];
+  memset(sqe,0,sizeof(*sqe));
+  return sqe;
+}
+
+
+/* Hand the SQE from uring_get_sqe() to the kernel, at the next io_uring_enter() */
+static void uring_queue_sqe(UringRing *ring, struct io_uring_sqe *sqe)
+{
+  unsigned int tail;
+
+  tail = *ring->sq_tail;
+  ring->sq_array[tail & *ring->sq_mask] = sqe - ring->sqes;
+  __atomic_store_n(ring->sq_tail,tail+1,__ATOMIC_RELEASE);
+  ring->to_submit++;
+}
+
+
+static void uring_prep_openat(UringRing *ring, UringSlot *slot, int index)
+{
+  struct io_uring_sqe *sqe;
+
+  sqe = uring_get_sqe(ring);
+  sqe->opcode = IORING_OP_OPENAT;
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (unsigned long)slot->path;
+  sqe->open_flags = O_RDONLY;
+  sqe->user_data = index;
+  uring_queue_sqe(ring,sqe);
+}
+
+
+static void uring_prep_read(UringRing *ring, UringSlot *slot, int index, char *block)
+{
+  struct io_uring_sqe *sqe;
+
+  sqe = uring_get_sqe(ring);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = slot->fd;
+  sqe->addr = (unsigned long)block;
+  sqe->len = RAWHDR_BLOCK_LEN;
+  sqe->off = slot->offset;
+  sqe->user_data = index;
+  uring_queue_sqe(ring,sqe);
+}
+
+
+/*
+ * Submit whatever is queued and wait for at least one completion.
+ * Returns 0, or 1 if the ring has stopped working.
+ */
+static int uring_enter(UringRing *ring)
+{
+  int ret;
+
+  ret = syscall(__NR_io_uring_enter,ring->fd,ring->to_submit,1,IORING_ENTER_GETEVENTS,NULL,0);
+  if (ret < 0)
+    return !(errno == EINTR || errno == EAGAIN || errno == EBUSY);
+  ring->to_submit -= ret;
+  return 0;
+}
+
+
+/*
+ * Finished with the file in slot, one way or the other. ok is 0 if it could not be opened
+ * or is not FITS, which extract_LogInfo() reports as 41.
+ */
+static void uring_finish(WorkQueue *wq, UringSlot *slot, int ok)
+{
+  LogJob *job;
+
+  job = slot->job;
+  job->t_open = trace_now() - job->t_start;
+  job->t_wait = slot->waited;
+  if (ok) {
+    extract_cards(job->cfg,job,&slot->hdr);
+    job->bytes_read = slot->hdr.bytes_read;
+    job->t_keys = trace_now() - job->t_start - job->t_open;
+  }
+  else {
+    job->info.error = -1;
+    job->status = 41;
+  }
+
+  job->pages_dropped = iopolicy_release(job->cfg->io,&slot->snap);
+  if (slot->fd >= 0)
+    close(slot->fd);
+  rawhdr_close(&slot->hdr);
+  if (wq->io)
+    iopolicy_end(wq->io,job->bytes_read);
+  if (ok)
+    job->t_close = trace_now() - job->t_start - job->t_open - job->t_keys;
+
+  slot->job = NULL;
+  workqueue_done(wq,job);
+}
+
+
+/* Ask for the next block of the header in slot. Returns 0, or 1 if there is no memory for it */
+static int uring_next_block(UringRing *ring, UringSlot *slot, int index)
+{
+  char *block;
+
+  block = rawhdr_block_space(&slot->hdr);
+  if (block == NULL)
+    return 1;
+  uring_prep_read(ring,slot,index,block);
+  return 0;
+}
+
+
+/*
+ * The request for slot has completed with res. Either ask for the next thing it needs
+ * or finish it. Returns 1 if the file is finished with.
+ */
+static int uring_complete(WorkQueue *wq, UringRing *ring, UringSlot *slot, int index, int res)
+{
+  int status;
+
+  /* The openat */
+  if (slot->fd < 0) {
+    if (res < 0) {
+      uring_finish(wq,slot,0);
+      return 1;
+    }
+    slot->fd = res;
+    slot->offset = 0;
+    iopolicy_no_readahead(slot->job->cfg->io,slot->fd);
+    iopolicy_snapshot(slot->job->cfg->io,NULL,slot->fd,&slot->snap);
+  }
+  /* A block of the header */
+  else {
+    if (res != RAWHDR_BLOCK_LEN) {
+      uring_finish(wq,slot,0);
+      return 1;
+    }
+    slot->hdr.bytes_read += res;
+    status = rawhdr_add_block(&slot->hdr,0,1);
+    if (status != RAWHDR_MORE) {
+      uring_finish(wq,slot,status == 0);
+      return 1;
+    }
+    slot->offset += RAWHDR_BLOCK_LEN;
+  }
+
+  if (uring_next_block(ring,slot,index)) {
+    uring_finish(wq,slot,0);
+    return 1;
+  }
+  return 0;
+}
+
+
+/*
+ * Read job on the spot with extract_LogInfo(), which waited on the I/O limits for it.
+ * uring_worker() has already done so, so they are left out this time round.
+ */
+static void uring_read_now(WorkQueue *wq, LogJob *job, double waited)
+{
+  ExtractConfig cfg;
+  IoPolicy unlimited;
+
+  cfg = *job->cfg;
+  if (cfg.io != NULL) {
+    unlimited.drop = cfg.io->drop;
+    unlimited.max_files = 0;
+    unlimited.max_rate = 0;
+    cfg.io = &unlimited;
+  }
+  extract_LogInfo(&cfg,job);
+  job->t_wait = waited;
+  if (wq->io)
+    iopolicy_end(wq->io,job->bytes_read);
+  workqueue_done(wq,job);
+}
+
+
+/*
+ * Whether --reader=uring can work here: a ring can be set up, and the kernel knows
+ * how to openat and read through it. Returns 1 if so.
+ */
+int uring_available(void)
+{
+  UringRing ring;
+  int ok;
+
+  if (uring_setup(&ring,4))
+    return 0;
+  ok = uring_supports(&ring,IORING_OP_OPENAT) && uring_supports(&ring,IORING_OP_READ);
+  uring_teardown(&ring);
+  return ok;
+}
+
+
+/*
+ * The body of worker thread number worker with --reader=uring. Takes jobs off wq, keeping
+ * up to URING_DEPTH in flight, until the queue is closed and empty.
+ * Returns 0 once it is, or 1 if the ring could not be set up or stopped working. Every
+ * job taken has been read by the time this returns, either way.
+ */
+int uring_worker(WorkQueue *wq, int worker)
+{
+  UringRing ring;
+  UringSlot *slots,*slot;
+  LogJob *job;
+  unsigned int head;
+  int nactive,index,failed,ii;
+  double waited;
+
+  if (uring_setup(&ring,URING_DEPTH))
+    return 1;
+  slots = (UringSlot *)calloc(URING_DEPTH,sizeof(UringSlot));
+  if (slots == NULL) {
+    uring_teardown(&ring);
+    return 1;
+  }
+
+  nactive = 0;
+  failed = 0;
+  while (!failed) {
+    /* Keep the ring full. Only sleep waiting for more work, or for --io-files and
+     * --io-rate to allow another file, if nothing is in flight */
+    index = 0;
+    while (nactive < URING_DEPTH) {
+      waited = 0;
+      if (wq->io) {
+	if (nactive == 0)
+	  waited = iopolicy_begin(wq->io);
+	else if (!iopolicy_try_begin(wq->io))
+	  break;
+      }
+      job = workqueue_take(wq,nactive==0);
+      if (job == NULL) {
+	if (wq->io)
+	  iopolicy_end(wq->io,0);
+	break;
+      }
+
+      while (slots[index].job != NULL)
+	index++;
+      slot = &slots[index];
+      job->worker = worker;
+      extract_begin(job->cfg,job,slot->path);
+      if (rawhdr_compression(slot->path) != RAWHDR_PLAIN) {
+	uring_read_now(wq,job,waited);
+	continue;
+      }
+      slot->job = job;
+      slot->fd = -1;
+      slot->hdr.cards = NULL;
+      slot->hdr.ncards = 0;
+      slot->hdr.map = NULL;
+      slot->hdr.bytes_read = 0;
+      slot->snap.fd = -1;
+      slot->snap.own_fd = 0;
+      slot->snap.npages = 0;
+      slot->waited = waited;
+      uring_prep_openat(&ring,slot,index);
+      nactive++;
+    }
+    /* Closed and empty */
+    if (nactive == 0)
+      break;
+
+    if (uring_enter(&ring)) {
+      failed = 1;
+      break;
+    }
+
+    head = *ring.cq_head;
+    while (head != __atomic_load_n(ring.cq_tail,__ATOMIC_ACQUIRE)) {
+      index = ring.cqes[head & *ring.cq_mask].user_data;
+      if (uring_complete(wq,&ring,&slots[index],index,ring.cqes[head & *ring.cq_mask].res))
+	nactive--;
+      head++;
+      __atomic_store_n(ring.cq_head,head,__ATOMIC_RELEASE);
+    }
+  }
+
+  if (failed) {
+    /* Whatever the kernel still has of ours may yet be written to, so the ring and the
+     * slots are left alone. Read the files again from the start */
+    for (ii=0; ii<URING_DEPTH; ii++) {
+      if (slots[ii].job != NULL)
+	uring_read_now(wq,slots[ii].job,slots[ii].waited);
+    }
+    return 1;
+  }
+
+  free(slots);
+  uring_teardown(&ring);
+  return 0;
+}
+
+#else
+
+int uring_available(void)
+{
+  return 0;
+}
+
+int uring_worker(WorkQueue *wq, int worker)
+{
+  return 1;
+}
+
+#endif
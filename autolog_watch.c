@@ -0,0 +1,397 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+The --watch mode. After the normal run over whatever is already in the directory, autolog
+stays resident and uses inotify to hear about each FITS file as it is finished
+(IN_CLOSE_WRITE) or moved into place (IN_MOVED_TO). Each new file is read on its own and
+put straight into the log, so the log is current within moments of a frame landing.
+
+The watch is set up by night_scan(), before the directory is listed, so a frame which
+lands while the night is being read and written is not lost: its event waits in the
+queue, and is the first thing watch_directory() reads. A file which was both listed and
+heard about is read twice, and the second read replaces the first row.
+
+The log lines are kept in memory in MJD order, along with where each one starts in the log
+file. Frames nearly always arrive in time order, so a new one normally just goes on the end
+of the file. If one turns up out of order, or Dp(RT) writes a reduced version of a frame
+which was logged raw, the file is truncated at the first line which changed and only the
+lines from there on are written again. Nothing is ever re-sorted.
+
+inotify is Linux only. Elsewhere --watch just reports that it is not available.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+#ifdef __linux__
+
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/inotify.h>
+
+/* One line in the log */
+typedef struct WatchRow_Struct{
+  LogInfo info;
+  char base[FILENAME_LENGTH];	/* night_exposure_base() of info.exposure */
+  int p;			/* The pipeline flag. Higher means more reduced */
+  long offset;			/* Where this line starts in the log file */
+  int len;			/* Length of the line, including the newline */
+}WatchRow;
+
+typedef struct WatchLog_Struct{
+  WatchRow *rows;		/* Sorted by info.mjd */
+  int nrows,nalloc;
+  char logpath[1024];
+  FILE *outlog;			/* NULL until we know what to call it */
+}WatchLog;
+
+/* Set by SIGINT or SIGTERM to get out of the event loop */
+static volatile sig_atomic_t watch_stop = 0;
+
+static void watch_signal(int sig)
+{
+  watch_stop = 1;
+}
+
+
+/* Index of the row for the same exposure (raw or reduced), or -1 */
+static int watch_find_base(const WatchLog *wl, const char *base)
+{
+  int ii;
+
+  /* Newest frames are at the end, and those are the ones likely to be replaced */
+  for (ii=wl->nrows-1; ii>=0; ii--) {
+    if (strcmp(wl->rows[ii].base,base) == 0)
+      return ii;
+  }
+  return -1;
+}
+
+
+/* Where a row with this MJD goes. After any rows with an equal MJD */
+static int watch_find_insert(const WatchLog *wl, double mjd)
+{
+  int lo,hi,mid;
+
+  lo = 0;
+  hi = wl->nrows;
+  while (lo < hi) {
+    mid = (lo+hi)/2;
+    if (wl->rows[mid].info.mjd <= mjd)
+      lo = mid+1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+
+static int watch_insert(WatchLog *wl, int pos, const LogInfo *info)
+{
+  WatchRow *newrows,*row;
+  char *flag;
+
+  if (wl->nrows == wl->nalloc) {
+    wl->nalloc = wl->nalloc ? 2*wl->nalloc : 256;
+    newrows = (WatchRow *)realloc(wl->rows,wl->nalloc*sizeof(WatchRow));
+    if (newrows == NULL)
+      return 1;
+    wl->rows = newrows;
+  }
+
+  memmove(&wl->rows[pos+1],&wl->rows[pos],(wl->nrows-pos)*sizeof(WatchRow));
+  wl->nrows++;
+
+  row = &wl->rows[pos];
+  row->info = *info;
+  night_exposure_base(info->exposure,row->base);
+  flag = strrchr(info->exposure,'_');
+  row->p = flag ? atoi(flag+1) : 0;
+  row->offset = -1;
+  row->len = 0;
+
+  return 0;
+}
+
+
+static void watch_remove(WatchLog *wl, int pos)
+{
+  memmove(&wl->rows[pos],&wl->rows[pos+1],(wl->nrows-pos-1)*sizeof(WatchRow));
+  wl->nrows--;
+}
+
+
+/*
+ * Write the log from row first onwards and cut the file off after the last row.
+ * Everything before row first is already correct in the file.
+ */
+static int watch_write_from(WatchLog *wl, int first)
+{
+  char line[1024];
+  long offset;
+  int ii;
+
+  if (wl->outlog == NULL)
+    return 1;
+
+  if (first == 0)
+    offset = LOG_HEADER_LEN;
+  else
+    offset = wl->rows[first-1].offset + wl->rows[first-1].len;
+
+  if (fseek(wl->outlog,offset,SEEK_SET) != 0)
+    return 1;
+
+  for (ii=first; ii<wl->nrows; ii++) {
+    wl->rows[ii].len = format_log_row(line,sizeof(line),&wl->rows[ii].info);
+    if (wl->rows[ii].len >= (int)sizeof(line))
+      wl->rows[ii].len = sizeof(line)-1;
+    wl->rows[ii].offset = offset;
+    fwrite(line,1,wl->rows[ii].len,wl->outlog);
+    offset += wl->rows[ii].len;
+  }
+
+  fflush(wl->outlog);
+  if (ftruncate(fileno(wl->outlog),offset) != 0)
+    return 1;
+
+  return 0;
+}
+
+
+static int watch_open_log(WatchLog *wl, FILE *proglog)
+{
+  wl->outlog = fopen(wl->logpath,"w");
+  if (wl->outlog == NULL) {
+    printf("Could not open output file (%d): %s\n",-53,wl->logpath);
+    fprintf(proglog,"Could not open output file (%d): %s\n",-53,wl->logpath);
+    return 1;
+  }
+  log_header_write(wl->outlog);
+  fprintf(proglog,"Watch mode is writing %s\n",wl->logpath);
+  fflush(proglog);
+  return 0;
+}
+
+
+/*
+ * Read one new file and put it in the log
+ */
+static void watch_new_file(WatchLog *wl, LogRun *run, const ExtractConfig *cfg, const char *name, int name_log)
+{
+  LogJob job;
+  LTFileName cur;
+  char base[FILENAME_LENGTH],line[1024];
+  int old,pos,first;
+
+  if (chop_filename((char *)name,&cur) != 0 || strncmp(cur.ext,"fits",4) != 0)
+    return;
+
+  /* The first frame of the night names the log, unless it was named on the command line */
+  if (wl->outlog == NULL && name_log) {
+    sprintf(wl->logpath,"%s/%s.log",cfg->dirname,cur.date);
+    if (watch_open_log(wl,run->proglog))
+      return;
+  }
+
+  fprintf(run->proglog,"current exposure : %s\n",cur.exposure);
+
+  /* If a more reduced version of this exposure is already logged, this one adds nothing */
+  night_exposure_base(cur.exposure,base);
+  old = watch_find_base(wl,base);
+  if (old >= 0 && wl->rows[old].p > atoi(cur.p)) {
+    fprintf(run->proglog,"Reduced data is available, so we will ignore this file.\n");
+    fflush(run->proglog);
+    return;
+  }
+
+  job.cur = cur;
+  job.no_dprt = (cur.p[0] == '0');
+  job.from_cache = 0;
+  job.inode = 0;
+  job.cfg = cfg;
+  job.pending = NULL;
+  extract_LogInfo(cfg,&job);
+
+  if (job.status == 41) {
+    fprintf(run->proglog,"Failed to open FITS (%d)- %s\n",41,cur.exposure);
+    printf("Failed to open FITS (%d)- %s\n",41,cur.exposure);
+    run->badfilect++;
+    fflush(run->proglog);
+    return;
+  }
+  if (job.status) {
+    job.info.error = job.status;
+    fprintf(run->proglog,"A FITSIO error has occured: %d\n",job.status);
+  }
+
+  /* Out with the raw (or previous) version of this exposure, in with the new one */
+  first = wl->nrows;
+  if (old >= 0) {
+    fprintf(run->proglog,"Replacing %s in the log\n",wl->rows[old].info.exposure);
+    watch_remove(wl,old);
+    first = old;
+  }
+
+  pos = watch_find_insert(wl,job.info.mjd);
+  if (watch_insert(wl,pos,&job.info))
+    return;
+  if (pos < first)
+    first = pos;
+
+  if (watch_write_from(wl,first))
+    fprintf(run->proglog,"Failed to update %s\n",wl->logpath);
+
+  if (!run->quiet) {
+    format_log_row(line,sizeof(line),&job.info);
+    fputs(line,stdout);
+    fflush(stdout);
+  }
+
+  fprintf(run->proglog,"Finished with %s\n",cur.exposure);
+  fflush(run->proglog);
+}
+
+
+/*
+ * Start watching dirname for new frames. Call it before listing the directory.
+ * Returns the inotify descriptor, or -1 if it could not be set up.
+ */
+int watch_begin(const char *dirname)
+{
+  int ifd;
+
+  ifd = inotify_init();
+  if (ifd >= 0 && inotify_add_watch(ifd,dirname,IN_CLOSE_WRITE|IN_MOVED_TO) < 0) {
+    close(ifd);
+    ifd = -1;
+  }
+  return ifd;
+}
+
+
+/*
+ * Stay resident and keep the log up to date as new frames arrive, until SIGINT or SIGTERM.
+ * The log starts from the filect rows already in run->table, taken in the order
+ * given by order[]. logpath is the log to maintain. If it is NULL the log is named after
+ * the date in the first new frame, as main() would have. The events come from
+ * run->watch_fd, from watch_begin(), starting with any queued while the night was read.
+ * Returns 0 on a clean exit, non-zero if inotify could not be set up.
+ */
+int watch_directory(LogRun *run, const ExtractConfig *cfg, const unsigned int *order, const char *logpath)
+{
+  WatchLog wl;
+  LogInfo info;
+  struct sigaction sa;
+  struct inotify_event *ev;
+  char evbuf[64*(sizeof(struct inotify_event)+256)];
+  char *ptr;
+  ssize_t len;
+  int ifd,ii;
+
+  wl.rows = NULL;
+  wl.nrows = wl.nalloc = 0;
+  wl.outlog = NULL;
+
+  ifd = run->watch_fd;
+  if (ifd < 0) {
+    printf("Unable to watch directory %s\n",cfg->dirname);
+    fprintf(run->proglog,"Unable to watch directory %s\n",cfg->dirname);
+    return 1;
+  }
+
+  /* Start from what the normal run found */
+  for (ii=0; ii<run->filect; ii++) {
+    logtable_row(&run->table,order[ii],&info);
+    watch_insert(&wl,ii,&info);
+  }
+  if (logpath != NULL) {
+    strcpy(wl.logpath,logpath);
+    if (watch_open_log(&wl,run->proglog) == 0)
+      watch_write_from(&wl,0);
+  }
+
+  memset(&sa,0,sizeof(sa));
+  sa.sa_handler = watch_signal;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = 0;		/* No SA_RESTART. We want read() to give up on a signal */
+  sigaction(SIGINT,&sa,NULL);
+  sigaction(SIGTERM,&sa,NULL);
+
+  fprintf(run->proglog,"Watching %s for new files\n",cfg->dirname);
+  fflush(run->proglog);
+
+  while (!watch_stop) {
+    len = read(ifd,evbuf,sizeof(evbuf));
+    if (len < 0) {
+      if (errno == EINTR)
+	continue;
+      break;
+    }
+
+    for (ptr=evbuf; ptr<evbuf+len; ptr+=sizeof(struct inotify_event)+ev->len) {
+      ev = (struct inotify_event *)ptr;
+      /* The directory itself went away */
+      if (ev->mask & IN_IGNORED)
+	watch_stop = 1;
+      else if (ev->mask & IN_Q_OVERFLOW) {
+	printf("Too many new files at once for inotify. Some may be missing from the log\n");
+	fprintf(run->proglog,"Too many new files at once for inotify. Some may be missing from the log\n");
+      }
+      else if (ev->len > 0 && !(ev->mask & IN_ISDIR))
+	watch_new_file(&wl,run,cfg,ev->name,logpath==NULL);
+    }
+  }
+
+  fprintf(run->proglog,"Stopped watching. %d files in the log\n",wl.nrows);
+  close(ifd);
+  run->watch_fd = -1;
+  if (wl.outlog)
+    fclose(wl.outlog);
+  free(wl.rows);
+
+  return 0;
+}
+
+#else
+
+int watch_begin(const char *dirname)
+{
+  return -1;
+}
+
+
+int watch_directory(LogRun *run, const ExtractConfig *cfg, const unsigned int *order, const char *logpath)
+{
+  printf("--watch needs inotify, which is only available on Linux\n");
+  fprintf(run->proglog,"--watch needs inotify, which is only available on Linux\n");
+  return 1;
+}
+
+#endif
@@ -0,0 +1,239 @@
+/*
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+A very small pool of worker threads for the `-j N' mode. night_scan() in autolog_night.c
+only decides which files need reading and hands each one over as a LogJob. The workers
+pull jobs off a FIFO and run extract_LogInfo() on them. Each worker opens its own
+fitsfile, so cFITSIO must have been built reentrant (./configure --enable-reentrant).
+
+Nothing is reordered here. The jobs live in the night's LogStore, in the order
+night_scan() submitted them, and night_collect() only looks at the results once
+workqueue_wait() says they have all been read, so the output is identical to a serial
+run. This is the same whether the night is read by the command line or a libautolog
+session.
+
+With --reader=uring each worker instead keeps up to URING_DEPTH files in flight through
+its own io_uring, so even -j 1 starts one. See autolog_uring.c.
+
+Each job carries its own ExtractConfig, so with --batch one pool serves every night.
+Whichever worker is free takes the next file, whatever night it is from, so a night with
+a few big files does not hold the others up.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+
+/*
+ * Next job off the queue, or NULL if there is none. With wait set, sleeps until there is
+ * one, and only returns NULL once the queue has been closed and emptied.
+ */
+LogJob *workqueue_take(WorkQueue *wq, int wait)
+{
+  LogJob *job;
+
+  pthread_mutex_lock(&wq->lock);
+  while (wait && wq->head == NULL && !wq->closed)
+    pthread_cond_wait(&wq->ready,&wq->lock);
+  job = wq->head;
+  if (job != NULL) {
+    wq->head = job->qnext;
+    if (wq->head == NULL) wq->tail = NULL;
+  }
+  pthread_mutex_unlock(&wq->lock);
+
+  return job;
+}
+
+
+/* A worker has finished reading job */
+void workqueue_done(WorkQueue *wq, LogJob *job)
+{
+  pthread_mutex_lock(&wq->lock);
+  if (job->pending != NULL)
+    (*job->pending)--;
+  pthread_cond_broadcast(&wq->done);
+  pthread_mutex_unlock(&wq->lock);
+}
+
+
+static void *workqueue_worker(void *arg)
+{
+  WorkQueue *wq;
+  LogJob *job;
+  int worker;
+
+  wq = (WorkQueue *)arg;
+
+  /* Which worker this is, for --trace */
+  pthread_mutex_lock(&wq->lock);
+  worker = wq->next_worker++;
+  pthread_mutex_unlock(&wq->lock);
+
+  /* With --reader=uring this only returns if the ring stops working, having finished
+   * every job it took. Anything left is then read here, one file at a time */
+  if (wq->uring)
+    uring_worker(wq,worker);
+
+  /* Queue is empty and closed once this gives NULL. Nothing more will arrive */
+  while ((job = workqueue_take(wq,1)) != NULL) {
+    job->worker = worker;
+    extract_LogInfo(job->cfg,job);
+    workqueue_done(wq,job);
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Start nthreads workers reading files with the given READER_*. If nthreads is 1 or less
+ * no threads are created and workqueue_submit() does the work inline, unless the reader
+ * is READER_URING and io_uring works here. io is the --io-files and --io-rate limits the
+ * io_uring workers have to keep to, or NULL. The others keep to them in extract_LogInfo().
+ * Returns the number of threads actually started.
+ */
+int workqueue_start(WorkQueue *wq, int nthreads, int reader, IoPolicy *io)
+{
+  int ii;
+
+  wq->head = wq->tail = NULL;
+  wq->closed = 0;
+  wq->nthreads = 0;
+  wq->next_worker = 1;
+  wq->uring = 0;
+  wq->io = io;
+  wq->threads = NULL;
+
+  /* The ring does the waiting, so one thread is enough to keep many files in flight */
+  if (reader == READER_URING) {
+    if (uring_available()) {
+      wq->uring = 1;
+      if (nthreads < 1) nthreads = 1;
+    }
+    else
+      printf("io_uring is not available. Reading headers one at a time with --reader=raw.\n");
+  }
+
+  if (nthreads <= 1 && !wq->uring)
+    return 0;
+
+  /* The raw reader has no shared state, but cFITSIO only does if it was built to be reentrant */
+  if (reader == READER_CFITSIO && !fits_is_reentrant()) {
+    printf("cFITSIO was not built reentrant. Reading files in a single thread.\n");
+    return 0;
+  }
+
+  pthread_mutex_init(&wq->lock,NULL);
+  pthread_cond_init(&wq->ready,NULL);
+  pthread_cond_init(&wq->done,NULL);
+
+  wq->threads = (pthread_t *)malloc(nthreads*sizeof(pthread_t));
+  if (wq->threads == NULL)
+    return 0;
+
+  for (ii=0; ii<nthreads; ii++) {
+    if (pthread_create(&wq->threads[wq->nthreads],NULL,workqueue_worker,wq) != 0) {
+      printf("Only able to start %d of %d worker threads\n",wq->nthreads,nthreads);
+      break;
+    }
+    wq->nthreads++;
+  }
+
+  return wq->nthreads;
+}
+
+
+/*
+ * Hand a job to the pool. In serial mode it is read before this returns.
+ * Otherwise *job->pending (if job->pending is set) is counted up now and down again
+ * once the job has been read.
+ */
+void workqueue_submit(WorkQueue *wq, LogJob *job)
+{
+  if (wq->nthreads == 0) {
+    job->worker = 0;
+    extract_LogInfo(job->cfg,job);
+    return;
+  }
+
+  job->qnext = NULL;
+  pthread_mutex_lock(&wq->lock);
+  if (job->pending != NULL)
+    (*job->pending)++;
+  if (wq->tail == NULL)
+    wq->head = job;
+  else
+    wq->tail->qnext = job;
+  wq->tail = job;
+  pthread_cond_signal(&wq->ready);
+  pthread_mutex_unlock(&wq->lock);
+}
+
+
+/*
+ * Wait until every job submitted with this pending counter has been read.
+ */
+void workqueue_wait(WorkQueue *wq, unsigned int *pending)
+{
+  if (wq->nthreads == 0)
+    return;
+
+  pthread_mutex_lock(&wq->lock);
+  while (*pending > 0)
+    pthread_cond_wait(&wq->done,&wq->lock);
+  pthread_mutex_unlock(&wq->lock);
+}
+
+
+/*
+ * No more jobs are coming. Wait for the workers to empty the queue and exit.
+ * Every job submitted has been read by the time this returns.
+ */
+void workqueue_finish(WorkQueue *wq)
+{
+  int ii;
+
+  if (wq->nthreads == 0)
+    return;
+
+  pthread_mutex_lock(&wq->lock);
+  wq->closed = 1;
+  pthread_cond_broadcast(&wq->ready);
+  pthread_mutex_unlock(&wq->lock);
+
+  for (ii=0; ii<wq->nthreads; ii++)
+    pthread_join(wq->threads[ii],NULL);
+
+  free(wq->threads);
+  wq->threads = NULL;
+  wq->nthreads = 0;
+  pthread_cond_destroy(&wq->ready);
+  pthread_cond_destroy(&wq->done);
+  pthread_mutex_destroy(&wq->lock);
+}
@@ -0,0 +1,88 @@
+/*   
+    Copyright 2006, Astrophysics Research Institute, Liverpool John Moores University.
+
+    This file is part of autolog.
+
+    autolog is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    autolog is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with autolog; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+libautolog. The same header extraction as the autolog command, for a program which wants
+the rows of a night's log without running autolog and reading the log back in. A session
+holds what is worth keeping from one night to the next: the schema, already hashed, and the
+worker threads. Each night read with it gives its LogInfo rows in memory, sorted, and may
+also be written out as the command line would write it.
+
+  AutologConfig config;
+  AutologSession *session;
+  AutologNight *night;
+  unsigned int ii;
+  int error;
+
+  autolog_config_init(&config);
+  config.nthreads = 8;
+  session = autolog_session_open(&config);
+  night = autolog_night_read(session,"/data/20240101",NULL,0,&error);
+  for(ii=0; ii<autolog_night_count(night); ii++)
+    puts(autolog_night_row(night,ii)->exposure);
+  autolog_night_close(night);
+  autolog_session_close(session);
+
+Each night still writes its autolog_status.log (and keeps its --cache) in its directory,
+just as the command line does. Nothing is printed on stdout, except to say what is
+wrong with a schema file or a --sort list.
+
+A session may only be used by one thread at a time, though separate sessions may be used
+from separate threads at once. Its nights stay valid until they are closed, whatever else
+the session goes on to read. The rows are kept packed, and autolog_night_row() unpacks
+one into the night, so each is only good until the next call.
+*/
+#ifndef _LIBAUTOLOG_H
+#define _LIBAUTOLOG_H
+
+#include <stdio.h>
+
+#include "fitsio.h"
+#include "lt_filenames.h"
+#include "autolog.h"
+
+/* How a session reads, as the command line options of the same names */
+typedef struct AutologConfig_Struct{
+  int nthreads;			/* -j. 1 reads each file in the calling thread */
+  int reader;			/* --reader, READER_* */
+  int open_order;		/* --open-order, OPEN_ORDER_* */
+  int use_cache;		/* --cache */
+  const char *schema;		/* --schema, or NULL for the built in one */
+  int pagecache_drop;		/* --pagecache=drop */
+  int io_files;			/* --io-files. 0 is no limit */
+  double io_rate;		/* --io-rate, in bytes a second. 0 is no limit */
+}AutologConfig;
+
+typedef struct AutologSession_Struct AutologSession;
+typedef struct AutologNight_Struct AutologNight;
+
+/* autolog_api.c */
+void autolog_config_init(AutologConfig *config);
+AutologSession *autolog_session_open(const AutologConfig *config);
+const Schema *autolog_session_schema(const AutologSession *session);
+void autolog_session_close(AutologSession *session);
+AutologNight *autolog_night_read(AutologSession *session, const char *dirname, char **names, int nnames, int *error);
+int autolog_night_sort(AutologNight *night, const char *keys);
+unsigned int autolog_night_count(const AutologNight *night);
+const LogInfo *autolog_night_row(AutologNight *night, unsigned int ii);
+int autolog_night_write(AutologNight *night, int formats, const char *logname);
+void autolog_night_close(AutologNight *night);
+
+#endif
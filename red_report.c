@@ -83,6 +83,10 @@ int main(int argc, char**argv)
   /* Misc variable initialisation */
   Autolog_Error = 0;		/* Value returned on exit */
   LogInfo_vec = NULL;		/* Set to NULL so first call to realloc does not cause a crash */
+  data_indices = NULL;
+  outlog = NULL;
+  filters[0] = '\0';
+  instrument[0] = '\0';
 
   badfilect = 0;		/* Number of files in the designated directory which were rejected and not read */
   filect = 0;			/* Number of files for which data if currently held in *LogInfo_vec */
@@ -172,7 +176,6 @@ int main(int argc, char**argv)
 	        fprintf(proglog,"Failed to open FITS (%d)- %s\n",Autolog_Error,cur.exposure);
 	        printf("Failed to open FITS (%d)- %s\n",Autolog_Error,cur.exposure);
 	        badfilect++;
-	        LogInfo_vec[filect].error = -1;
 	        fits_stat = 1;		/* This will prevent any FITSIO commands being executed */
 	      }
 	    }
@@ -228,10 +231,12 @@ int main(int argc, char**argv)
 	    printf("Filters: %s\n",filters);
 
 	    /* Read everything I want. Close the file and clean up */
-            fits_close_file(fitsin,&fits_stat);
+	    /* fitsin is still the last file if this one was skipped, and that is closed already */
+	    if(!skip_this_file && fitsin)
+	      fits_close_file(fitsin,&fits_stat);
+	    fitsin = NULL;
 
 	    if(fits_stat && !skip_this_file){
-	      LogInfo_vec[filect].error = fits_stat;
 	      fprintf(proglog,"A FITSIO error has occured: %d\n",fits_stat);
 	    }
 
@@ -275,10 +280,15 @@ int check_header_flag(char keyword[9], char* task, FILE* proglog, fitsfile* fits
   int fits_stat,status;
   char comment[FC];
 
+  /* Skipped, or failed to open */
+  if(fitsin == NULL)
+    return 0;
+
+  fits_stat = 0;
   printf("%s : ",task);
   ffgky(fitsin,TINT,keyword,&status,comment,&fits_stat);
   /* If FITS keyword does not exist, this file has not been reduced */
-  if(fits_stat==VALUE_UNDEFINED){
+  if(fits_stat==VALUE_UNDEFINED || fits_stat==KEY_NO_EXIST){
     printf("File has not been reduced\n");
     fprintf(proglog,"File has not been reduced\n");
     fits_stat = 0;
@@ -452,7 +462,6 @@ void init_LogInfo(LogInfo *to_init){
   to_init->mjd = 0;
   to_init->airmass = 0;
   sprintf(to_init->instrume,"        ");
-  sprintf(to_init->obstype,"         ");
   to_init->exptime = 0;
   sprintf(to_init->grating,"    ");
   sprintf(to_init->filter,"                        ");